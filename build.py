@@ -30,6 +30,9 @@ def main():
     build_metron_app()
     build_metron_test()
     build_rvtests()
+    build_metron_test_goldens()
+    build_metron_test_emitters()
+    build_translate_benchmark()
     build_uart()
     build_rvsimple()
     # build_pinwheel()
@@ -37,6 +40,7 @@ def main():
     build_pong()
     #build_j1()
     build_gb_spu()
+    build_benchmarks()
     print("Done!")
     outfile.close()
     outfile = None
@@ -107,8 +111,20 @@ ninja.rule(name="link",
 ninja.rule(name="metron", # yes, we run metron with quiet and verbose both on for test coverage
            command="bin/metron -q -v -c ${in} -o ${out}")
 
+ninja.rule(name="metron_reflect",
+           command="bin/metron -q -c ${in} --reflect ${out}")
+
+ninja.rule(name="metron_bind",
+           command="bin/metron -q -c ${in} --bind ${out}")
+
+ninja.rule(name="metron_profile",
+           command="bin/metron -q -c ${in} --profile ${dst_dir}")
+
+ninja.rule(name="metron_coverage",
+           command="bin/metron -q -c ${in} --coverage ${dst_dir}")
+
 ninja.rule(name="verilator",
-           command="verilator --public ${includes} --cc ${src_top} -Mdir ${dst_dir}")
+           command="verilator --public ${flags} ${includes} --cc ${src_top} -Mdir ${dst_dir}")
 
 ninja.rule(name="make",
            command="make --quiet -C ${dst_dir} -f ${makefile} > /dev/null")
@@ -159,7 +175,55 @@ def metronize_dir(src_dir, src_top, dst_dir):
     return dst_paths
 
 
-def verilate_dir(src_dir, src_files, src_top, dst_dir):
+def reflect_header(src_path, dst_path):
+    """
+    Generate the reflection tables for a Metron source file.
+    """
+    ninja.build(rule="metron_reflect",
+                inputs=[src_path],
+                implicit=["bin/metron"],
+                outputs=[dst_path])
+    return dst_path
+
+
+def bind_header(src_path, dst_path):
+    """
+    Generate the Verilator adapter header for a Metron source file.
+    """
+    ninja.build(rule="metron_bind",
+                inputs=[src_path],
+                implicit=["bin/metron"],
+                outputs=[dst_path])
+    return dst_path
+
+
+def profile_sources(src_path, dst_dir):
+    """
+    Generate the instrumented profiling copy of a Metron source file.
+    """
+    dst_path = f"{dst_dir}/{path.basename(src_path)}"
+    ninja.build(rule="metron_profile",
+                inputs=[src_path],
+                implicit=["bin/metron"],
+                outputs=[dst_path],
+                dst_dir=dst_dir)
+    return dst_path
+
+
+def coverage_sources(src_path, dst_dir):
+    """
+    Generate the instrumented coverage copy of a Metron source file.
+    """
+    dst_path = f"{dst_dir}/{path.basename(src_path)}"
+    ninja.build(rule="metron_coverage",
+                inputs=[src_path],
+                implicit=["bin/metron"],
+                outputs=[dst_path],
+                dst_dir=dst_dir)
+    return dst_path
+
+
+def verilate_dir(src_dir, src_files, src_top, dst_dir, flags=""):
     """
     Run Verilator on all .sv files in the source directory, using "src_top" as
     the top module. Returns the full paths of "V<src_top>.h" and
@@ -177,7 +241,8 @@ def verilate_dir(src_dir, src_files, src_top, dst_dir):
                 outputs=[verilated_make, verilated_hdr],
                 includes=["-Isrc", f"-I{src_dir}"],
                 src_top=src_top,
-                dst_dir=dst_dir)
+                dst_dir=dst_dir,
+                flags=flags or None)
 
     # Compile via makefile to generate object file
     ninja.build(rule="make",
@@ -302,21 +367,27 @@ def build_metron_lib():
         lib_name="bin/libmetron.a",
         src_files=[
             "src/Err.cpp",
+            "src/MtBind.cpp",
             "src/MtChecker.cpp",
             "src/MtContext.cpp",
+            "src/MtCoverage.cpp",
             "src/MtCursor.cpp",
             "src/MtField.cpp",
             "src/MtFuncParam.cpp",
             "src/MtInstance.cpp",
+            "src/MtInstrument.cpp",
             "src/MtMethod.cpp",
             "src/MtModLibrary.cpp",
             "src/MtModParam.cpp",
             "src/MtModule.cpp",
             "src/MtNode.cpp",
+            "src/MtProfile.cpp",
+            "src/MtReflect.cpp",
             "src/MtSourceFile.cpp",
             "src/MtStruct.cpp",
             "src/MtTracer.cpp",
             "src/MtTracer2.cpp",
+            "src/MtTranslate.cpp",
             "src/MtUtils.cpp",
             "src/Platform.cpp",
         ],
@@ -462,21 +533,27 @@ cpp_binary2(
         "src/MetronApp.cpp",
         "src/Platform.cpp",
         "src/Err.cpp",
+        "src/MtBind.cpp",
         "src/MtChecker.cpp",
         "src/MtContext.cpp",
+        "src/MtCoverage.cpp",
         "src/MtCursor.cpp",
         "src/MtField.cpp",
         "src/MtFuncParam.cpp",
         "src/MtInstance.cpp",
+        "src/MtInstrument.cpp",
         "src/MtMethod.cpp",
         "src/MtModLibrary.cpp",
         "src/MtModParam.cpp",
         "src/MtModule.cpp",
         "src/MtNode.cpp",
+        "src/MtProfile.cpp",
+        "src/MtReflect.cpp",
         "src/MtSourceFile.cpp",
         "src/MtStruct.cpp",
         "src/MtTracer.cpp",
         "src/MtTracer2.cpp",
+        "src/MtTranslate.cpp",
         "src/MtUtils.cpp",
     ],
     src_objs=treesitter_objs_wasi,
@@ -497,12 +574,63 @@ def build_metron_test():
         src_files=[
             "tests/test_main.cpp",
             "tests/test_logic.cpp",
+            "tests/test_sim.cpp",
             "tests/test_utils.cpp",
         ],
         includes=base_includes,
         link_deps=["bin/libmetron.a"],
     )
 
+# ------------------------------------------------------------------------------
+# In-process conversion tests for metron_good/metron_bad
+
+def build_metron_test_goldens():
+    cpp_binary(
+        bin_name="bin/metron_test_goldens",
+        src_files=[
+            "tests/test_goldens.cpp",
+        ],
+        includes=base_includes,
+        link_deps=["bin/libmetron.a"],
+    )
+
+# ------------------------------------------------------------------------------
+# Tests that compile and run what metron's generators emit for the fixtures in
+# tests/metron_emit
+
+def build_metron_test_emitters():
+    emit_src = "tests/metron_emit/emit_top.h"
+    emit_root = "gen/tests/metron_emit"
+
+    gen_hdrs = [
+        reflect_header(emit_src, f"{emit_root}/emit_top_reflect.h"),
+        bind_header(emit_src, f"{emit_root}/emit_top_vl.h"),
+        profile_sources("tests/metron_emit/emit_prof.h", f"{emit_root}/profile"),
+        coverage_sources("tests/metron_emit/emit_cov.h", f"{emit_root}/coverage"),
+    ]
+
+    cpp_binary(
+        bin_name="bin/metron_test_emitters",
+        src_files=[
+            "tests/test_emitters.cpp",
+        ],
+        includes=base_includes + [emit_root],
+        deps=gen_hdrs,
+    )
+
+# ------------------------------------------------------------------------------
+# Translator throughput benchmark
+
+def build_translate_benchmark():
+    cpp_binary(
+        bin_name="bin/translate_benchmark",
+        src_files=[
+            "tests/translate_benchmark.cpp",
+        ],
+        includes=base_includes,
+        link_deps=["bin/libmetron.a"],
+    )
+
 # ------------------------------------------------------------------------------
 
 def build_j1():
@@ -740,6 +868,69 @@ def build_pong():
     metronized_src = metronize_dir(mt_root, "pong.h", sv_root)
 
 # ------------------------------------------------------------------------------
+# Simulation-rate benchmarks. Each example's bench.cpp is built natively and,
+# as bench_vl.cpp, against its Verilated model through the "metron --bind"
+# adapter. Always optimized, whatever the build mode. run_benchmarks.py runs
+# them all and collects the table.
+
+bench_build_mode = "-rdynamic -O3"
+
+
+def bench_pair(name, mt_src, vl_hdr, vl_obj):
+    vl_root = path.dirname(vl_hdr)
+    mt_top = path.basename(mt_src)[:-2]
+
+    cpp_binary(
+        bin_name=f"bin/examples/{name}_bench",
+        src_files=[f"examples/{name}/bench.cpp"],
+        includes=base_includes,
+        cpp_build_mode=bench_build_mode,
+    )
+
+    bind_hdr = bind_header(mt_src, f"{vl_root}/{mt_top}_vl.h")
+
+    cpp_binary(
+        bin_name=f"bin/examples/{name}_bench_vl",
+        src_files=[f"examples/{name}/bench_vl.cpp"],
+        includes=base_includes + [vl_root],
+        src_objs=["obj/verilated.o", "obj/verilated_threads.o", vl_obj],
+        deps=[vl_hdr, bind_hdr],
+        cpp_build_mode=bench_build_mode,
+    )
+
+    return [f"bin/examples/{name}_bench", f"bin/examples/{name}_bench_vl"]
+
+
+def build_benchmarks():
+    bins = []
+
+    # The uart testbench's Verilated model has repeat_msg = 0, the benchmark
+    # needs 1 so the design never goes idle.
+    uart_vhdr, uart_vobj = verilate_dir(
+        src_dir="examples/uart/metron_sv",
+        src_files=glob.glob("examples/uart/metron_sv/*.sv"),
+        src_top="uart_top",
+        dst_dir="gen/examples/uart/bench_vl",
+        flags="-Grepeat_msg=1",
+    )
+    bins += bench_pair("uart", "examples/uart/metron/uart_top.h", uart_vhdr, uart_vobj)
+
+    # Same model as bin/examples/rvsimple_vl, verilated in build_rvsimple().
+    bins += bench_pair("rvsimple", "examples/rvsimple/metron/toplevel.h",
+                       "gen/examples/rvsimple/metron_vl/Vtoplevel.h",
+                       "gen/examples/rvsimple/metron_vl/Vtoplevel__ALL.o")
+
+    pong_vhdr, pong_vobj = verilate_dir(
+        src_dir="examples/pong/metron_sv",
+        src_files=glob.glob("examples/pong/metron_sv/*.sv"),
+        src_top="pong",
+        dst_dir="gen/examples/pong/metron_vl",
+    )
+    bins += bench_pair("pong", "examples/pong/metron/pong.h", pong_vhdr, pong_vobj)
+
+    ninja.build(rule="phony", inputs=bins, outputs="benchmarks")
+
+# ------------------------------------------------------------------------------
 
 
 """"
@@ -0,0 +1,59 @@
+#include <stdio.h>
+
+#include "metron_sim.h"
+#include "submodules/CLI11/include/CLI/App.hpp"
+#include "submodules/CLI11/include/CLI/Config.hpp"
+#include "submodules/CLI11/include/CLI/Formatter.hpp"
+
+#ifdef BENCH_VL
+#include "Vpong.h"
+#include "pong_vl.h"
+#else
+#include "metron/pong.h"
+#endif
+
+//------------------------------------------------------------------------------
+// Simulation-rate benchmark for pong, headless. bench_vl.cpp builds this same
+// file against the Verilated model, driven through the adapter from
+// "metron --bind".
+
+#ifdef BENCH_VL
+typedef Pong_vl<Vpong> top_t;
+static const char* model = "verilator";
+#else
+typedef Pong top_t;
+static const char* model = "metron";
+#endif
+
+int main(int argc, char** argv) {
+  CLI::App app{"pong simulation-rate benchmark"};
+
+  uint64_t cycles = 100000000;
+  uint64_t warmup = 1000000;
+  int trials = 5;
+  bool header = false;
+
+  app.add_option("-c,--cycles", cycles, "Cycles per trial");
+  app.add_option("-w,--warmup", warmup, "Untimed cycles before the first trial");
+  app.add_option("-t,--trials", trials, "Number of timed trials");
+  app.add_flag("--header", header, "Print the column names first");
+  CLI11_PARSE(app, argc, argv);
+
+  top_t top;
+
+  auto r = sim_bench(cycles, warmup, trials, [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      top.tock_video();
+      top.tock_game(0, 0);
+      sim_cycle(top);
+    }
+    sim_bench_keep(top);
+    return uint64_t(0);
+  });
+
+  if (header) sim_bench_print_header(stdout);
+  sim_bench_print(stdout, "pong", model, r);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
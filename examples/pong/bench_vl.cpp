@@ -0,0 +1,3 @@
+// The pong benchmark, against the Verilated model.
+#define BENCH_VL
+#include "bench.cpp"
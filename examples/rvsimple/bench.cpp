@@ -0,0 +1,82 @@
+#include <stdio.h>
+
+#include <memory>
+
+#include "metron_sim.h"
+#include "submodules/CLI11/include/CLI/App.hpp"
+#include "submodules/CLI11/include/CLI/Config.hpp"
+#include "submodules/CLI11/include/CLI/Formatter.hpp"
+
+#ifdef BENCH_VL
+#include "Vtoplevel.h"
+#include "Vtoplevel___024root.h"
+#include "toplevel_vl.h"
+#else
+#include "metron/toplevel.h"
+#endif
+
+//------------------------------------------------------------------------------
+// Simulation-rate benchmark for rvsimple. Runs tests/rv_tests/benchmark.S and
+// resets the core whenever it reports a pass, so a trial can be any length.
+// bench_vl.cpp builds this same file against the Verilated model, driven
+// through the adapter from "metron --bind".
+//
+// rvsimple is single-cycle, so every cycle outside of reset retires one
+// instruction.
+
+static const char* text_path = "tests/rv_tests/benchmark.text.vh";
+static const char* data_path = "tests/rv_tests/benchmark.data.vh";
+
+#ifdef BENCH_VL
+typedef toplevel_vl<Vtoplevel> top_t;
+static const char* model = "verilator";
+#else
+typedef toplevel top_t;
+static const char* model = "metron";
+#endif
+
+int main(int argc, char** argv) {
+  CLI::App app{"rvsimple simulation-rate benchmark"};
+
+  uint64_t cycles = 10000000;
+  uint64_t warmup = 100000;
+  int trials = 5;
+  bool header = false;
+
+  app.add_option("-c,--cycles", cycles, "Cycles per trial");
+  app.add_option("-w,--warmup", warmup, "Untimed cycles before the first trial");
+  app.add_option("-t,--trials", trials, "Number of timed trials");
+  app.add_flag("--header", header, "Print the column names first");
+  CLI11_PARSE(app, argc, argv);
+
+#ifdef BENCH_VL
+  auto top = std::make_unique<top_t>();
+  auto& text = top->vl.rootp->toplevel__DOT__text_memory_bus__DOT__text_memory__DOT__mem;
+  auto& data = top->vl.rootp->toplevel__DOT__data_memory_bus__DOT__data_memory__DOT__mem;
+  parse_hex(text_path, &text, sizeof(text));
+  parse_hex(data_path, &data, sizeof(data));
+#else
+  auto top = std::make_unique<top_t>(text_path, data_path);
+#endif
+
+  logic<1> reset = 1;
+
+  auto r = sim_bench(cycles, warmup, trials, [&](uint64_t n) {
+    uint64_t instret = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      top->reset = reset;
+      top->tock(0);
+      sim_cycle(*top);
+      instret += !reset;
+      reset = logic<32>(top->bus_address) == 0xfffffff0 && logic<1>(top->bus_write_enable);
+    }
+    sim_bench_keep(*top);
+    return instret;
+  });
+
+  if (header) sim_bench_print_header(stdout);
+  sim_bench_print(stdout, "rvsimple", model, r);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,61 @@
+#include <stdio.h>
+
+#include "metron_sim.h"
+#include "submodules/CLI11/include/CLI/App.hpp"
+#include "submodules/CLI11/include/CLI/Config.hpp"
+#include "submodules/CLI11/include/CLI/Formatter.hpp"
+
+#ifdef BENCH_VL
+#include "Vuart_top.h"
+#include "uart_top_vl.h"
+#else
+#include "metron/uart_top.h"
+#endif
+
+//------------------------------------------------------------------------------
+// Simulation-rate benchmark for the uart, with the message repeating so the
+// design never goes idle. bench_vl.cpp builds this same file against the
+// Verilated model (verilated with -Grepeat_msg=1), driven through the adapter
+// from "metron --bind".
+
+#ifdef BENCH_VL
+typedef uart_top_vl<Vuart_top, uart_top<3, 1>> top_t;
+static const char* model = "verilator";
+#else
+typedef uart_top<3, 1> top_t;
+static const char* model = "metron";
+#endif
+
+int main(int argc, char** argv) {
+  CLI::App app{"uart simulation-rate benchmark"};
+
+  uint64_t cycles = 100000000;
+  uint64_t warmup = 1000000;
+  int trials = 5;
+  bool header = false;
+
+  app.add_option("-c,--cycles", cycles, "Cycles per trial");
+  app.add_option("-w,--warmup", warmup, "Untimed cycles before the first trial");
+  app.add_option("-t,--trials", trials, "Number of timed trials");
+  app.add_flag("--header", header, "Print the column names first");
+  CLI11_PARSE(app, argc, argv);
+
+  top_t top;
+  top.tock(1);
+  sim_cycle(top);
+
+  auto r = sim_bench(cycles, warmup, trials, [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      top.tock(0);
+      sim_cycle(top);
+    }
+    sim_bench_keep(top);
+    return uint64_t(0);
+  });
+
+  if (header) sim_bench_print_header(stdout);
+  sim_bench_print(stdout, "uart", model, r);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,3 @@
+// The uart benchmark, against the Verilated model.
+#define BENCH_VL
+#include "bench.cpp"
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+import os
+import sys
+import subprocess
+import argparse
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--cycles', type=int, help='Cycles per trial, overrides each benchmark\'s default')
+parser.add_argument('--warmup', type=int, help='Untimed cycles before the first trial')
+parser.add_argument('--trials', type=int, default=5, help='Number of timed trials')
+parser.add_argument('--output', help='Also write the table to this file')
+parser.add_argument('--no-build', action='store_true', help='Don\'t run ninja first')
+options = parser.parse_args()
+
+################################################################################
+# Runs every example's simulation-rate benchmark, natively and against its
+# Verilated model, and prints one tab-separated table. The columns come from
+# sim_bench_print() in src/metron_sim.h. Compare runs with
+#
+#   ./run_benchmarks.py --output before.tsv
+#   ./run_benchmarks.py --output after.tsv
+#   diff before.tsv after.tsv
+
+benchmarks = [
+    "bin/examples/uart_bench",
+    "bin/examples/uart_bench_vl",
+    "bin/examples/rvsimple_bench",
+    "bin/examples/rvsimple_bench_vl",
+    "bin/examples/pong_bench",
+    "bin/examples/pong_bench_vl",
+]
+
+################################################################################
+
+
+def main():
+    if not options.no_build:
+        # rvsimple runs tests/rv_tests/benchmark.S, which isn't a build input.
+        if os.system("ninja benchmarks tests/rv_tests/benchmark.text.vh"):
+            print("Build failed!", file=sys.stderr)
+            return -1
+
+    args = ["--trials", str(options.trials)]
+    if options.cycles is not None:
+        args += ["--cycles", str(options.cycles)]
+    if options.warmup is not None:
+        args += ["--warmup", str(options.warmup)]
+
+    rows = []
+    errors = 0
+    for bench in benchmarks:
+        cmd = [bench, "--header"] + args
+        result = subprocess.run(cmd, stdout=subprocess.PIPE, encoding="utf-8")
+        if result.returncode:
+            print(f"{bench} failed with exit code {result.returncode}", file=sys.stderr)
+            errors += 1
+            continue
+        for line in result.stdout.splitlines():
+            # Keep only the first copy of the column names.
+            if line.startswith("example\t") and rows:
+                continue
+            print(line)
+            sys.stdout.flush()
+            rows.append(line)
+
+    if options.output:
+        with open(options.output, "w") as f:
+            f.write("\n".join(rows) + "\n")
+
+    return -1 if errors else 0
+
+
+################################################################################
+
+
+if __name__ == "__main__":
+    sys.exit(main())
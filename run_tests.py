@@ -130,6 +130,8 @@ def main():
         print_b("Running standalone tests")
         errors += check_commands_good([
             "bin/metron_test",
+            "bin/metron_test_goldens",
+            "bin/metron_test_emitters",
             "bin/examples/uart",
             "bin/examples/uart_vl",
             "bin/examples/uart_iv",
@@ -320,8 +322,9 @@ def build_lockstep(filename):
     # name the top module after the <test_name>.sv filename.
     mt_top = f"Module"
     vl_top = f"V{test_name}"
+    bind_top = f"Module_vl"
 
-    mt_header = f"{mt_root}/{test_name}.h"
+    bind_header = f"{sv_root}/{test_name}_vl.h"
     vl_header = f"{vl_root}/V{test_name}.h"
     vl_obj = f"{vl_root}/V{test_name}__ALL.o"
     test_obj = f"obj/{mt_root}/{test_name}.o"
@@ -331,7 +334,7 @@ def build_lockstep(filename):
 
     errors = 0
 
-    cmd = f"bin/metron -q -c {mt_root}/{test_name}.h -o {sv_root}/{test_name}.sv"
+    cmd = f"bin/metron -q -c {mt_root}/{test_name}.h -o {sv_root}/{test_name}.sv --bind {bind_header}"
     errors += check_cmd_good(cmd)
 
     cmd = f"verilator {includes} --cc {test_name}.sv -Mdir {vl_root}"
@@ -340,7 +343,7 @@ def build_lockstep(filename):
     cmd = f"make -C {vl_root} -f V{test_name}.mk"
     errors += check_cmd_good(cmd)
 
-    cmd = f"g++ -O3 -std=gnu++2a -DMT_TOP={mt_top} -DVL_TOP={vl_top} -DMT_HEADER={mt_header} -DVL_HEADER={vl_header} {includes} -c {test_src} -o {test_obj}"
+    cmd = f"g++ -O3 -std=gnu++2a -DMT_TOP={mt_top} -DVL_TOP={vl_top} -DBIND_TOP={bind_top} -DVL_HEADER={vl_header} -DBIND_HEADER={bind_header} {includes} -c {test_src} -o {test_obj}"
     errors += check_cmd_good(cmd)
 
     cmd = f"g++ {test_obj} {vl_obj} obj/verilated.o obj/verilated_threads.o -o {test_bin}"
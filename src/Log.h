@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <time.h>
 #include <stdarg.h>
+#include <string>
 
 //-----------------------------------------------------------------------------
 // TinyLog - simple console log with color coding, indentation, and timestamps
@@ -14,9 +15,11 @@ struct TinyLog {
   int _indentation = 0;
   bool _start_line = true;
   uint64_t _time_origin = 0;
+  std::string* _capture = nullptr; // if set, log text goes here instead
 
+  // One log per thread so independent translations don't share state.
   static TinyLog& get() {
-    static TinyLog log;
+    static thread_local TinyLog log;
     return log;
   }
 
@@ -64,6 +67,17 @@ struct TinyLog {
   void print_char(FILE* file, int c, uint32_t color) {
     if (_muted) return;
 
+    // Captured text is plain - no timestamps or color codes.
+    if (_capture) {
+      if (_start_line) {
+        _start_line = false;
+        _capture->append(_indentation, ' ');
+      }
+      _capture->push_back(char(c));
+      if (c == '\n') _start_line = true;
+      return;
+    }
+
     if (_start_line) {
       _start_line = false;
       print(file, 0, "[%07.3f] ", timestamp());
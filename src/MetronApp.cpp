@@ -1,15 +1,6 @@
 #include "Log.h"
-#include "MtContext.h"
-#include "MtCursor.h"
-#include "MtField.h"
-#include "MtInstance.h"
-#include "MtMethod.h"
-#include "MtModLibrary.h"
-#include "MtModule.h"
-#include "MtSourceFile.h"
-#include "MtStruct.h"
-#include "MtTracer.h"
-#include "MtTracer2.h"
+#include "MtTranslate.h"
+#include "Platform.h"
 #include "submodules/CLI11/include/CLI/App.hpp"
 #include "submodules/CLI11/include/CLI/Config.hpp"
 #include "submodules/CLI11/include/CLI/Formatter.hpp"
@@ -63,6 +54,35 @@ void mkdir_all(const std::vector<std::string>& full_path) {
   }
 }
 
+//------------------------------------------------------------------------------
+// Writes one output file, creating its directory if needed.
+
+bool save_file(const std::string& name, const std::string& text) {
+  auto out_path = split_path(name);
+  out_path.pop_back();
+  mkdir_all(out_path);
+
+  FILE* out_file = fopen(name.c_str(), "wb");
+  if (!out_file) {
+    LOG_R("ERROR Could not open %s for output\n", name.c_str());
+    return false;
+  }
+  fwrite(text.data(), 1, text.size(), out_file);
+  fclose(out_file);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Writes instrumented copies of the sources, keeping their relative paths.
+
+bool save_sources(const std::string& dir, const std::map<std::string, std::string>& sources) {
+  bool ok = true;
+  for (const auto& [name, text] : sources) {
+    ok &= save_file(dir + "/" + name, text);
+  }
+  return ok;
+}
+
 //------------------------------------------------------------------------------
 
 int main(int argc, char** argv) {
@@ -82,6 +102,10 @@ int main(int argc, char** argv) {
 
   std::string src_name;
   std::string dst_name;
+  std::string reflect_name;
+  std::string bind_name;
+  std::string profile_dir;
+  std::string coverage_dir;
   bool verbose = false;
   bool quiet = false;
   bool echo = false;
@@ -91,6 +115,10 @@ int main(int argc, char** argv) {
   // clang-format off
   auto src_opt     = app.add_option("-c,--convert",    src_name,     "Full path to source file to translate from C++ to SystemVerilog");
   auto dst_opt     = app.add_option("-o,--output",     dst_name,     "Output file path. If not specified, will only check the source for convertibility.");
+  auto reflect_opt = app.add_option("-r,--reflect",    reflect_name, "Also write a C++ header with field tables for every module, for use by testbenches.");
+  auto bind_opt    = app.add_option("-b,--bind",       bind_name,    "Also write a C++ header with Verilator adapters that have the same methods as the Metron modules.");
+  auto profile_opt = app.add_option("-p,--profile",    profile_dir,  "Also write copies of the source files with per-method timers to this directory, for profiling native simulations.");
+  auto cover_opt   = app.add_option("--coverage",      coverage_dir, "Also write copies of the source files with branch and toggle coverage counters to this directory, for measuring coverage in native simulations.");
   auto verbose_opt = app.add_flag  ("-v,--verbose",    verbose,      "Print detailed stats about the source modules.");
   auto quiet_opt   = app.add_flag  ("-q,--quiet",      quiet,        "Quiet mode");
   auto echo_opt    = app.add_flag  ("-e,--echo",       echo,         "Echo the converted source back to the terminal, with color-coding.");
@@ -111,6 +139,10 @@ int main(int argc, char** argv) {
   LOG_B("Metron v0.0.1\n");
   LOG_B("Source file '%s'\n", src_name.empty() ? "<empty>" : src_name.c_str());
   LOG_B("Output file '%s'\n", dst_name.empty() ? "<empty>" : dst_name.c_str());
+  LOG_B("Reflection '%s'\n", reflect_name.empty() ? "<empty>" : reflect_name.c_str());
+  LOG_B("Binding    '%s'\n", bind_name.empty() ? "<empty>" : bind_name.c_str());
+  LOG_B("Profile    '%s'\n", profile_dir.empty() ? "<empty>" : profile_dir.c_str());
+  LOG_B("Coverage   '%s'\n", coverage_dir.empty() ? "<empty>" : coverage_dir.c_str());
   LOG_B("Verbose    %d\n", verbose);
   LOG_B("Quiet      %d\n", quiet);
   LOG_B("Echo       %d\n", echo);
@@ -119,323 +151,61 @@ int main(int argc, char** argv) {
   LOG_B("\n");
 
   //----------
-  // Load all source files.
-
-  Err err;
-  MtModLibrary lib;
-  MtSourceFile* source = nullptr;
-
-  lib.add_search_path(".");
+  // Translate, then write out everything that was asked for.
 
+  MtTranslateOptions options;
+  options.top = src_name;
+  options.search_paths.push_back(".");
   {
-    LOG_B("Loading source file %s\n", src_name.c_str());
     auto src_path = split_path(src_name);
     src_path.pop_back();
-    auto search_path = join_path(src_path);
-    lib.add_search_path(search_path);
-    err << lib.load_source(src_name.c_str(), source);
-  }
-
-  if (err.has_err()) {
+    options.search_paths.push_back(join_path(src_path));
+  }
+  options.verbose = verbose;
+  options.echo = echo && !quiet;
+  options.dump = dump;
+  options.capture_log = false;
+  options.reflect = reflect_name.size();
+  options.bind = bind_name.size();
+  options.profile = profile_dir.size();
+  options.coverage = coverage_dir.size();
+
+  LOG_G("Converting %s to SystemVerilog\n", src_name.c_str());
+  auto result = mt_translate({}, options);
+  if (!result.ok) {
     LOG_R("Exiting due to error\n");
-    lib.teardown();
     return -1;
   }
 
-  if (dump) {
-    source->root_node.dump_tree(0, 0, 255);
-  }
-
-  //----------------------------------------
-
-  LOG_B("Processing source files\n");
-  {
-    //----------------------------------------
-    // All modules are now in the library, we can resolve references to other
-    // modules when we're collecting fields.
-
-    for (auto m : lib.all_modules) {
-      err << m->collect_fields_and_methods();
-    }
+  struct Output {
+    const char* what;
+    const std::string& name;
+    const std::string& text;
+  };
 
-    for (auto s : lib.all_structs) {
-      err << s->collect_fields();
-    }
-
-    //----------------------------------------
-    // Build call graphs
+  const Output outputs[] = {
+    {"SystemVerilog",      dst_name,     result.sv},
+    {"reflection tables",  reflect_name, result.reflect_h},
+    {"Verilator adapters", bind_name,    result.bind_h},
+  };
 
-    for (auto m : lib.all_modules) {
-      err << m->build_call_graph();
-    }
-
-    //----------------------------------------
-    // Count module instances so we can find top modules.
-
-    for (auto mod : lib.all_modules) {
-      for (auto field : mod->all_fields) {
-        if (field->is_component()) {
-          field->_type_mod->refcount++;
-        }
-      }
-    }
+  bool ok = true;
+  for (const auto& out : outputs) {
+    if (out.name.empty()) continue;
+    LOG_G("Saving %s to %s\n", out.what, out.name.c_str());
+    ok &= save_file(out.name, out.text);
   }
-  LOG_B("\n");
-
-  if (verbose) {
-    lib.dump_lib();
-    LOG_G("\n");
+  if (profile_dir.size()) {
+    LOG_G("Saving profiling sources to %s\n", profile_dir.c_str());
+    ok &= save_sources(profile_dir, result.profile_sources);
   }
-
-  //----------------------------------------
-  // New Trace
-
-#if 1
-  for (auto mod : lib.all_modules) {
-    if (mod->refcount) continue;
-
-    LOG_B("Tracing version 2: %s\n", mod->cname());
-    LOG_INDENT_SCOPE();
-
-    MtModuleInstance* root_inst = new MtModuleInstance("<top>", mod);
-    //root_inst->dump();
-
-    MtTracer2 tracer(&lib, root_inst, true);
-
-    for (auto m : root_inst->_methods) {
-      LOG_B("Tracing %s\n", m.second->_name.c_str());
-      {
-        LOG_INDENT_SCOPE();
-        err << tracer.trace_method(m.second->_method);
-      }
-      LOG_B("Tracing %s done\n", m.second->_name.c_str());
-      //root_inst->dump();
-      LOG_B("\n");
-      root_inst->reset_state();
-    }
-
-    //LOG_B("\n");
-    //root_inst->dump();
-
-    delete root_inst;
-  }
-  LOG_B("Tracing version 2: done\n");
-  LOG_B("\n");
-#endif
-
-  //----------------------------------------
-  // Trace
-
-  for (auto mod : lib.all_modules) {
-    LOG_B("Tracing %s\n", mod->cname());
-    LOG_INDENT();
-    mod->ctx = new MtContext(mod);
-    mod->ctx->instantiate();
-
-    MtTracer tracer(&lib, mod->ctx, verbose);
-
-    for (auto method : mod->all_methods) {
-      if (method->is_constructor()) continue;
-      if (method->internal_callers.size()) continue;
-      if (verbose) {
-        LOG_G("Tracing %s.%s\n", mod->cname(), method->cname());
-      }
-      err << tracer.trace_method(mod->ctx, method);
-      //if (verbose) {
-      //  mod->ctx->dump_ctx_tree();
-      //}
-    }
-    mod->ctx->assign_struct_states();
-    if (verbose) {
-      LOG_G("Final context tree for module %s:\n", mod->cname());
-      mod->ctx->dump_ctx_tree();
-      LOG("\n");
-    }
-    mod->ctx->assign_state_to_field(mod);
-
-    err << mod->ctx->check_done();
-    if (err.has_err()) {
-      LOG_R("Error during trace\n");
-      lib.teardown();
-      return -1;
-    }
-    LOG_DEDENT();
-  }
-
-  //----------
-  // Categorize fields
-
-  LOG_B("Categorizing fields\n");
-  for (auto m : lib.all_modules) {
-    LOG_INDENT_SCOPE();
-    err << m->categorize_fields(verbose);
-  }
-
-  if (err.has_err()) {
-    LOG_R("Exiting due to error\n");
-    lib.teardown();
-    return -1;
-  }
-  LOG("\n");
-
-  //----------
-  // Categorize methods
-
-  LOG_B("Categorizing methods\n");
-  LOG_INDENT();
-  err << lib.categorize_methods(verbose);
-
-  int uncategorized = 0;
-  int invalid = 0;
-  for (auto mod : lib.all_modules) {
-    for (auto m : mod->all_methods) {
-      if (!m->categorized()) {
-        uncategorized++;
-      }
-      if (!m->is_valid()) {
-        invalid++;
-      }
-    }
-  }
-
-  if (verbose) {
-    LOG_G("Methods uncategorized %d\n", uncategorized);
-    LOG_G("Methods invalid %d\n", invalid);
-  }
-
-  if (uncategorized || invalid) {
-    err << ERR("Could not categorize all methods\n");
-    lib.teardown();
-    return -1;
-  }
-  LOG_DEDENT();
-  LOG("\n");
-
-  //----------------------------------------
-
-  if (verbose) {
-    LOG_B("Module info:\n");
-    LOG_INDENT();
-
-    //----------------------------------------
-    // Print module tree
-
-    LOG_B("Module tree:\n");
-    LOG_INDENT();
-    std::function<void(MtModule*, int, bool)> step;
-    step = [&](MtModule* m, int rank, bool last) -> void {
-      for (int i = 0; i < rank - 1; i++) LOG_Y("|  ");
-      if (last) {
-        if (rank) LOG_Y("\\--");
-      } else {
-        if (rank) LOG_Y("|--");
-      }
-      LOG_Y("%s\n", m->name().c_str());
-      auto field_count = m->all_fields.size();
-      for (auto i = 0; i < field_count; i++) {
-        auto field = m->all_fields[i];
-        if (!field->is_component()) continue;
-        step(lib.get_module(field->type_name()), rank + 1,
-              i == field_count - 1);
-      }
-    };
-
-    for (auto m : lib.all_modules) {
-      if (m->refcount == 0) step(m, 0, false);
-    }
-    LOG_DEDENT();
-    LOG_G("\n");
-
-    for (auto m : lib.all_modules) m->dump_module();
-
-    LOG_DEDENT();
-    LOG("\n");
-  }
-
-  //----------------------------------------
-  // Check for and report bad fields.
-
-  std::vector<MtField*> bad_fields;
-  for (auto mod : lib.all_modules) {
-    for (auto field : mod->all_fields) {
-      if (field->_state == CTX_INVALID) {
-        err << ERR("Field %s is in an invalid state\n", field->cname());
-        bad_fields.push_back(field);
-      }
-    }
-  }
-
-  for (auto bad_field : bad_fields) {
-    LOG_R("Bad field \"%s.%s\" log:\n", bad_field->_parent_mod->cname(),
-          bad_field->cname());
-    LOG_G("\n");
-  }
-
-  for (auto mod : lib.all_modules) {
-    for (auto method : mod->all_methods) {
-      if (method->name().starts_with("tick") && !method->is_tick_) {
-        err << ERR("Method %s labeled 'tick' but is not a tick.\n", method->cname());
-      }
-      if (method->name().starts_with("tock") && !method->is_tock_) {
-        err << ERR("Method %s labeled 'tock' but is not a tock.\n", method->cname());
-      }
-    }
-  }
-
-  if (err.has_err()) {
-    LOG_R("Exiting due to error\n");
-    lib.teardown();
-    return -1;
-  }
-
-  //----------
-  // Emit all modules.
-
- {
-    LOG_G("Converting %s to SystemVerilog\n", src_name.c_str());
-
-    std::string out_string;
-    MtCursor cursor(&lib, source, nullptr, &out_string);
-    cursor.echo = echo && !quiet;
-
-    if (echo) LOG_G("----------------------------------------\n\n");
-    err << cursor.emit_everything();
-    if (echo) LOG_G("----------------------------------------\n\n");
-
-    if (err.has_err()) {
-      LOG_R("Error during code generation\n");
-      lib.teardown();
-      return -1;
-    }
-
-    if (dst_name.size()) {
-      // Save translated source to output directory, if there is one.
-
-      LOG_G("Saving %s\n", dst_name.c_str());
-
-      auto dst_path = split_path(dst_name);
-      dst_path.pop_back();
-      mkdir_all(dst_path);
-
-      FILE* out_file = fopen(dst_name.c_str(), "wb");
-      if (!out_file) {
-        LOG_R("ERROR Could not open %s for output\n", dst_name.c_str());
-      } else {
-        // Copy the BOM over if needed.
-        if (source->use_utf8_bom) {
-          uint8_t bom[3] = {239, 187, 191};
-          fwrite(bom, 1, 3, out_file);
-        }
-
-        fwrite(out_string.data(), 1, out_string.size(), out_file);
-        fclose(out_file);
-      }
-    }
+  if (coverage_dir.size()) {
+    LOG_G("Saving coverage sources to %s\n", coverage_dir.c_str());
+    ok &= save_sources(coverage_dir, result.coverage_sources);
   }
+  if (!ok) return -1;
 
   LOG_B("Done!\n");
-  lib.teardown();
-
   return 0;
 }
 
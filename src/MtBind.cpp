@@ -0,0 +1,142 @@
+#include "MtBind.h"
+
+#include "Log.h"
+#include "MtField.h"
+#include "MtMethod.h"
+#include "MtModLibrary.h"
+#include "MtModParam.h"
+#include "MtModule.h"
+#include "MtSourceFile.h"
+#include "MtUtils.h"
+
+//------------------------------------------------------------------------------
+// Port naming has to match MtCursor::emit_module_ports() exactly - params are
+// "<method>_<param>", returns are "<method>_ret" and the clock is "clock".
+
+static void emit_fields(const char* comment, const std::vector<MtField*>& fields,
+                        std::string& out) {
+  if (fields.empty()) return;
+  out += str_printf("  // %s\n", comment);
+  for (auto f : fields) {
+    // Verilator's representation of arrays and structs doesn't map onto ours,
+    // so those are exposed as the raw port.
+    if (f->is_array() || f->is_struct()) {
+      out += str_printf("  decltype(VL::%s)& %s = vl.%s;\n", f->cname(), f->cname(), f->cname());
+    } else {
+      out += str_printf("  sim_vl_field<decltype(MT::%s), decltype(VL::%s)> %s{vl.%s};\n",
+                        f->cname(), f->cname(), f->cname(), f->cname());
+    }
+  }
+  out += "\n";
+}
+
+//------------------------------------------------------------------------------
+
+static void emit_method(MtModule* mod, MtMethod* m, std::string& out) {
+  auto name = m->cname();
+  bool has_ret = m->has_return();
+
+  out += str_printf("  using %s_t = sim_method_traits<decltype(&MT::%s)>;\n", name, name);
+  out += str_printf("  typename %s_t::ret %s(", name, name);
+  for (size_t i = 0; i < m->param_nodes.size(); i++) {
+    if (i) out += ", ";
+    out += str_printf("typename %s_t::template arg<%d> %s", name, int(i),
+                      m->param_nodes[i].name4().c_str());
+  }
+  out += ") {\n";
+
+  for (auto& p : m->param_nodes) {
+    auto param = p.name4();
+    out += str_printf("    sim_vl_put(vl.%s_%s, %s);\n", name, param.c_str(), param.c_str());
+  }
+
+  // Calls only apply their arguments and settle the model - funcs don't even
+  // need that if nothing could have changed since the last call. Outputs are
+  // sampled before the clock edge, same as the Metron method returning before
+  // its ticks commit. The edge itself is cycle(), so a testbench that calls
+  // several methods per cycle still clocks the model once.
+  bool settle = !m->is_func_ || m->param_nodes.size() || mod->input_signals.size();
+
+  if (settle) out += "    vl.eval();\n";
+  if (has_ret) {
+    out += str_printf("    return sim_vl_get<typename %s_t::ret>(vl.%s_ret);\n", name, name);
+  }
+
+  out += "  }\n\n";
+}
+
+//------------------------------------------------------------------------------
+
+static CHECK_RETURN Err emit_module(MtModule* mod, std::string& out) {
+  Err err;
+
+  // Templated modules default to their default arguments, if they all have
+  // them. Otherwise the caller has to name the instantiation that was
+  // Verilated.
+  std::string mt_default = str_printf(" = %s", mod->cname());
+  if (mod->mod_template) {
+    mt_default += "<>";
+    for (auto p : mod->all_modparams) {
+      if (p->_node.sym != sym_optional_parameter_declaration) mt_default.clear();
+    }
+  }
+
+  out += "//------------------------------------------------------------------------------\n";
+  out += str_printf("// %s\n\n", mod->cname());
+
+  out += str_printf("template <typename VL, typename MT%s>\n", mt_default.c_str());
+  out += str_printf("class %s_vl {\n", mod->cname());
+  out += " public:\n";
+  out += "  VL vl;\n\n";
+
+  emit_fields("input signals", mod->input_signals, out);
+  emit_fields("output signals", mod->output_signals, out);
+  emit_fields("output registers", mod->output_registers, out);
+
+  for (auto m : mod->all_methods) {
+    if (m->is_constructor() || m->is_init_) continue;
+    if (!m->is_public() || !m->internal_callers.empty()) continue;
+    emit_method(mod, m, out);
+  }
+
+  if (mod->needs_tick()) {
+    out += "  // Commits the ticks of every method called since the last cycle().\n";
+    out += "  void cycle() {\n";
+    out += "    vl.clock = 0;\n";
+    out += "    vl.eval();\n";
+    out += "    vl.clock = 1;\n";
+    out += "    vl.eval();\n";
+    out += "  }\n\n";
+  }
+
+  out += "  void eval() { vl.eval(); }\n";
+  out += "};\n\n";
+
+  return err;
+}
+
+//------------------------------------------------------------------------------
+
+CHECK_RETURN Err mt_emit_binding(MtModLibrary* lib, MtSourceFile* source,
+                                 std::string& out) {
+  Err err;
+
+  out += str_printf("// Verilator adapters for %s, generated by \"metron --bind\".\n",
+                    source->filename.c_str());
+  out += "// Do not edit.\n";
+  out += "#pragma once\n";
+  out += "#include \"metron_sim.h\"\n";
+  out += str_printf("#include \"%s\"\n\n", source->filename.c_str());
+
+  // Only the modules in this file - Verilator only exposes the top module's
+  // ports, and the other files get their own adapters.
+  for (auto mod : lib->all_modules) {
+    if (mod->source_file != source) continue;
+    err << emit_module(mod, out);
+  }
+
+  out += "//------------------------------------------------------------------------------\n";
+  return err;
+}
+
+//------------------------------------------------------------------------------
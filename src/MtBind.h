@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+
+#include "Err.h"
+#include "Platform.h"
+
+struct MtModLibrary;
+struct MtSourceFile;
+
+//------------------------------------------------------------------------------
+// Generates the Verilator adapter header for "metron --bind out.h" - one
+// <Module>_vl<VL> class per module in the source file, with the same methods
+// and public fields as the Metron class but backed by a Verilated model.
+// Modules with ticks also get a cycle() that clocks the model once, which the
+// testbench calls after each cycle's method calls - see sim_cycle() and
+// sim_vl_put() in metron_sim.h for the runtime side. Must be called after
+// MtModLibrary::process_sources().
+
+CHECK_RETURN Err mt_emit_binding(MtModLibrary* lib, MtSourceFile* source,
+                                 std::string& out);
+
+//------------------------------------------------------------------------------
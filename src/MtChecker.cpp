@@ -391,11 +391,10 @@ bool MtChecker::ends_with_break(MnNode n) {
 bool MtChecker::has_return(MnNode n) {
   if (n.is_null()) return false;
 
-  bool result = false;
-  n.visit_tree([&](MnNode child) {
-    if (child.sym == sym_return_statement) result = true;
+  bool found = !n.visit_tree([](MnNode child) {
+    return child.sym == sym_return_statement ? VISIT_STOP : VISIT_CONTINUE;
   });
-  return result;
+  return found;
 }
 
 //------------------------------------------------------------------------------
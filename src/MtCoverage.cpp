@@ -0,0 +1,181 @@
+#include "MtCoverage.h"
+
+#include <algorithm>
+
+#include "Log.h"
+#include "MtField.h"
+#include "MtInstrument.h"
+#include "MtMethod.h"
+#include "MtModLibrary.h"
+#include "MtModule.h"
+#include "MtSourceFile.h"
+#include "MtUtils.h"
+
+//------------------------------------------------------------------------------
+
+struct CovModule {
+  MtModule* mod;
+  MtSourceFile* source;
+  std::vector<MtSplice>& inserts;
+  std::vector<std::string> arms;
+
+  void insert(uint32_t offset, bool open, const std::string& text) {
+    inserts.push_back({offset, open, int(inserts.size()), text});
+  }
+
+  // Arms are keyed by line and column, as one line can hold several ifs.
+  int add_arm(uint32_t offset, const std::string& kind) {
+    auto& src = source->src_blob;
+    int line = 1 + int(std::count(src.begin(), src.begin() + offset, '\n'));
+    auto line_start = offset ? src.rfind('\n', offset - 1) : std::string::npos;
+    int col = 1 + int(offset - (line_start == std::string::npos ? 0 : line_start + 1));
+    arms.push_back(str_printf("{%d, %d, \"%s\"}", line, col, kind.c_str()));
+    return int(arms.size()) - 1;
+  }
+
+  // Braces go around arms that are a single statement so there's somewhere to
+  // put the hit, and an "if" without an "else" gets an empty one.
+  void cover_arm(MnNode arm, const std::string& kind, const std::string& close = "") {
+    int id = add_arm(arm.start_byte(), kind);
+    if (arm.sym == sym_compound_statement) {
+      insert(arm.start_byte() + 1, true, str_printf(" MT_COV_BRANCH(%d);", id));
+      if (close.size()) insert(arm.end_byte(), false, close);
+    } else {
+      insert(arm.start_byte(), true, str_printf("{ MT_COV_BRANCH(%d); ", id));
+      insert(arm.end_byte(), false, " }" + close);
+    }
+  }
+
+  void cover_if(MnNode node) {
+    auto branch_a = node.get_field(field_consequence);
+    auto branch_b = node.get_field(field_alternative);
+
+    if (branch_b.is_null()) {
+      // The else arm's id has to be known before its text is built.
+      int id_b = int(arms.size()) + 1;
+      cover_arm(branch_a, "if", str_printf(" else { MT_COV_BRANCH(%d); }", id_b));
+      add_arm(branch_a.end_byte(), "else");
+    } else {
+      cover_arm(branch_a, "if");
+      cover_arm(branch_b, "else");
+    }
+  }
+
+  void cover_switch(MnNode node) {
+    auto body = node.get_field(field_body);
+
+    bool has_default = false;
+    for (const auto& child : body) {
+      if (child.sym != sym_case_statement) continue;
+      if (child.child(0).text() == "default") has_default = true;
+
+      // Labels without statements fall through to the next arm.
+      MnNode colon;
+      bool has_body = false;
+      for (const auto& c : child) {
+        if (colon.is_null()) {
+          if (c.sym == anon_sym_COLON) colon = c;
+        } else if (c.is_named() && c.sym != sym_comment) {
+          has_body = true;
+        }
+      }
+      if (colon.is_null() || !has_body) continue;
+
+      std::string kind = "default";
+      auto value = child.get_field(field_value);
+      if (!value.is_null()) {
+        kind = "case ";
+        for (auto c : value.text()) kind += isalnum(c) || c == '_' || c == ':' ? c : '?';
+      }
+      int id = add_arm(child.start_byte(), kind);
+      insert(colon.end_byte(), true, str_printf(" MT_COV_BRANCH(%d);", id));
+    }
+
+    // Nothing falls into a default at the top of the switch.
+    if (!has_default) {
+      int id = add_arm(node.start_byte(), "default");
+      insert(body.start_byte() + 1, true, str_printf(" default: MT_COV_BRANCH(%d); break;", id));
+    }
+  }
+};
+
+//------------------------------------------------------------------------------
+
+static bool is_tracked_register(MtModule* mod, MtField* f) {
+  if (f->is_array() || f->is_struct() || f->is_component() || f->_static) return false;
+  for (auto r : mod->output_registers) if (r == f) return true;
+  for (auto r : mod->private_registers) if (r == f) return true;
+  return false;
+}
+
+//------------------------------------------------------------------------------
+
+CHECK_RETURN Err mt_emit_coverage(MtModLibrary* lib, MtSourceFile* source,
+                                  std::map<std::string, std::string>& out) {
+  Err err;
+
+  for (auto s : lib->source_files) {
+    std::vector<MtSplice> inserts;
+    int total_arms = 0;
+
+    for (auto mod : lib->all_modules) {
+      if (mod->source_file != s) continue;
+      CovModule cov = {mod, s, inserts, {}};
+
+      std::vector<MtField*> regs;
+      for (auto f : mod->all_fields) {
+        if (is_tracked_register(mod, f)) regs.push_back(f);
+      }
+
+      for (auto m : mod->all_methods) {
+        auto body = m->_node.get_field(field_body);
+        if (body.is_null()) continue;
+        if (s->src_blob[body.start_byte()] != '{') {
+          return err << ERR("Body of %s.%s doesn't start with a brace\n", mod->cname(), m->cname());
+        }
+
+        // Registers are compared before and after each call into the module
+        // that can change them. Internal calls happen inside those.
+        bool entry = !m->is_constructor() && !m->is_init_ && !m->is_func_ &&
+                     m->internal_callers.empty();
+        if (entry && regs.size()) {
+          std::string toggles;
+          for (size_t i = 0; i < regs.size(); i++) {
+            toggles += str_printf(" MT_COV_TOGGLE(%d, this->%s);", int(i), regs[i]->cname());
+          }
+          cov.insert(body.start_byte() + 1, true, toggles);
+        }
+
+        body.visit_tree([&](const MnNode& n) {
+          if (n.sym == sym_if_statement) cov.cover_if(n);
+          if (n.sym == sym_switch_statement) cov.cover_switch(n);
+        });
+      }
+
+      // The table goes at the end of the class so it can see the fields' types.
+      std::string table = str_printf(" static inline mt_cov_module mt_cov{\"%s\", \"%s\", {",
+                                     mod->cname(), s->filename.c_str());
+      for (size_t i = 0; i < cov.arms.size(); i++) {
+        table += (i ? ", " : "") + cov.arms[i];
+      }
+      table += "}, {";
+      for (size_t i = 0; i < regs.size(); i++) {
+        table += str_printf("%s{\"%s\", mt_cov_width<decltype(%s)>()}", i ? ", " : "",
+                            regs[i]->cname(), regs[i]->cname());
+      }
+      table += "}};";
+
+      auto mod_body = mod->mod_class.get_field(field_body);
+      cov.insert(mod_body.end_byte() - 1, false, table);
+      total_arms += int(cov.arms.size());
+    }
+
+    auto trailer = str_printf("// Instrumented by \"metron --coverage\", %d branch arms. Do not edit.\n",
+                              total_arms);
+    out[mt_instrumented_name(s, source)] = mt_splice_source(s, inserts, "metron_coverage.h", trailer);
+  }
+
+  return err;
+}
+
+//------------------------------------------------------------------------------
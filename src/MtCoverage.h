@@ -0,0 +1,23 @@
+#pragma once
+#include <map>
+#include <string>
+
+#include "Err.h"
+#include "Platform.h"
+
+struct MtModLibrary;
+struct MtSourceFile;
+
+//------------------------------------------------------------------------------
+// Generates the instrumented sources for "metron --coverage dir" - a copy of
+// every loaded source file that includes metron_coverage.h and has a coverage
+// table in each module, a hit bit in every branch arm and toggle tracking on
+// each scalar register. See mt_cov_module in metron_coverage.h for the runtime
+// side. 'out' maps output
+// paths, relative to the coverage directory, to file contents. Must be called
+// after MtModLibrary::process_sources().
+
+CHECK_RETURN Err mt_emit_coverage(MtModLibrary* lib, MtSourceFile* source,
+                                  std::map<std::string, std::string>& out);
+
+//------------------------------------------------------------------------------
@@ -727,6 +727,15 @@ CHECK_RETURN Err MtCursor::emit_sym_call_expression(MnNode n) {
   } else if (func_name == "write") {
     err << emit_replacement(func, "$write");
     err << emit_sym_argument_list(args);
+  } else if (func_name == "display_info") {
+    err << emit_replacement(func, "$info");
+    err << emit_sym_argument_list(args);
+  } else if (func_name == "display_warning") {
+    err << emit_replacement(func, "$warning");
+    err << emit_sym_argument_list(args);
+  } else if (func_name == "display_error") {
+    err << emit_replacement(func, "$error");
+    err << emit_sym_argument_list(args);
   } else if (func_name == "sign_extend") {
     err << emit_replacement(func, "$signed");
     err << emit_sym_argument_list(args);
@@ -2073,6 +2082,14 @@ CHECK_RETURN Err MtCursor::emit_sym_field_declaration(MnNode n) {
     err << comment_out(n);
     return err << check_done(n);
   }
+  else if (field->is_sparse_mem()) {
+    err << emit_sparse_mem(n);
+    return err << check_done(n);
+  }
+  else if (field->is_packed()) {
+    err << emit_packed_field(n);
+    return err << check_done(n);
+  }
   else {
     for (auto c : n) {
       switch(c.field) {
@@ -2085,6 +2102,83 @@ CHECK_RETURN Err MtCursor::emit_sym_field_declaration(MnNode n) {
   }
 }
 
+//------------------------------------------------------------------------------
+// Change "sparse_mem<logic<N>, DEPTH> mem;" to "logic[N-1:0] mem[DEPTH];"
+
+CHECK_RETURN Err MtCursor::emit_sparse_mem(MnNode n) {
+  Err err = emit_ws_to(sym_field_declaration, n);
+
+  auto node_type = n.get_field(field_type);
+  auto node_args = node_type.get_field(field_arguments);
+  if (node_args.named_child_count() != 2) {
+    return err << ERR("sparse_mem needs an element type and a depth\n");
+  }
+
+  auto node_elem = node_args.named_child(0);
+  auto node_depth = node_args.named_child(1);
+
+  for (auto c : n) {
+    switch (c.field) {
+      case field_type:
+        push_cursor(node_elem);
+        err << emit_template_argument(node_elem);
+        pop_cursor(node_elem);
+        cursor = c.end();
+        break;
+      case field_declarator:
+        err << emit_declarator(c);
+        err << emit_print("[");
+        push_cursor(node_depth);
+        err << emit_template_argument(node_depth);
+        pop_cursor(node_depth);
+        err << emit_print("]");
+        break;
+      default:
+        err << emit_default(c);
+        break;
+    }
+  }
+
+  return err << check_done(n);
+}
+
+//------------------------------------------------------------------------------
+// Change "packed_logic name : N;" to "logic[N-1:0] name;"
+
+CHECK_RETURN Err MtCursor::emit_packed_field(MnNode n) {
+  Err err = emit_ws_to(sym_field_declaration, n);
+
+  MnNode node_bits;
+  for (auto c : n) {
+    if (c.sym == sym_bitfield_clause) node_bits = c;
+  }
+  auto node_width = node_bits.first_named_child();
+
+  for (auto c : n) {
+    if (c.field == field_type) {
+      if (node_width.sym == sym_number_literal) {
+        int width = atoi(node_width.start());
+        err << emit_replacement(c, width > 1 ? "logic[%d:0]" : "logic", width - 1);
+      } else {
+        err << emit_replacement(c, "logic[");
+        push_cursor(node_width);
+        err << emit_expression(node_width);
+        pop_cursor(node_width);
+        err << emit_print("-1:0]");
+      }
+    } else if (c.field == field_declarator) {
+      err << emit_declarator(c);
+    } else if (c.sym == sym_bitfield_clause) {
+      // Drop the clause along with the whitespace in front of it.
+      cursor = c.end();
+    } else {
+      err << emit_default(c);
+    }
+  }
+
+  return err << check_done(n);
+}
+
 //------------------------------------------------------------------------------
 
 CHECK_RETURN Err MtCursor::emit_sym_struct_specifier(MnNode n) {
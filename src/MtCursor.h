@@ -73,6 +73,8 @@ struct MtCursor {
   CHECK_RETURN Err emit_init_declarator_as_assign(MnNode n);
   CHECK_RETURN Err emit_submod_binding_fields(MnNode n);
   CHECK_RETURN Err emit_field_as_component(MnNode field_decl);
+  CHECK_RETURN Err emit_sparse_mem(MnNode field_decl);
+  CHECK_RETURN Err emit_packed_field(MnNode field_decl);
   CHECK_RETURN Err emit_component_port_list(MnNode n);
 
   CHECK_RETURN Err emit_local_call_arg_binding(MtMethod* method, MnNode param, MnNode val);
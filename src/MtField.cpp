@@ -120,7 +120,18 @@ bool MtField::is_port() const {
 }
 
 bool MtField::is_array() const {
-  return _decl.sym == sym_array_declarator;
+  return _decl.sym == sym_array_declarator || is_sparse_mem();
+}
+
+// sparse_mem<logic<N>, DEPTH> behaves like an array everywhere except the
+// declaration.
+bool MtField::is_sparse_mem() const {
+  return _type.sym == sym_template_type && _type_name == "sparse_mem";
+}
+
+// "packed_logic name : N;" is an N-bit bitfield packed in with its neighbors.
+bool MtField::is_packed() const {
+  return _type.sym == alias_sym_type_identifier && _type_name == "packed_logic";
 }
 
 //------------------------------------------------------------------------------
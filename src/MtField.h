@@ -22,6 +22,8 @@ struct MtField {
 
   bool is_enum() const;
   bool is_array() const;
+  bool is_sparse_mem() const;
+  bool is_packed() const;
   bool is_component() const;
   bool is_struct() const;
   bool is_param() const;
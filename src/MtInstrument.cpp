@@ -0,0 +1,36 @@
+#include "MtInstrument.h"
+
+#include <algorithm>
+
+#include "MtSourceFile.h"
+
+//------------------------------------------------------------------------------
+
+std::string mt_splice_source(MtSourceFile* s, std::vector<MtSplice> splices,
+                             const std::string& runtime, const std::string& trailer) {
+  std::sort(splices.begin(), splices.end());
+
+  std::string text = "#include \"" + runtime + "\"\n#line 1\n";
+
+  uint32_t cursor = 0;
+  for (auto& i : splices) {
+    text.append(s->src_blob, cursor, i.offset - cursor);
+    text += i.text;
+    cursor = i.offset;
+  }
+  text.append(s->src_blob, cursor, std::string::npos);
+
+  if (text.size() && text.back() != '\n') text += "\n";
+  text += trailer;
+  return text;
+}
+
+//------------------------------------------------------------------------------
+
+std::string mt_instrumented_name(MtSourceFile* s, MtSourceFile* top) {
+  if (s != top) return s->filename;
+  auto slash = s->filename.find_last_of("/\\");
+  return slash == std::string::npos ? s->filename : s->filename.substr(slash + 1);
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+struct MtSourceFile;
+
+//------------------------------------------------------------------------------
+// Shared by "metron --profile" and "metron --coverage", which both write
+// copies of the loaded source files with instrumentation spliced in.
+
+// Text to splice into a source file. Everything goes on an existing line so
+// line numbers in the instrumented copy match the original.
+//
+// Openers at the same offset go in the order they were added, closers in
+// reverse, so the braces around nested single-statement branches nest.
+
+struct MtSplice {
+  uint32_t offset;
+  bool open;
+  int order;
+  std::string text;
+
+  bool operator<(const MtSplice& b) const {
+    if (offset != b.offset) return offset < b.offset;
+    if (open != b.open) return !open;
+    return open ? order < b.order : order > b.order;
+  }
+};
+
+// Returns the source with 'splices' applied and 'trailer' appended as its
+// last line. The copy starts by including the 'runtime' header, followed by a
+// #line directive so the original's lines keep their numbers.
+std::string mt_splice_source(MtSourceFile* s, std::vector<MtSplice> splices,
+                             const std::string& runtime, const std::string& trailer);
+
+// Where the instrumented copy of 's' goes, relative to the output directory.
+// The top file goes in the root. Everything else keeps the name it was
+// included by, so includes still resolve relative to the top file.
+std::string mt_instrumented_name(MtSourceFile* s, MtSourceFile* top);
+
+//------------------------------------------------------------------------------
@@ -8,8 +8,10 @@
 #include "MtMethod.h"
 #include "MtModule.h"
 #include "MtContext.h"
+#include "MtInstance.h"
 #include "MtSourceFile.h"
 #include "MtTracer.h"
+#include "MtTracer2.h"
 #include "MtStruct.h"
 #include "metron_tools.h"
 
@@ -47,6 +49,15 @@ void MtModLibrary::add_search_path(const std::string &path) {
   search_paths.push_back(path);
 }
 
+//------------------------------------------------------------------------------
+// Register an in-memory file that load_source() will find before looking in
+// the search paths.
+
+void MtModLibrary::add_source_blob(const std::string &filename,
+                                   const std::string &blob) {
+  source_blobs[filename] = blob;
+}
+
 //------------------------------------------------------------------------------
 
 void MtModLibrary::add_source(MtSourceFile *source_file) {
@@ -71,39 +82,53 @@ CHECK_RETURN Err MtModLibrary::load_source(const char *filename,
   }
 
   bool found = false;
+  std::string full_path;
+  std::string src_blob;
+
+  // In-memory sources take priority over the search paths.
+  auto blob_it = source_blobs.find(filename);
+  if (blob_it != source_blobs.end()) {
+    found = true;
+    full_path = filename;
+    src_blob = blob_it->second;
+  }
+
   for (auto &path : search_paths) {
-    auto full_path = path.size() ? path + "/" + filename : filename;
+    if (found) break;
+    full_path = path.size() ? path + "/" + filename : filename;
 
     struct stat s;
     auto stat_result = stat(full_path.c_str(), &s);
     if (stat_result == 0) {
       found = true;
-      LOG_B("Loading %s from %s\n", filename, full_path.c_str());
-      LOG_INDENT_SCOPE();
-
-      std::string src_blob;
       src_blob.resize(s.st_size);
 
       auto f = fopen(full_path.c_str(), "rb");
       size_t result = fread((void *)src_blob.data(), 1, src_blob.size(), f);
       fclose(f);
-
-      bool use_utf8_bom = false;
-      if (uint8_t(src_blob[0]) == 239 && uint8_t(src_blob[1]) == 187 &&
-          uint8_t(src_blob[2]) == 191) {
-        use_utf8_bom = true;
-        src_blob.erase(src_blob.begin(), src_blob.begin() + 3);
-      }
-      err << load_blob(filename, full_path, src_blob.data(), src_blob.size(), out_source, use_utf8_bom);
-
-      break;
     }
   }
 
   if (!found) {
-    err << ERR("Couldn't find %s in path!", filename);
+    return err << ERR("Couldn't find %s in path!", filename);
+  }
+
+  LOG_B("Loading %s from %s\n", filename, full_path.c_str());
+  LOG_INDENT_SCOPE();
+
+  bool use_utf8_bom = false;
+  if (src_blob.size() >= 3 && uint8_t(src_blob[0]) == 239 &&
+      uint8_t(src_blob[1]) == 187 && uint8_t(src_blob[2]) == 191) {
+    use_utf8_bom = true;
+    src_blob.erase(src_blob.begin(), src_blob.begin() + 3);
+  }
+
+  if (src_blob.empty()) {
+    return err << ERR("Source file %s is empty\n", filename);
   }
 
+  err << load_blob(filename, full_path, src_blob.data(), src_blob.size(), out_source, use_utf8_bom);
+
   return err;
 }
 
@@ -132,20 +157,24 @@ CHECK_RETURN Err MtModLibrary::load_blob(const std::string &filename,
   source_file->root_node.visit_tree([&](MnNode child) {
     if (child.sym == sym_comment && child.contains("metron_noconvert")) {
       noconvert = true;
-      return;
+      return VISIT_CONTINUE;
     }
 
     if (noconvert) {
       noconvert = false;
-      return;
+      return VISIT_CONTINUE;
     }
 
-    if (child.sym != sym_preproc_include) return;
+    // Includes can't appear inside function bodies.
+    if (child.sym == sym_compound_statement) return VISIT_SKIP;
+
+    if (child.sym != sym_preproc_include) return VISIT_CONTINUE;
 
     std::string filename = child.get_field(field_path).text();
     filename.erase(filename.begin());
     filename.pop_back();
     includes.push_back(filename);
+    return VISIT_SKIP;
   });
 
   for (const auto &file : includes) {
@@ -164,6 +193,199 @@ CHECK_RETURN Err MtModLibrary::load_blob(const std::string &filename,
   return err;
 }
 
+//------------------------------------------------------------------------------
+// All sources are loaded, collect fields and methods, trace every module, and
+// categorize everything so the library is ready for MtCursor.
+
+CHECK_RETURN Err MtModLibrary::process_sources(bool verbose) {
+  Err err;
+
+  LOG_B("Processing source files\n");
+  {
+    //----------------------------------------
+    // All modules are now in the library, we can resolve references to other
+    // modules when we're collecting fields.
+
+    for (auto m : all_modules) {
+      err << m->collect_fields_and_methods();
+    }
+
+    for (auto s : all_structs) {
+      err << s->collect_fields();
+    }
+
+    //----------------------------------------
+    // Build call graphs
+
+    for (auto m : all_modules) {
+      err << m->build_call_graph();
+    }
+
+    //----------------------------------------
+    // Count module instances so we can find top modules.
+
+    for (auto mod : all_modules) {
+      for (auto field : mod->all_fields) {
+        if (field->is_component()) {
+          field->_type_mod->refcount++;
+        }
+      }
+    }
+  }
+  LOG_B("\n");
+
+  if (verbose) {
+    dump_lib();
+    LOG_G("\n");
+  }
+
+  //----------------------------------------
+  // New Trace
+
+  for (auto mod : all_modules) {
+    if (mod->refcount) continue;
+
+    LOG_B("Tracing version 2: %s\n", mod->cname());
+    LOG_INDENT_SCOPE();
+
+    MtModuleInstance* root_inst = new MtModuleInstance("<top>", mod);
+
+    MtTracer2 tracer(this, root_inst, true);
+
+    for (auto m : root_inst->_methods) {
+      LOG_B("Tracing %s\n", m.second->_name.c_str());
+      {
+        LOG_INDENT_SCOPE();
+        err << tracer.trace_method(m.second->_method);
+      }
+      LOG_B("Tracing %s done\n", m.second->_name.c_str());
+      LOG_B("\n");
+      root_inst->reset_state();
+    }
+
+    delete root_inst;
+  }
+  LOG_B("Tracing version 2: done\n");
+  LOG_B("\n");
+
+  //----------------------------------------
+  // Trace
+
+  for (auto mod : all_modules) {
+    LOG_B("Tracing %s\n", mod->cname());
+    LOG_INDENT_SCOPE();
+    mod->ctx = new MtContext(mod);
+    mod->ctx->instantiate();
+
+    MtTracer tracer(this, mod->ctx, verbose);
+
+    for (auto method : mod->all_methods) {
+      if (method->is_constructor()) continue;
+      if (method->internal_callers.size()) continue;
+      if (verbose) {
+        LOG_G("Tracing %s.%s\n", mod->cname(), method->cname());
+      }
+      err << tracer.trace_method(mod->ctx, method);
+    }
+    mod->ctx->assign_struct_states();
+    if (verbose) {
+      LOG_G("Final context tree for module %s:\n", mod->cname());
+      mod->ctx->dump_ctx_tree();
+      LOG("\n");
+    }
+    mod->ctx->assign_state_to_field(mod);
+
+    err << mod->ctx->check_done();
+    if (err.has_err()) {
+      LOG_R("Error during trace\n");
+      return err;
+    }
+  }
+
+  //----------
+  // Categorize fields
+
+  LOG_B("Categorizing fields\n");
+  for (auto m : all_modules) {
+    LOG_INDENT_SCOPE();
+    err << m->categorize_fields(verbose);
+  }
+
+  if (err.has_err()) {
+    LOG_R("Exiting due to error\n");
+    return err;
+  }
+  LOG("\n");
+
+  //----------
+  // Categorize methods
+
+  LOG_B("Categorizing methods\n");
+  {
+    LOG_INDENT_SCOPE();
+    err << categorize_methods(verbose);
+
+    int uncategorized = 0;
+    int invalid = 0;
+    for (auto mod : all_modules) {
+      for (auto m : mod->all_methods) {
+        if (!m->categorized()) {
+          uncategorized++;
+        }
+        if (!m->is_valid()) {
+          invalid++;
+        }
+      }
+    }
+
+    if (verbose) {
+      LOG_G("Methods uncategorized %d\n", uncategorized);
+      LOG_G("Methods invalid %d\n", invalid);
+    }
+
+    if (uncategorized || invalid) {
+      return err << ERR("Could not categorize all methods\n");
+    }
+  }
+  LOG("\n");
+
+  //----------------------------------------
+  // Check for and report bad fields.
+
+  std::vector<MtField*> bad_fields;
+  for (auto mod : all_modules) {
+    for (auto field : mod->all_fields) {
+      if (field->_state == CTX_INVALID) {
+        err << ERR("Field %s is in an invalid state\n", field->cname());
+        bad_fields.push_back(field);
+      }
+    }
+  }
+
+  for (auto bad_field : bad_fields) {
+    LOG_R("Bad field \"%s.%s\" log:\n", bad_field->_parent_mod->cname(),
+          bad_field->cname());
+    LOG_G("\n");
+  }
+
+  for (auto mod : all_modules) {
+    for (auto method : mod->all_methods) {
+      if (method->name().starts_with("tick") && !method->is_tick_) {
+        err << ERR("Method %s labeled 'tick' but is not a tick.\n", method->cname());
+      }
+      if (method->name().starts_with("tock") && !method->is_tock_) {
+        err << ERR("Method %s labeled 'tock' but is not a tock.\n", method->cname());
+      }
+    }
+  }
+
+  if (err.has_err()) {
+    LOG_R("Exiting due to error\n");
+  }
+
+  return err;
+}
+
 //------------------------------------------------------------------------------
 
 void MtModLibrary::dump_lib() {
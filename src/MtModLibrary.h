@@ -1,5 +1,6 @@
 #pragma once
 #include <functional>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -17,6 +18,7 @@ typedef std::function<int(MtMethod*)> propagate_visitor;
 
 struct MtModLibrary {
   void add_search_path(const std::string& path);
+  void add_source_blob(const std::string& filename, const std::string& blob);
   void add_source(MtSourceFile* source_file);
 
   CHECK_RETURN Err load_source(const char* name, MtSourceFile*& out_source);
@@ -29,6 +31,7 @@ struct MtModLibrary {
   MtStruct* get_struct(const std::string& name) const;
 
   CHECK_RETURN Err collect_structs();
+  CHECK_RETURN Err process_sources(bool verbose);
   CHECK_RETURN Err categorize_methods(bool verbose);
 
   MtModule* get_module(const std::string& module_name);
@@ -43,6 +46,7 @@ struct MtModLibrary {
   //----------
 
   std::vector<std::string> search_paths;
+  std::map<std::string, std::string> source_blobs;  // filename -> contents
   std::vector<MtSourceFile*> source_files;
   std::vector<MtModule*> all_modules;
   std::vector<MtStruct*> all_structs;
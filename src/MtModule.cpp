@@ -269,6 +269,17 @@ CHECK_RETURN Err MtModule::collect_fields_and_methods() {
       } else {
         auto new_field = new MtField(this, n, in_public);
         all_fields.push_back(new_field);
+
+        if (new_field->is_packed()) {
+          if (in_public) {
+            err << ERR("Packed field %s can't be a port\n", new_field->cname());
+          }
+          bool has_width = false;
+          for (auto c : n) has_width |= c.sym == sym_bitfield_clause;
+          if (!has_width) {
+            err << ERR("Packed field %s needs a bit width\n", new_field->cname());
+          }
+        }
       }
     }
 
@@ -1,36 +1,191 @@
 #include "MtNode.h"
 
+#include <algorithm>
+#include <deque>
+
 #include "Log.h"
 #include "MtSourceFile.h"
 
 const MnNode MnNode::null;
 
-bool operator==(const TSTreeCursor& a, const TSTreeCursor& b) {
-  if (a.context[0] != b.context[0]) return false;
-  if (a.context[1] != b.context[1]) return false;
-  if (a.tree != b.tree) return false;
-  if (a.id != b.id) return false;
-  return true;
+//------------------------------------------------------------------------------
+// Walks and iterators nest, so a cursor stays busy until it's released and a
+// new one is only created when every cursor in the pool is busy.
+
+struct CursorSlot {
+  TSTreeCursor cursor;
+  bool busy;
+};
+
+struct CursorPool {
+  ~CursorPool() {
+    for (auto& slot : slots) ts_tree_cursor_delete(&slot.cursor);
+  }
+  std::deque<CursorSlot> slots;  // deque so cursor pointers stay valid
+};
+
+static thread_local CursorPool cursor_pool;
+
+TSTreeCursor* mn_acquire_cursor(TSNode root) {
+  for (auto& slot : cursor_pool.slots) {
+    if (!slot.busy) {
+      slot.busy = true;
+      ts_tree_cursor_reset(&slot.cursor, root);
+      return &slot.cursor;
+    }
+  }
+  cursor_pool.slots.push_back({ts_tree_cursor_new(root), true});
+  return &cursor_pool.slots.back().cursor;
 }
 
-bool MnConstIterator::operator!=(const MnConstIterator& b) const {
-  return !(cursor == b.cursor);
+void mn_release_cursor(TSTreeCursor* cursor) {
+  for (auto& slot : cursor_pool.slots) {
+    if (&slot.cursor == cursor) {
+      slot.busy = false;
+      return;
+    }
+  }
+  assert(false);
+}
+
+//------------------------------------------------------------------------------
+
+void MnNodeTable::clear() {
+  nodes.clear();
+  child_list.clear();
+  named_child_list.clear();
+  field_slots.clear();
+  sym_slots.clear();
+}
+
+//----------
+
+void MnNodeTable::build(TSNode root) {
+  clear();
+  if (ts_node_is_null(root)) return;
+
+  // Pre-order walk to lay out the nodes. 'stack' holds the indices of the
+  // nodes whose subtrees are still open.
+
+  auto cursor = mn_acquire_cursor(root);
+  std::vector<int> stack;
+
+  while (1) {
+    int index = int(nodes.size());
+    MnNodeInfo e = {};
+    e.node = ts_tree_cursor_current_node(cursor);
+    e.sym = ts_node_symbol(e.node);
+    e.field = stack.size() ? ts_tree_cursor_current_field_id(cursor) : 0;
+    e.named = ts_node_is_named(e.node);
+    e.parent = stack.size() ? stack.back() : -1;
+    e.subtree_end = index + 1;
+    nodes.push_back(e);
+
+    if (ts_tree_cursor_goto_first_child(cursor)) {
+      stack.push_back(index);
+      continue;
+    }
+
+    while (stack.size() && !ts_tree_cursor_goto_next_sibling(cursor)) {
+      ts_tree_cursor_goto_parent(cursor);
+      nodes[stack.back()].subtree_end = int(nodes.size());
+      stack.pop_back();
+    }
+    if (stack.empty()) break;
+  }
+
+  mn_release_cursor(cursor);
+
+  // Size the child lists, then fill them. Children come after their parents
+  // in pre-order, so walking forward visits each node's children in order.
+
+  int child_total = 0;
+  int named_total = 0;
+  for (auto& e : nodes) {
+    if (e.parent < 0) continue;
+    nodes[e.parent].child_count++;
+    if (e.named) nodes[e.parent].named_child_count++;
+  }
+  for (auto& e : nodes) {
+    e.children = child_total;
+    e.named_children = named_total;
+    child_total += e.child_count;
+    named_total += e.named_child_count;
+    e.child_count = 0;
+    e.named_child_count = 0;
+  }
+
+  child_list.resize(child_total);
+  named_child_list.resize(named_total);
+  for (int i = 0; i < int(nodes.size()); i++) {
+    if (nodes[i].parent < 0) continue;
+    auto& p = nodes[nodes[i].parent];
+    child_list[p.children + p.child_count++] = i;
+    if (nodes[i].named) named_child_list[p.named_children + p.named_child_count++] = i;
+  }
+
+  // Only the first child with a given field is reachable through get_field().
+
+  for (auto& e : nodes) {
+    e.fields = int(field_slots.size());
+    for (int c = 0; c < e.child_count; c++) {
+      int child = child_list[e.children + c];
+      auto field = nodes[child].field;
+      if (!field) continue;
+
+      bool dupe = false;
+      for (int f = e.fields; f < int(field_slots.size()); f++) {
+        if (field_slots[f].field == field) dupe = true;
+      }
+      if (!dupe) field_slots.push_back({field, child});
+    }
+    e.field_count = int(field_slots.size()) - e.fields;
+  }
+
+  // Same for child_by_sym(), but sorted so lookups can binary search.
+
+  for (auto& e : nodes) {
+    e.syms = int(sym_slots.size());
+    for (int c = 0; c < e.child_count; c++) {
+      int child = child_list[e.children + c];
+      auto sym = nodes[child].sym;
+
+      bool dupe = false;
+      for (int s = e.syms; s < int(sym_slots.size()); s++) {
+        if (sym_slots[s].sym == sym) dupe = true;
+      }
+      if (!dupe) sym_slots.push_back({sym, child});
+    }
+    e.sym_count = int(sym_slots.size()) - e.syms;
+    std::sort(sym_slots.begin() + e.syms, sym_slots.end(),
+              [](const MnSymSlot& a, const MnSymSlot& b) { return a.sym < b.sym; });
+  }
+}
+
+//----------
+
+const MnNodeTable* mn_node_table(const MtSourceFile* source) {
+  if (!source || source->node_table.nodes.empty()) return nullptr;
+  return &source->node_table;
 }
 
 //------------------------------------------------------------------------------
 
 MnNode::MnNode() {
-  this->node = {0};
+  this->node = {};
   this->sym = 0;
   this->field = 0;
   this->source = nullptr;
+  this->index = -1;
 }
 
-MnNode::MnNode(TSNode node, int sym, int field, MtSourceFile* source) {
+MnNode::MnNode(TSNode node, int sym, int field, MtSourceFile* source,
+               int index) {
   this->node = node;
   this->sym = sym;
   this->field = field;
   this->source = source;
+  this->index = index;
 }
 
 //------------------------------------------------------------------------------
@@ -83,6 +238,15 @@ void MnNode::dump_source_lines() const {
 MnNode MnNode::get_field(int field_id) const {
   if (is_null()) return MnNode::null;
 
+  if (auto table = index >= 0 ? mn_node_table(source) : nullptr) {
+    auto& e = table->nodes[index];
+    for (int f = e.fields; f < e.fields + e.field_count; f++) {
+      auto& slot = table->field_slots[f];
+      if (slot.field == field_id) return mn_table_node(table, slot.child, source);
+    }
+    return MnNode::null;
+  }
+
   for (auto c : *this) {
     if (c.field == field_id) return c;
   }
@@ -92,23 +256,51 @@ MnNode MnNode::get_field(int field_id) const {
 
 //------------------------------------------------------------------------------
 
-MnNode MnNode::child(int index) const {
-  int i = 0;
+int MnNode::child_count() const {
+  if (auto table = index >= 0 ? mn_node_table(source) : nullptr) {
+    return table->nodes[index].child_count;
+  }
+  return (int)ts_node_child_count(node);
+}
+
+int MnNode::named_child_count() const {
+  if (auto table = index >= 0 ? mn_node_table(source) : nullptr) {
+    return table->nodes[index].named_child_count;
+  }
+  return (int)ts_node_named_child_count(node);
+}
+
+//----------
+
+MnNode MnNode::child(int i) const {
+  if (auto table = index >= 0 ? mn_node_table(source) : nullptr) {
+    auto& e = table->nodes[index];
+    if (i < 0 || i >= e.child_count) return MnNode::null;
+    return mn_table_node(table, table->child_list[e.children + i], source);
+  }
+
+  int n = 0;
   for (auto c : *this) {
-    if (index == i) return c;
-    i++;
+    if (i == n) return c;
+    n++;
   }
   return MnNode::null;
 }
 
 //----------
 
-MnNode MnNode::named_child(int index) const {
-  int i = 0;
+MnNode MnNode::named_child(int i) const {
+  if (auto table = index >= 0 ? mn_node_table(source) : nullptr) {
+    auto& e = table->nodes[index];
+    if (i < 0 || i >= e.named_child_count) return MnNode::null;
+    return mn_table_node(table, table->named_child_list[e.named_children + i], source);
+  }
+
+  int n = 0;
   for (auto c : *this) {
     if (!c.is_named()) continue;
-    if (index == i) return c;
-    i++;
+    if (i == n) return c;
+    n++;
   }
   return MnNode::null;
 }
@@ -118,6 +310,19 @@ MnNode MnNode::named_child(int index) const {
 MnNode MnNode::first_named_child() const { return named_child(0); }
 
 MnNode MnNode::child_by_sym(TSSymbol _sym) const {
+  if (is_null()) return MnNode::null;
+
+  if (auto table = index >= 0 ? mn_node_table(source) : nullptr) {
+    auto& e = table->nodes[index];
+    auto first = table->sym_slots.begin() + e.syms;
+    auto last = first + e.sym_count;
+    auto slot = std::lower_bound(first, last, _sym, [](const MnSymSlot& a, TSSymbol b) {
+      return a.sym < b;
+    });
+    if (slot == last || slot->sym != _sym) return MnNode::null;
+    return mn_table_node(table, slot->child, source);
+  }
+
   for (auto c : *this) {
     if (c.sym == _sym) return c;
   }
@@ -289,19 +494,6 @@ std::string MnNode::type5() const {
   }
 }
 
-//------------------------------------------------------------------------------
-
-void MnNode::visit_tree(NodeVisitor cv) {
-  cv(*this);
-  for (auto c : *this) {
-    if (c.is_null()) {
-      Err err;
-      err << ERR("Null node hit in visit_tree() for %s\n", text().c_str());
-    }
-    c.visit_tree(cv);
-  }
-}
-
 //------------------------------------------------------------------------------
 // Node debugging
 
@@ -369,11 +561,11 @@ struct NodeDumper {
     }
 
     LOG(" ");
-    for (int i = 0; i < color_stack.size(); i++) {
+    for (size_t i = 0; i < color_stack.size(); i++) {
       bool stack_top = i == color_stack.size() - 1;
       uint32_t color = color_stack[i];
 
-      if (color == -1)
+      if (color == uint32_t(-1))
         LOG_C(0x000000, "   ");
       else if (!stack_top)
         //LOG_C(color, "\261  ");
@@ -3,6 +3,8 @@
 
 #include <functional>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include "Err.h"
 #include "MtUtils.h"
@@ -12,11 +14,74 @@
 
 struct MtSourceFile;
 
+//------------------------------------------------------------------------------
+// Visitors passed to MnNode::visit_tree() can return one of these to steer the
+// walk. Visitors that return void always continue.
+
+enum VisitAction {
+  VISIT_CONTINUE = 0,  // Visit this node's children, then its siblings
+  VISIT_SKIP,          // Don't visit this node's children
+  VISIT_STOP,          // End the walk
+};
+
+// Creating a TSTreeCursor allocates, so walks and child iterators borrow one
+// from a per-thread pool instead.
+TSTreeCursor* mn_acquire_cursor(TSNode root);
+void mn_release_cursor(TSTreeCursor* cursor);
+
+//------------------------------------------------------------------------------
+// Flattened copy of a source file's syntax tree, built once after parsing.
+// Nodes are stored in pre-order so a node's subtree is [index, subtree_end).
+// Child, named child, field, and symbol lookups on MnNodes that carry a table
+// index read these arrays instead of going back to tree-sitter.
+
+struct MnNodeInfo {
+  TSNode node;
+  TSSymbol sym;
+  uint16_t field;
+  bool named;
+  int parent;
+  int subtree_end;
+  int children;           // Offset into child_list
+  int child_count;
+  int named_children;     // Offset into named_child_list
+  int named_child_count;
+  int fields;             // Offset into field_slots
+  int field_count;
+  int syms;               // Offset into sym_slots
+  int sym_count;
+};
+
+struct MnFieldSlot {
+  uint16_t field;
+  int child;              // First child with this field
+};
+
+struct MnSymSlot {
+  TSSymbol sym;
+  int child;              // First child with this symbol
+};
+
+struct MnNodeTable {
+  void build(TSNode root);
+  void clear();
+
+  std::vector<MnNodeInfo> nodes;
+  std::vector<int> child_list;
+  std::vector<int> named_child_list;
+  std::vector<MnFieldSlot> field_slots;
+  std::vector<MnSymSlot> sym_slots;       // Sorted by symbol within each node
+};
+
+// Null if the source hasn't been flattened.
+const MnNodeTable* mn_node_table(const MtSourceFile* source);
+
 //------------------------------------------------------------------------------
 
 struct MnNode {
   MnNode();
-  MnNode(TSNode node, int sym, int field, MtSourceFile* source);
+  MnNode(TSNode node, int sym, int field, MtSourceFile* source,
+         int index = -1);
 
   //----------
 
@@ -115,8 +180,8 @@ struct MnNode {
 
   //----------
 
-  int child_count() const { return (int)ts_node_child_count(node); }
-  int named_child_count() const { return (int)ts_node_named_child_count(node); }
+  int child_count() const;
+  int named_child_count() const;
 
   MnNode child(int i) const;
   MnNode named_child(int i) const;
@@ -140,9 +205,10 @@ struct MnNode {
   std::string name4() const;
   std::string type5() const;
 
-  typedef std::function<void(MnNode)> NodeVisitor;
-
-  void visit_tree(NodeVisitor cv);
+  // Pre-order walk over this node and all its descendants. Returns false if
+  // the visitor ended the walk with VISIT_STOP.
+  template <typename V>
+  bool visit_tree(V&& visitor) const;
 
   //----------
 
@@ -150,53 +216,80 @@ struct MnNode {
   TSSymbol sym;
   int field;
   MtSourceFile* source;
+  int index;  // Position in the source's MnNodeTable, -1 if not known
 
   static const MnNode null;
 };
 
+inline MnNode mn_table_node(const MnNodeTable* table, int index,
+                            MtSourceFile* source) {
+  auto& e = table->nodes[index];
+  return MnNode(e.node, e.sym, e.field, source, index);
+}
+
 //------------------------------------------------------------------------------
 
 struct MnConstIterator {
-  MnConstIterator(MnNode parent) {
-    if (ts_node_is_null(parent.node)) {
-      cursor = {0};
-    } else {
-      cursor = ts_tree_cursor_new(parent.node);
+  MnConstIterator(MnNode parent) : source(parent.source) {
+    if (parent.is_null()) return;
+
+    table = parent.index >= 0 ? mn_node_table(source) : nullptr;
+    if (table) {
+      auto& e = table->nodes[parent.index];
+      child = e.children;
+      child_end = e.children + e.child_count;
+      if (child == child_end) finish();
+      return;
+    }
 
-      if (!ts_tree_cursor_goto_first_child(&cursor)) {
-        ts_tree_cursor_delete(&cursor);
-        cursor = {0};
-      }
+    cursor = mn_acquire_cursor(parent.node);
+    if (!ts_tree_cursor_goto_first_child(cursor)) {
+      mn_release_cursor(cursor);
+      cursor = nullptr;
     }
-    this->source = parent.source;
   }
 
+  MnConstIterator(const MnConstIterator&) = delete;
+
   ~MnConstIterator() {
-    if (cursor.tree) {
-      ts_tree_cursor_delete(&cursor);
-    }
+    if (cursor) mn_release_cursor(cursor);
   }
 
   MnConstIterator& operator++() {
-    if (!ts_tree_cursor_goto_next_sibling(&cursor)) {
-      ts_tree_cursor_delete(&cursor);
-      cursor = {0};
+    if (table) {
+      if (++child == child_end) finish();
+    } else if (!ts_tree_cursor_goto_next_sibling(cursor)) {
+      mn_release_cursor(cursor);
+      cursor = nullptr;
     }
     return *this;
   }
 
-  // bool operator<(const MnConstIterator& b) const;
-  bool operator!=(const MnConstIterator& b) const;
+  void finish() {
+    table = nullptr;
+    child = child_end = 0;
+  }
+
+  bool operator!=(const MnConstIterator& b) const {
+    return cursor != b.cursor || table != b.table || child != b.child;
+  }
 
   const MnNode operator*() const {
-    auto child = ts_tree_cursor_current_node(&cursor);
+    if (table) return mn_table_node(table, table->child_list[child], source);
+
+    auto child = ts_tree_cursor_current_node(cursor);
     auto sym = ts_node_symbol(child);
-    auto field = ts_tree_cursor_current_field_id(&cursor);
+    auto field = ts_tree_cursor_current_field_id(cursor);
 
     return {child, sym, field, source};
   }
 
-  TSTreeCursor cursor;
+  // Table-driven iteration if the parent has a table index, cursor otherwise.
+  const MnNodeTable* table = nullptr;
+  int child = 0;
+  int child_end = 0;
+
+  TSTreeCursor* cursor = nullptr;
   MtSourceFile* source;
 };
 
@@ -204,8 +297,68 @@ inline MnConstIterator begin(const MnNode& parent) {
   return MnConstIterator(parent);
 }
 
-inline MnConstIterator end(const MnNode& parent) {
+inline MnConstIterator end(const MnNode&) {
   return MnConstIterator(MnNode::null);
 }
 
 //------------------------------------------------------------------------------
+
+template <typename V>
+bool MnNode::visit_tree(V&& visitor) const {
+  if (is_null()) return true;
+
+  auto visit = [&](const MnNode& n) {
+    if constexpr (std::is_void_v<decltype(visitor(n))>) {
+      visitor(n);
+      return VISIT_CONTINUE;
+    } else {
+      return VisitAction(visitor(n));
+    }
+  };
+
+  // Flattened trees can be walked by index.
+  auto table = index >= 0 ? mn_node_table(source) : nullptr;
+  if (table) {
+    int end = table->nodes[index].subtree_end;
+    for (int i = index; i < end;) {
+      auto action = visit(i == index ? *this : mn_table_node(table, i, source));
+      if (action == VISIT_STOP) return false;
+      i = action == VISIT_SKIP ? table->nodes[i].subtree_end : i + 1;
+    }
+    return true;
+  }
+
+  auto cursor = mn_acquire_cursor(node);
+  bool stopped = false;
+  int depth = 0;
+  MnNode n = *this;
+
+  while (1) {
+    auto action = visit(n);
+
+    if (action == VISIT_STOP) {
+      stopped = true;
+      break;
+    }
+
+    if (action == VISIT_CONTINUE && ts_tree_cursor_goto_first_child(cursor)) {
+      depth++;
+    } else {
+      // Climb until we find an unvisited sibling or get back to the start.
+      while (depth && !ts_tree_cursor_goto_next_sibling(cursor)) {
+        ts_tree_cursor_goto_parent(cursor);
+        depth--;
+      }
+      if (!depth) break;
+    }
+
+    auto child = ts_tree_cursor_current_node(cursor);
+    n = MnNode(child, ts_node_symbol(child),
+               ts_tree_cursor_current_field_id(cursor), source);
+  }
+
+  mn_release_cursor(cursor);
+  return !stopped;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,55 @@
+#include "MtProfile.h"
+
+#include "Log.h"
+#include "MtInstrument.h"
+#include "MtMethod.h"
+#include "MtModLibrary.h"
+#include "MtModule.h"
+#include "MtSourceFile.h"
+#include "MtUtils.h"
+
+//------------------------------------------------------------------------------
+// Each scope costs two timestamp reads, which would swamp a getter. Leaf funcs
+// are left out and their time shows up as their caller's self time. Ticks and
+// tocks are always timed, leaves or not, since that's where the work is.
+
+static bool needs_scope(MtMethod* m) {
+  if (m->is_constructor() || m->is_init_) return false;
+  if (m->_node.get_field(field_body).is_null()) return false;
+  bool leaf = m->internal_callees.empty() && m->external_callees.empty();
+  return !(leaf && m->is_func_);
+}
+
+//------------------------------------------------------------------------------
+
+CHECK_RETURN Err mt_emit_profile(MtModLibrary* lib, MtSourceFile* source,
+                                 std::map<std::string, std::string>& out) {
+  Err err;
+
+  for (auto s : lib->source_files) {
+    // Each scope goes right after the method's opening brace so line numbers
+    // don't move.
+    std::vector<MtSplice> scopes;
+
+    for (auto mod : lib->all_modules) {
+      if (mod->source_file != s) continue;
+      for (auto m : mod->all_methods) {
+        if (!needs_scope(m)) continue;
+        auto body = m->_node.get_field(field_body);
+        if (s->src_blob[body.start_byte()] != '{') {
+          return err << ERR("Body of %s.%s doesn't start with a brace\n", mod->cname(), m->cname());
+        }
+        scopes.push_back({body.start_byte() + 1, true, int(scopes.size()),
+                          str_printf(" MT_PROF_SCOPE(\"%s::%s\");", mod->cname(), m->cname())});
+      }
+    }
+
+    auto trailer = str_printf("// Instrumented by \"metron --profile\", %d methods timed. Do not edit.\n",
+                              int(scopes.size()));
+    out[mt_instrumented_name(s, source)] = mt_splice_source(s, scopes, "metron_profile.h", trailer);
+  }
+
+  return err;
+}
+
+//------------------------------------------------------------------------------
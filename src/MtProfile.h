@@ -0,0 +1,22 @@
+#pragma once
+#include <map>
+#include <string>
+
+#include "Err.h"
+#include "Platform.h"
+
+struct MtModLibrary;
+struct MtSourceFile;
+
+//------------------------------------------------------------------------------
+// Generates the instrumented sources for "metron --profile dir" - a copy of
+// every loaded source file that includes metron_profile.h and has
+// MT_PROF_SCOPE() at the top of each method that is worth timing. See
+// mt_prof_scope in metron_profile.h for the runtime side.
+// 'out' maps output paths, relative to the profile directory, to file
+// contents. Must be called after MtModLibrary::process_sources().
+
+CHECK_RETURN Err mt_emit_profile(MtModLibrary* lib, MtSourceFile* source,
+                                 std::map<std::string, std::string>& out);
+
+//------------------------------------------------------------------------------
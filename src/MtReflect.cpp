@@ -0,0 +1,128 @@
+#include "MtReflect.h"
+
+#include "Log.h"
+#include "MtField.h"
+#include "MtModLibrary.h"
+#include "MtModParam.h"
+#include "MtModule.h"
+#include "MtSourceFile.h"
+#include "MtUtils.h"
+
+//------------------------------------------------------------------------------
+
+static bool contains(const std::vector<MtField*>& fields, MtField* f) {
+  for (auto g : fields) if (g == f) return true;
+  return false;
+}
+
+static const char* field_kind(MtModule* mod, MtField* f) {
+  if (contains(mod->input_signals, f))     return "MT_FIELD_INPUT";
+  if (contains(mod->output_signals, f))    return "MT_FIELD_OUTPUT";
+  if (contains(mod->output_registers, f))  return "MT_FIELD_OUTPUT_REG";
+  if (contains(mod->private_signals, f))   return "MT_FIELD_SIGNAL";
+  if (contains(mod->private_registers, f)) return "MT_FIELD_REGISTER";
+  if (contains(mod->components, f))        return "MT_FIELD_COMPONENT";
+  if (contains(mod->dead_fields, f))       return "MT_FIELD_DEAD";
+  return nullptr;
+}
+
+//------------------------------------------------------------------------------
+
+static CHECK_RETURN Err emit_module(MtModule* mod, std::string& out) {
+  Err err;
+
+  // The access trick needs a concrete type, so templated modules can only be
+  // reflected through their default arguments.
+  std::string type = mod->name();
+  if (mod->mod_template) {
+    for (auto p : mod->all_modparams) {
+      if (p->_node.sym != sym_optional_parameter_declaration) {
+        out += str_printf("// %s has template parameters without defaults, not reflected\n\n",
+                          mod->cname());
+        return err;
+      }
+    }
+    type += "<>";
+  }
+
+  std::vector<MtField*> fields;
+  for (auto f : mod->all_fields) {
+    if (f->is_param() || f->is_enum() || f->_static) continue;
+    if (!field_kind(mod, f)) {
+      return err << ERR("Field %s.%s was never categorized\n", mod->cname(), f->cname());
+    }
+    fields.push_back(f);
+  }
+
+  out += "//------------------------------------------------------------------------------\n";
+  out += str_printf("// %s\n\n", type.c_str());
+
+  for (size_t i = 0; i < fields.size(); i++) {
+    auto f = fields[i];
+    if (f->is_packed()) continue;
+    auto tag = str_printf("mt_tag<%s, %d>", type.c_str(), int(i));
+    out += str_printf("template <> struct %s { friend constexpr auto mt_member(%s); };\n", tag.c_str(), tag.c_str());
+    out += str_printf("template struct mt_member_access<%s, &%s::%s>;\n", tag.c_str(), type.c_str(), f->cname());
+  }
+  if (fields.size()) out += "\n";
+
+  out += "template <>\n";
+  out += str_printf("struct mt_reflect<%s> {\n", type.c_str());
+  out += str_printf("  static constexpr const char* name = \"%s\";\n\n", mod->cname());
+
+  out += "  static constexpr auto members = std::make_tuple(";
+  for (size_t i = 0; i < fields.size(); i++) {
+    auto f = fields[i];
+    out += i ? ",\n    " : "\n    ";
+    if (f->is_packed()) {
+      out += "nullptr";
+    } else {
+      out += str_printf("mt_member(mt_tag<%s, %d>{})", type.c_str(), int(i));
+    }
+  }
+  out += ");\n\n";
+
+  out += str_printf("  static constexpr std::array<mt_field_info, %d> fields = {{", int(fields.size()));
+  for (size_t i = 0; i < fields.size(); i++) {
+    auto f = fields[i];
+    auto kind = field_kind(mod, f);
+    out += i ? ",\n    " : "\n    ";
+    if (f->is_packed()) {
+      MnNode node_bits;
+      for (auto c : f->_node) {
+        if (c.sym == sym_bitfield_clause) node_bits = c;
+      }
+      out += str_printf("mt_make_packed_field(\"%s\", %s, %s)", f->cname(), kind,
+                        node_bits.first_named_child().text().c_str());
+    } else {
+      out += str_printf("mt_make_field(\"%s\", %s, std::get<%d>(members))", f->cname(), kind, int(i));
+    }
+  }
+  out += "}};\n";
+  out += "};\n\n";
+
+  return err;
+}
+
+//------------------------------------------------------------------------------
+
+CHECK_RETURN Err mt_emit_reflection(MtModLibrary* lib, MtSourceFile* source,
+                                    std::string& out) {
+  Err err;
+
+  out += str_printf("// Reflection tables for %s, generated by \"metron --reflect\".\n",
+                    source->filename.c_str());
+  out += "// Do not edit.\n";
+  out += "#pragma once\n";
+  out += "#include \"metron_sim.h\"\n";
+  out += str_printf("#include \"%s\"\n\n", source->filename.c_str());
+
+  for (auto mod : lib->all_modules) {
+    err << emit_module(mod, out);
+  }
+
+  out += "//------------------------------------------------------------------------------\n";
+  return err;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+
+#include "Err.h"
+#include "Platform.h"
+
+struct MtModLibrary;
+struct MtSourceFile;
+
+//------------------------------------------------------------------------------
+// Generates the C++ reflection header for "metron --reflect out.h" - one
+// mt_reflect<Module> specialization per module with the categorized field
+// table from the translator. See mt_visit_fields() in metron_sim.h for the
+// runtime side. Must be called after MtModLibrary::process_sources().
+
+CHECK_RETURN Err mt_emit_reflection(MtModLibrary* lib, MtSourceFile* source,
+                                    std::string& out);
+
+//------------------------------------------------------------------------------
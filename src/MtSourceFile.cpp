@@ -39,10 +39,14 @@ CHECK_RETURN Err MtSourceFile::init(MtModLibrary* _lib,
 
   tree = ts_parser_parse_string(parser, NULL, source, (uint32_t)blob_size);
 
-  // Pull out all modules from the top level of the source.
+  // Flatten the tree so later passes don't have to go through tree-sitter for
+  // structural lookups.
   TSNode ts_root = ts_tree_root_node(tree);
+  node_table.build(ts_root);
+
+  // Pull out all modules from the top level of the source.
   auto root_sym = ts_node_symbol(ts_root);
-  root_node = MnNode(ts_root, root_sym, 0, this);
+  root_node = MnNode(ts_root, root_sym, 0, this, 0);
   err << collect_modules_and_structs(root_node);
 
   return err;
@@ -65,13 +69,14 @@ MtSourceFile::~MtSourceFile() {
 CHECK_RETURN Err MtSourceFile::collect_modules_and_structs(MnNode toplevel) {
   Err err;
 
-  for (const auto& c : toplevel) {
+  // Modules and structs are either top-level or inside a top-level #ifdef.
+  toplevel.visit_tree([&](MnNode c) {
     switch (c.sym) {
       case sym_struct_specifier: {
         MtStruct* new_struct = new MtStruct(c, lib);
         src_structs.push_back(new_struct);
         lib->all_structs.push_back(new_struct);
-        break;
+        return VISIT_SKIP;
       }
       case sym_class_specifier:
       case sym_template_declaration: {
@@ -79,14 +84,14 @@ CHECK_RETURN Err MtSourceFile::collect_modules_and_structs(MnNode toplevel) {
         err << mod->init(this, c);
         src_modules.push_back(mod);
         lib->all_modules.push_back(mod);
-        break;
-      }
-      case sym_preproc_ifdef: {
-        err << collect_modules_and_structs(c);
-        break;
+        return VISIT_SKIP;
       }
+      case sym_preproc_ifdef:
+        return VISIT_CONTINUE;
+      default:
+        return c.node.id == toplevel.node.id ? VISIT_CONTINUE : VISIT_SKIP;
     }
-  }
+  });
 
   return err;
 }
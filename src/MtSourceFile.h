@@ -31,6 +31,7 @@ struct MtSourceFile {
   bool use_utf8_bom = false;
 
   MnNode root_node;
+  MnNodeTable node_table;
 
   const char* source = nullptr;
   const char* source_end = nullptr;
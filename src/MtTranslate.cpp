@@ -0,0 +1,167 @@
+#include "MtTranslate.h"
+
+#include "Log.h"
+#include "MtBind.h"
+#include "MtCoverage.h"
+#include "MtCursor.h"
+#include "MtField.h"
+#include "MtModLibrary.h"
+#include "MtModule.h"
+#include "MtProfile.h"
+#include "MtReflect.h"
+#include "MtSourceFile.h"
+#include "Platform.h"
+
+#include <functional>
+
+//------------------------------------------------------------------------------
+// Redirects this thread's TinyLog into a string for the lifetime of the
+// object, then puts the log back the way it was. A null capture leaves the log
+// alone.
+
+struct LogCapture {
+  LogCapture(std::string* capture) : saved(TinyLog::get()) {
+    if (!capture) return;
+    auto& log = TinyLog::get();
+    log.reset();
+    log._capture = capture;
+  }
+
+  ~LogCapture() { TinyLog::get() = saved; }
+
+  TinyLog saved;
+};
+
+//------------------------------------------------------------------------------
+
+static void dump_module_tree(MtModLibrary& lib) {
+  LOG_B("Module info:\n");
+  LOG_INDENT();
+
+  LOG_B("Module tree:\n");
+  LOG_INDENT();
+  std::function<void(MtModule*, int, bool)> step;
+  step = [&](MtModule* m, int rank, bool last) -> void {
+    for (int i = 0; i < rank - 1; i++) LOG_Y("|  ");
+    if (last) {
+      if (rank) LOG_Y("\\--");
+    } else {
+      if (rank) LOG_Y("|--");
+    }
+    LOG_Y("%s\n", m->name().c_str());
+    auto field_count = m->all_fields.size();
+    for (auto i = 0; i < field_count; i++) {
+      auto field = m->all_fields[i];
+      if (!field->is_component()) continue;
+      step(lib.get_module(field->type_name()), rank + 1,
+           i == field_count - 1);
+    }
+  };
+
+  for (auto m : lib.all_modules) {
+    if (m->refcount == 0) step(m, 0, false);
+  }
+  LOG_DEDENT();
+  LOG_G("\n");
+
+  for (auto m : lib.all_modules) m->dump_module();
+
+  LOG_DEDENT();
+  LOG("\n");
+}
+
+//------------------------------------------------------------------------------
+
+MtTranslateResult mt_translate(const std::map<std::string, std::string>& sources,
+                               const MtTranslateOptions& options) {
+  MtTranslateResult result;
+  auto& stats = result.stats;
+
+  LogCapture capture(options.capture_log ? &result.diagnostics : nullptr);
+
+  if (sources.empty() && options.top.empty()) {
+    LOG_R("No source files\n");
+    return result;
+  }
+
+  std::string top = options.top.size() ? options.top : sources.begin()->first;
+  if (!sources.contains(top) && options.search_paths.empty()) {
+    LOG_R("Top file %s is not in the source list\n", top.c_str());
+    return result;
+  }
+
+  Err err;
+  MtModLibrary lib;
+  MtSourceFile* source = nullptr;
+
+  for (const auto& [filename, blob] : sources) {
+    lib.add_source_blob(filename, blob);
+  }
+  for (const auto& path : options.search_paths) {
+    lib.add_search_path(path);
+  }
+
+  //----------
+
+  auto time_a = timestamp();
+  err << lib.load_source(top.c_str(), source);
+  auto time_b = timestamp();
+  if (!err.has_err() && options.dump) source->root_node.dump_tree(0, 0, 255);
+  if (!err.has_err()) err << lib.process_sources(options.verbose);
+  if (!err.has_err() && options.verbose) dump_module_tree(lib);
+  auto time_c = timestamp();
+
+  if (!err.has_err()) {
+    MtCursor cursor(&lib, source, nullptr, &result.sv);
+    cursor.echo = options.echo;
+    if (options.echo) LOG_G("----------------------------------------\n\n");
+    err << cursor.emit_everything();
+    if (options.echo) LOG_G("----------------------------------------\n\n");
+    if (err.has_err()) LOG_R("Error during code generation\n");
+  }
+  if (!err.has_err() && options.reflect) {
+    err << mt_emit_reflection(&lib, source, result.reflect_h);
+  }
+  if (!err.has_err() && options.bind) {
+    err << mt_emit_binding(&lib, source, result.bind_h);
+  }
+  if (!err.has_err() && options.profile) {
+    err << mt_emit_profile(&lib, source, result.profile_sources);
+  }
+  if (!err.has_err() && options.coverage) {
+    err << mt_emit_coverage(&lib, source, result.coverage_sources);
+  }
+  auto time_d = timestamp();
+
+  //----------
+
+  if (!err.has_err() && source->use_utf8_bom) {
+    result.sv.insert(0, "\xEF\xBB\xBF");
+  }
+
+  for (auto s : lib.source_files) {
+    stats.source_files++;
+    for (auto c : s->src_blob) stats.source_lines += (c == '\n');
+  }
+
+  stats.modules = int(lib.all_modules.size());
+  stats.structs = int(lib.all_structs.size());
+  stats.output_bytes = int(result.sv.size());
+  stats.parse_ns = time_b - time_a;
+  stats.process_ns = time_c - time_b;
+  stats.emit_ns = time_d - time_c;
+
+  lib.teardown();
+
+  result.ok = !err.has_err();
+  if (!result.ok) {
+    result.sv.clear();
+    result.reflect_h.clear();
+    result.bind_h.clear();
+    result.profile_sources.clear();
+    result.coverage_sources.clear();
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
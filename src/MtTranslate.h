@@ -0,0 +1,55 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// Embeddable entry point for the translator - C++ source in, SystemVerilog out.
+// Nothing is written to disk, and nothing is read from it unless the options
+// name search paths. Unless 'capture_log' is off, everything the translator
+// would have logged ends up in 'diagnostics'. Each call builds its own
+// MtModLibrary, so separate threads can translate at the same time.
+
+struct MtTranslateOptions {
+  std::string top;            // File to translate, defaults to the first source
+  std::vector<std::string> search_paths;  // Where to look for files not in 'sources'
+  bool verbose = false;       // Include the module dump in the diagnostics
+  bool echo = false;          // Log the output as it's generated, color-coded
+  bool dump = false;          // Log the top file's syntax tree
+  bool capture_log = true;    // If false, log to stdout instead of capturing
+  bool reflect = false;       // Also generate the C++ reflection header
+  bool bind = false;          // Also generate the Verilator adapter header
+  bool profile = false;       // Also generate the instrumented profiling sources
+  bool coverage = false;      // Also generate the instrumented coverage sources
+};
+
+struct MtTranslateStats {
+  int source_files = 0;
+  int source_lines = 0;
+  int modules = 0;
+  int structs = 0;
+  int output_bytes = 0;
+
+  uint64_t parse_ns = 0;
+  uint64_t process_ns = 0;
+  uint64_t emit_ns = 0;
+};
+
+struct MtTranslateResult {
+  bool ok = false;
+  std::string sv;
+  std::string reflect_h;
+  std::string bind_h;
+  std::map<std::string, std::string> profile_sources;
+  std::map<std::string, std::string> coverage_sources;
+  std::string diagnostics;
+  MtTranslateStats stats;
+};
+
+// 'sources' maps filenames to file contents. Every file the top file includes
+// (other than metron_tools.h) must be in the map or in one of the search
+// paths. 'sources' can be empty if 'top' is on disk.
+MtTranslateResult mt_translate(const std::map<std::string, std::string>& sources,
+                               const MtTranslateOptions& options = {});
+
+//------------------------------------------------------------------------------
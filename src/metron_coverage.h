@@ -0,0 +1,338 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// Coverage runtime for "metron --coverage" builds. The translator writes
+// copies of the design's headers that include this file and have an
+// mt_cov_module table at the end of each module, an MT_COV_BRANCH() in every if, else and case arm, and an
+// MT_COV_TOGGLE() for each scalar register at the top of every tick and tock
+// that can be called from outside the module. Arms are one bit each, and
+// registers get a mask of bits that have risen and a mask of bits that have
+// fallen, so the hot path is a load, an OR and a store.
+//
+// When the program exits the bits are OR'd into the file named by
+// $METRON_COVERAGE ("metron.cov" if it isn't set) and a summary of the merged
+// results is printed to stderr, so coverage accumulates across testbenches and
+// runs. Modules and template instantiations with the same name share entries.
+// The bits aren't atomic - threads simulating the same module can drop hits.
+// Designs themselves never include this file.
+
+struct mt_cov_arm {
+  int line;
+  int col;
+  const char* kind;  // "if", "else", "case 3", "default"
+};
+
+struct mt_cov_reg {
+  const char* name;
+  int width;  // 0 if the type isn't tracked - arrays, structs, wide logics
+  uint64_t rise = 0;
+  uint64_t fall = 0;
+};
+
+// Everything the report needs is kept in a table that's never freed, as the
+// report runs at exit and the modules' static members may be gone by then.
+struct mt_cov_table {
+  const char* name;
+  const char* file;
+  std::vector<mt_cov_arm> arms;
+  std::vector<uint64_t> hits;
+  std::vector<mt_cov_reg> regs;
+  mt_cov_table* next;
+
+  bool was_hit(int arm) const { return (hits[arm >> 6] >> (arm & 63)) & 1; }
+};
+
+inline void mt_cov_save();
+
+inline std::atomic<mt_cov_table*>& mt_cov_tables() {
+  static std::atomic<mt_cov_table*> head = nullptr;
+  return head;
+}
+
+class mt_cov_module {
+ public:
+  mt_cov_module(const char* name, const char* file, std::vector<mt_cov_arm> arms,
+                std::vector<mt_cov_reg> regs)
+      : table(new mt_cov_table{name, file, arms, std::vector<uint64_t>((arms.size() + 63) / 64),
+                               regs, nullptr}),
+        hits(table->hits.data()) {
+    static std::atomic<bool> registered = false;
+    if (!registered.exchange(true)) atexit([]() { mt_cov_save(); });
+    table->next = mt_cov_tables().load();
+    while (!mt_cov_tables().compare_exchange_weak(table->next, table)) {
+    }
+  }
+
+  void hit(int arm) { hits[arm >> 6] |= 1ull << (arm & 63); }
+  mt_cov_reg& reg(int index) { return table->regs[index]; }
+
+ private:
+  mt_cov_table* table;
+  uint64_t* hits;
+};
+
+//----------------------------------------
+// Register values as raw bits, for anything that fits in 64 of them.
+
+template <typename T>
+constexpr int mt_cov_width() {
+  if constexpr (std::is_same_v<T, bool>) {
+    return 1;
+  } else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+    return int(sizeof(T) * 8);
+  } else if constexpr (requires { T::width; }) {
+    return T::width <= 64 ? T::width : 0;
+  } else {
+    return 0;
+  }
+}
+
+template <typename T>
+inline uint64_t mt_cov_bits(const T& v) {
+  constexpr int width = mt_cov_width<T>();
+  if constexpr (width == 0) {
+    return 0;
+  } else {
+    uint64_t mask = ~0ull >> (64 - width);
+    if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+      return uint64_t(v) & mask;
+    } else {
+      return uint64_t(v.get()) & mask;
+    }
+  }
+}
+
+// Samples a register on entry and exit of a method, so early returns and
+// nested calls are covered and each module instance compares against its own
+// previous value.
+template <typename F>
+class mt_cov_toggle_scope {
+ public:
+  mt_cov_toggle_scope(mt_cov_reg& reg, F read) : reg(reg), read(read), old(read()) {}
+
+  ~mt_cov_toggle_scope() {
+    uint64_t now = read();
+    reg.rise |= ~old & now;
+    reg.fall |= old & ~now;
+  }
+
+  mt_cov_toggle_scope(const mt_cov_toggle_scope&) = delete;
+  mt_cov_toggle_scope& operator=(const mt_cov_toggle_scope&) = delete;
+
+ private:
+  mt_cov_reg& reg;
+  F read;
+  uint64_t old;
+};
+
+#define MT_COV_CAT2(A, B) A##B
+#define MT_COV_CAT(A, B) MT_COV_CAT2(A, B)
+#define MT_COV_BRANCH(ID) mt_cov.hit(ID)
+#define MT_COV_TOGGLE(ID, FIELD)                                   \
+  mt_cov_toggle_scope MT_COV_CAT(mt_cov_toggle_, ID)(mt_cov.reg(ID), \
+                                                     [&]() { return mt_cov_bits(FIELD); })
+
+//----------------------------------------
+
+inline void mt_cov_reset() {
+  for (auto m = mt_cov_tables().load(); m; m = m->next) {
+    for (auto& h : m->hits) h = 0;
+    for (auto& r : m->regs) r.rise = r.fall = 0;
+  }
+}
+
+// One line per arm or register, keyed by everything but the coverage bits so
+// entries from a stale build of the design don't get mixed in:
+//
+//   arm uart_rx uart_rx.h 42:7 else 1
+//   reg uart_rx cursor 4 f e
+//
+// 'cov' maps each key to its bits, which get OR'd together.
+
+inline void mt_cov_collect(std::map<std::string, std::array<uint64_t, 2>>& cov) {
+  char key[512];
+  for (auto m = mt_cov_tables().load(); m; m = m->next) {
+    for (size_t i = 0; i < m->arms.size(); i++) {
+      snprintf(key, sizeof(key), "arm %s %s %d:%d %s", m->name, m->file, m->arms[i].line,
+               m->arms[i].col, m->arms[i].kind);
+      cov[key][0] |= m->was_hit(int(i));
+    }
+    for (auto& r : m->regs) {
+      if (!r.width) continue;
+      snprintf(key, sizeof(key), "reg %s %s %d", m->name, r.name, r.width);
+      cov[key][0] |= r.rise;
+      cov[key][1] |= r.fall;
+    }
+  }
+}
+
+inline void mt_cov_load(FILE* in, std::map<std::string, std::array<uint64_t, 2>>& cov) {
+  char line[512];
+  while (fgets(line, sizeof(line), in)) {
+    // The bits are the last one or two fields on the line.
+    char* end = line + strlen(line);
+    while (end > line && (end[-1] == '\n' || end[-1] == '\r')) *--end = 0;
+    char* split = strrchr(line, ' ');
+    if (!split) continue;
+    if (strncmp(line, "arm ", 4) == 0) {
+      *split = 0;
+      cov[line][0] |= strtoull(split + 1, nullptr, 16);
+    } else if (strncmp(line, "reg ", 4) == 0) {
+      *split = 0;
+      char* split2 = strrchr(line, ' ');
+      if (!split2) continue;
+      *split2 = 0;
+      cov[line][0] |= strtoull(split2 + 1, nullptr, 16);
+      cov[line][1] |= strtoull(split + 1, nullptr, 16);
+    }
+  }
+}
+
+inline void mt_cov_write(FILE* out, const std::map<std::string, std::array<uint64_t, 2>>& cov) {
+  for (auto& [key, bits] : cov) {
+    if (key.starts_with("arm ")) {
+      fprintf(out, "%s %llx\n", key.c_str(), (unsigned long long)bits[0]);
+    } else {
+      fprintf(out, "%s %llx %llx\n", key.c_str(), (unsigned long long)bits[0],
+              (unsigned long long)bits[1]);
+    }
+  }
+}
+
+// Per-module totals, then every arm that was never taken and every register
+// that has bits stuck in one direction.
+inline void mt_cov_summary(FILE* out, const std::map<std::string, std::array<uint64_t, 2>>& cov) {
+  struct totals {
+    int arms = 0, arms_hit = 0, bits = 0, bits_hit = 0;
+  };
+  std::map<std::string, totals> mods;
+  std::vector<std::string> missed;
+
+  char mod[256], rest[256];
+  for (auto& [key, bits] : cov) {
+    int width = 0;
+    if (sscanf(key.c_str(), "arm %255s %255[^\n]", mod, rest) == 2) {
+      auto& t = mods[mod];
+      t.arms++;
+      t.arms_hit += bits[0] ? 1 : 0;
+      if (!bits[0]) missed.push_back(std::string("  branch ") + mod + " " + rest);
+    } else if (sscanf(key.c_str(), "reg %255s %255s %d", mod, rest, &width) == 3) {
+      auto& t = mods[mod];
+      uint64_t mask = width < 64 ? (1ull << width) - 1 : ~0ull;
+      int hit = std::popcount(bits[0] & mask) + std::popcount(bits[1] & mask);
+      t.bits += width * 2;
+      t.bits_hit += hit;
+      if (hit < width * 2) {
+        char buf[600];
+        snprintf(buf, sizeof(buf), "  toggle %s.%s rise %llx fall %llx of %llx", mod, rest,
+                 (unsigned long long)(bits[0] & mask), (unsigned long long)(bits[1] & mask),
+                 (unsigned long long)mask);
+        missed.push_back(buf);
+      }
+    }
+  }
+
+  fprintf(out, "Metron coverage\n");
+  fprintf(out, "%21s%23s  %s\n", "branches", "toggles", "module");
+  for (auto& [name, t] : mods) {
+    fprintf(out, "%6d/%-6d %6.2f%%  %6d/%-6d %6.2f%%  %s\n", t.arms_hit, t.arms,
+            t.arms ? 100.0 * t.arms_hit / t.arms : 100.0, t.bits_hit, t.bits,
+            t.bits ? 100.0 * t.bits_hit / t.bits : 100.0, name.c_str());
+  }
+  if (missed.size()) {
+    fprintf(out, "\nNot covered:\n");
+    for (auto& m : missed) fprintf(out, "%s\n", m.c_str());
+  }
+  fflush(out);
+}
+
+// Testbenches often run in parallel and share one coverage file, so merges
+// into it are serialized with a lock file next to it. fopen()'s "x" mode is
+// the portable way to create a file only if it doesn't exist. A held lock is
+// never taken over, since a slow writer and the one taking over would both
+// write the file. After 'timeout_ms' this gives up instead, and a lock left
+// behind by a run that died mid-merge has to be removed by hand.
+
+class mt_cov_file_lock {
+ public:
+  explicit mt_cov_file_lock(const char* path, int timeout_ms = 60000)
+      : lock_path(std::string(path) + ".lock") {
+    for (int waited = 0; !(locked = try_lock()) && waited < timeout_ms; waited += 10) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+
+  ~mt_cov_file_lock() {
+    if (locked) remove(lock_path.c_str());
+  }
+
+  mt_cov_file_lock(const mt_cov_file_lock&) = delete;
+  mt_cov_file_lock& operator=(const mt_cov_file_lock&) = delete;
+
+  bool locked = false;
+
+ private:
+  bool try_lock() {
+    FILE* f = fopen(lock_path.c_str(), "wx");
+    if (f) fclose(f);
+    return f != nullptr;
+  }
+
+  std::string lock_path;
+};
+
+// OR's 'cov' into the coverage file at 'path', and leaves the merged result in
+// 'cov'.
+inline bool mt_cov_merge(const char* path, std::map<std::string, std::array<uint64_t, 2>>& cov) {
+  mt_cov_file_lock lock(path);
+  if (!lock.locked) {
+    fprintf(stderr, "Could not lock %s, remove %s.lock if no other run is using it\n", path, path);
+    return false;
+  }
+
+  if (FILE* in = fopen(path, "rb")) {
+    mt_cov_load(in, cov);
+    fclose(in);
+  }
+  FILE* out = fopen(path, "wb");
+  if (!out) {
+    fprintf(stderr, "Could not write coverage to %s\n", path);
+    return false;
+  }
+  mt_cov_write(out, cov);
+  fclose(out);
+  return true;
+}
+
+// Merges this run into the coverage file and prints the totals. Called at exit,
+// but testbenches that never return from main() can call it themselves.
+inline void mt_cov_save() {
+  std::map<std::string, std::array<uint64_t, 2>> cov;
+  mt_cov_collect(cov);
+
+  bool any = false;
+  for (auto& [key, bits] : cov) any |= (bits[0] | bits[1]) != 0;
+  if (!any) return;
+
+  const char* path = getenv("METRON_COVERAGE");
+  if (!path || !*path) path = "metron.cov";
+
+  mt_cov_merge(path, cov);
+  mt_cov_summary(stderr, cov);
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,214 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//------------------------------------------------------------------------------
+// Per-method profiler for "metron --profile" builds. The translator writes
+// copies of the design's headers that include this file and have an
+// MT_PROF_SCOPE("module::method") at the top of each method worth timing, and
+// the testbench is compiled against those copies instead of the originals.
+// Designs themselves never include this file. Each scope reads the timestamp
+// counter on entry and exit and charges the difference to its node in this
+// thread's calling-context tree, so time is broken down by call path, e.g.
+// "uart_top::tock > uart_tx::tick", and not just by method.
+//
+// Nothing is shared between threads while simulating. The per-thread trees
+// are merged and printed to stderr when the program exits. Testbenches can
+// also call mt_prof_reset() after warming up, or mt_prof_report() whenever
+// they like, as long as no other thread is inside a profiled method.
+
+inline uint64_t mt_prof_ticks() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+struct mt_prof_site {
+  const char* name;
+};
+
+struct mt_prof_node {
+  const char* name;
+  int parent;
+  int first_child;
+  int next_sibling;
+  uint64_t calls;
+  uint64_t ticks;
+  const mt_prof_site* site;
+};
+
+struct mt_prof_thread {
+  // nodes[0] is the root and never has a site.
+  std::vector<mt_prof_node> nodes = {{"<root>", -1, -1, -1, 0, 0, nullptr}};
+  int current = 0;
+  mt_prof_thread* next = nullptr;
+
+  int enter(const mt_prof_site* site) {
+    int c = nodes[current].first_child;
+    while (c >= 0 && nodes[c].site != site) c = nodes[c].next_sibling;
+    if (c < 0) {
+      c = int(nodes.size());
+      nodes.push_back({site->name, current, -1, nodes[current].first_child, 0, 0, site});
+      nodes[current].first_child = c;
+    }
+    current = c;
+    return c;
+  }
+};
+
+inline void mt_prof_report(FILE* out = stderr);
+
+inline std::atomic<mt_prof_thread*>& mt_prof_threads() {
+  static std::atomic<mt_prof_thread*> head = nullptr;
+  return head;
+}
+
+// Thread states are never freed, so threads that have already exited still
+// show up in the report.
+inline mt_prof_thread& mt_prof_this_thread() {
+  static thread_local mt_prof_thread* self = nullptr;
+  if (!self) {
+    static std::atomic<bool> registered = false;
+    if (!registered.exchange(true)) atexit([]() { mt_prof_report(); });
+
+    self = new mt_prof_thread();
+    self->next = mt_prof_threads().load();
+    while (!mt_prof_threads().compare_exchange_weak(self->next, self)) {
+    }
+  }
+  return *self;
+}
+
+class mt_prof_scope {
+ public:
+  mt_prof_scope(const mt_prof_site& site) : thread(mt_prof_this_thread()) {
+    node = thread.enter(&site);
+    start = mt_prof_ticks();
+  }
+
+  ~mt_prof_scope() {
+    uint64_t end = mt_prof_ticks();
+    auto& n = thread.nodes[node];
+    n.ticks += end - start;
+    n.calls++;
+    thread.current = n.parent;
+  }
+
+  mt_prof_scope(const mt_prof_scope&) = delete;
+  mt_prof_scope& operator=(const mt_prof_scope&) = delete;
+
+ private:
+  mt_prof_thread& thread;
+  int node;
+  uint64_t start;
+};
+
+#define MT_PROF_CAT2(A, B) A##B
+#define MT_PROF_CAT(A, B) MT_PROF_CAT2(A, B)
+#define MT_PROF_SCOPE(NAME)                                           \
+  static const mt_prof_site MT_PROF_CAT(mt_prof_site_, __LINE__){NAME}; \
+  mt_prof_scope MT_PROF_CAT(mt_prof_scope_, __LINE__)(MT_PROF_CAT(mt_prof_site_, __LINE__))
+
+//----------------------------------------
+
+inline void mt_prof_reset() {
+  for (auto t = mt_prof_threads().load(); t; t = t->next) {
+    for (auto& n : t->nodes) n.calls = n.ticks = 0;
+  }
+}
+
+// Merges every thread's tree by call path. Nodes with the same name under the
+// same parent are the same path, even if they came from different template
+// instantiations.
+inline void mt_prof_merge(const mt_prof_thread& src, int s, std::vector<mt_prof_node>& dst, int d) {
+  for (int c = src.nodes[s].first_child; c >= 0; c = src.nodes[c].next_sibling) {
+    auto& sc = src.nodes[c];
+    int m = dst[d].first_child;
+    while (m >= 0 && strcmp(dst[m].name, sc.name) != 0) m = dst[m].next_sibling;
+    if (m < 0) {
+      m = int(dst.size());
+      dst.push_back({sc.name, d, -1, dst[d].first_child, 0, 0, nullptr});
+      dst[d].first_child = m;
+    }
+    dst[m].calls += sc.calls;
+    dst[m].ticks += sc.ticks;
+    mt_prof_merge(src, c, dst, m);
+  }
+}
+
+inline void mt_prof_print(FILE* out, const std::vector<mt_prof_node>& nodes, int n, int depth,
+                          double total) {
+  std::vector<int> children;
+  for (int c = nodes[n].first_child; c >= 0; c = nodes[c].next_sibling) children.push_back(c);
+  std::sort(children.begin(), children.end(),
+            [&](int a, int b) { return nodes[a].ticks > nodes[b].ticks; });
+
+  for (int c : children) {
+    auto& node = nodes[c];
+    uint64_t inner = 0;
+    for (int g = node.first_child; g >= 0; g = nodes[g].next_sibling) inner += nodes[g].ticks;
+    uint64_t self = node.ticks > inner ? node.ticks - inner : 0;
+    fprintf(out, "%6.2f%% %6.2f%% %12llu %10.1f  %*s%s\n", 100.0 * node.ticks / total,
+            100.0 * self / total, (unsigned long long)node.calls,
+            node.calls ? double(node.ticks) / node.calls : 0.0, depth * 2, "", node.name);
+    mt_prof_print(out, nodes, c, depth + 1, total);
+  }
+}
+
+inline void mt_prof_report(FILE* out) {
+  std::vector<mt_prof_node> merged = {{"<root>", -1, -1, -1, 0, 0, nullptr}};
+  int threads = 0;
+  for (auto t = mt_prof_threads().load(); t; t = t->next) {
+    mt_prof_merge(*t, 0, merged, 0);
+    threads++;
+  }
+
+  uint64_t total = 0;
+  for (int c = merged[0].first_child; c >= 0; c = merged[c].next_sibling) total += merged[c].ticks;
+  if (!total) return;
+
+  fprintf(out, "Metron profile, %llu ticks in %d thread%s\n", (unsigned long long)total,
+          threads, threads == 1 ? "" : "s");
+  fprintf(out, "  total    self        calls ticks/call  method\n");
+  mt_prof_print(out, merged, 0, 0, double(total));
+
+  // Flat per-method totals, for when a hot spot is spread over many paths.
+  std::vector<mt_prof_node> flat;
+  for (size_t i = 1; i < merged.size(); i++) {
+    auto& node = merged[i];
+    uint64_t inner = 0;
+    for (int g = node.first_child; g >= 0; g = merged[g].next_sibling) inner += merged[g].ticks;
+    size_t f = 0;
+    while (f < flat.size() && strcmp(flat[f].name, node.name) != 0) f++;
+    if (f == flat.size()) flat.push_back({node.name, -1, -1, -1, 0, 0, nullptr});
+    flat[f].calls += node.calls;
+    flat[f].ticks += node.ticks > inner ? node.ticks - inner : 0;
+  }
+  std::sort(flat.begin(), flat.end(), [](auto& a, auto& b) { return a.ticks > b.ticks; });
+
+  fprintf(out, "\n   self        calls  method\n");
+  for (auto& f : flat) {
+    fprintf(out, "%6.2f%% %12llu  %s\n", 100.0 * f.ticks / total, (unsigned long long)f.calls,
+            f.name);
+  }
+  fflush(out);
+}
+
+//------------------------------------------------------------------------------
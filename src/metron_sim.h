@@ -0,0 +1,1570 @@
+#pragma once
+#include "metron_tools.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <tuple>
+#include <typeinfo>
+#include <utility>
+
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+//------------------------------------------------------------------------------
+// Testbench-side helpers for running Metron models. Designs never include
+// this file, so unlike metron_tools.h it's free to pull in OS headers.
+
+//------------------------------------------------------------------------------
+// Runtime side of "metron --reflect out.h". The generated header specializes
+// mt_reflect<Module> for every module in the design with a constexpr table of
+// its fields and a matching tuple of member pointers, so testbench tooling can
+// walk any module's state without per-design glue:
+//
+//   mt_visit_fields(top, [](const mt_field_info& info, auto& value) {
+//     printf("%s : %d x %d bits\n", info.name, int(info.extent), info.width);
+//   });
+//
+// Private fields are reached through explicit instantiations of
+// mt_member_access, which are exempt from access checking. Packed fields are
+// bitfields and can't be pointed to, so they're listed in the table with a
+// null member and the visitor skips them.
+
+enum mt_field_kind {
+  MT_FIELD_INPUT,       // Public field written from outside the module
+  MT_FIELD_OUTPUT,      // Public signal
+  MT_FIELD_OUTPUT_REG,  // Public register
+  MT_FIELD_SIGNAL,      // Private signal
+  MT_FIELD_REGISTER,    // Private register
+  MT_FIELD_COMPONENT,   // Submodule
+  MT_FIELD_DEAD,        // Never read or written
+};
+
+struct mt_field_info {
+  const char* name;
+  mt_field_kind kind;
+  int width;        // Bits per element, 0 for submodules and structs
+  uint64_t extent;  // Number of elements, 1 for scalars
+  size_t size;      // sizeof() the field, 0 if it's packed
+};
+
+template <typename Module>
+struct mt_reflect;
+
+template <typename T>
+constexpr bool mt_is_reflected = requires { mt_reflect<T>::fields; };
+
+// The generated header specializes mt_tag<Module, I> for field I of each
+// module, so tags can't collide whatever the module and field names are.
+template <typename Module, int I>
+struct mt_tag;
+
+template <typename Tag, auto M>
+struct mt_member_access {
+  friend constexpr auto mt_member(Tag) { return M; }
+};
+
+//----------------------------------------
+
+template <typename T>
+struct mt_field_shape {
+  static constexpr int width =
+      std::is_same_v<T, bool> ? 1
+      : std::is_integral_v<T> || std::is_enum_v<T> ? int(sizeof(T) * 8)
+      : 0;
+  static constexpr uint64_t extent = 1;
+};
+
+template <int WIDTH>
+struct mt_field_shape<logic<WIDTH>> {
+  static constexpr int width = WIDTH;
+  static constexpr uint64_t extent = 1;
+};
+
+template <typename T, size_t N>
+struct mt_field_shape<T[N]> {
+  static constexpr int width = mt_field_shape<T>::width;
+  static constexpr uint64_t extent = N * mt_field_shape<T>::extent;
+};
+
+template <typename T, uint64_t DEPTH>
+struct mt_field_shape<sparse_mem<T, DEPTH>> {
+  static constexpr int width = mt_field_shape<T>::width;
+  static constexpr uint64_t extent = DEPTH;
+};
+
+template <typename Module, typename T>
+constexpr mt_field_info mt_make_field(const char* name, mt_field_kind kind,
+                                      T Module::*) {
+  return {name, kind, mt_field_shape<T>::width, mt_field_shape<T>::extent,
+          sizeof(T)};
+}
+
+constexpr mt_field_info mt_make_packed_field(const char* name,
+                                             mt_field_kind kind, int width) {
+  return {name, kind, width, 1, 0};
+}
+
+//----------------------------------------
+// Byte offset of a field within 'mod'. Measured on a live object, so it's
+// well-defined for any module type.
+
+template <typename Module, typename T>
+inline size_t mt_field_offset(const Module& mod, T Module::*member) {
+  return size_t(reinterpret_cast<const char*>(&(mod.*member)) -
+                reinterpret_cast<const char*>(&mod));
+}
+
+// Offset of field 'index' in the table, or size_t(-1) for packed fields.
+template <typename Module>
+inline size_t mt_field_offset(const Module& mod, int index) {
+  size_t result = size_t(-1);
+  [&]<size_t... I>(std::index_sequence<I...>) {
+    auto step = [&](auto member, size_t i) {
+      if constexpr (!std::is_null_pointer_v<decltype(member)>) {
+        if (int(i) == index) result = mt_field_offset(mod, member);
+      }
+    };
+    (step(std::get<I>(mt_reflect<Module>::members), I), ...);
+  }(std::make_index_sequence<mt_reflect<Module>::fields.size()>{});
+  return result;
+}
+
+// Calls visitor(const mt_field_info&, T& value) for every field of 'mod' in
+// declaration order. Components are passed as-is, recurse into them with
+// another mt_visit_fields() if they're reflected too.
+template <typename Module, typename Visitor>
+inline void mt_visit_fields(Module& mod, Visitor&& visitor) {
+  typedef mt_reflect<std::remove_const_t<Module>> R;
+  [&]<size_t... I>(std::index_sequence<I...>) {
+    auto step = [&](auto member, const mt_field_info& info) {
+      if constexpr (!std::is_null_pointer_v<decltype(member)>) {
+        visitor(info, mod.*member);
+      }
+    };
+    (step(std::get<I>(R::members), R::fields[I]), ...);
+  }(std::make_index_sequence<R::fields.size()>{});
+}
+
+//------------------------------------------------------------------------------
+// Background writer for a sim_log_channel in deferred mode. The channel
+// records messages into a buffer, and each time the buffer fills it's handed
+// over here and formatted and written on this thread while the simulation
+// carries on with the other buffer. One buffer can be in flight at a time,
+// so the simulation only waits if the writer falls a whole buffer behind.
+//
+//   sim_log().set_deferred(true);
+//   sim_log_start_thread();
+//   ...
+//   sim_log_stop_thread();  // Or let the channel stop it when the thread exits
+
+class sim_log_thread_writer : public sim_log_writer {
+ public:
+  sim_log_thread_writer(sim_log_channel& chan, size_t capacity)
+      : chan(chan), pending((uint8_t*)malloc(capacity)) {
+    worker = std::thread([this]() {
+      while (!stop.load(std::memory_order_acquire)) {
+        if (!drain()) std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+      drain();
+    });
+  }
+
+  ~sim_log_thread_writer() override {
+    stop = true;
+    worker.join();
+    free(pending);
+  }
+
+  uint8_t* swap(uint8_t* full, size_t size) override {
+    wait();
+    uint8_t* empty = pending;
+    pending = full;
+    pending_size = size;
+    pending_full.store(true, std::memory_order_release);
+    return empty;
+  }
+
+  void wait() override {
+    while (pending_full.load(std::memory_order_acquire)) std::this_thread::yield();
+  }
+
+ private:
+  bool drain() {
+    if (!pending_full.load(std::memory_order_acquire)) return false;
+    chan.replay_records(pending, pending_size);
+    pending_full.store(false, std::memory_order_release);
+    return true;
+  }
+
+  sim_log_channel& chan;
+  uint8_t* pending;
+  size_t pending_size = 0;
+  std::atomic<bool> pending_full = false;
+  std::atomic<bool> stop = false;
+  std::thread worker;
+};
+
+inline void sim_log_start_thread(sim_log_channel& chan = sim_log()) {
+  if (!chan.has_thread()) chan.attach(new sim_log_thread_writer(chan, chan.get_capacity()));
+}
+
+inline void sim_log_stop_thread(sim_log_channel& chan = sim_log()) {
+  chan.attach(nullptr);
+}
+
+//------------------------------------------------------------------------------
+// Binary memory images. The header records the word width, the number of
+// words and the word address the image loads at, and the words follow at a
+// page-aligned offset in the same layout as a logic<WIDTH> array.
+//
+// readmemb_mmap() maps the image copy-on-write over the destination array
+// where it can, so large memories load without reading the file up front and
+// simulations loading the same image share its pages until they write to
+// them. That needs the destination to start on a page boundary - anywhere
+// else the image is read into the array instead.
+
+struct mem_image_header {
+  char magic[8];
+  uint32_t width;       // Bits per word
+  uint32_t word_bytes;  // sizeof(logic<width>)
+  uint64_t depth;       // Words in the image
+  uint64_t base;        // Word address of the first word
+  uint64_t data_offset;
+  uint64_t data_size;
+};
+
+static const char mem_image_magic[8] = "MTMEM01";
+static const uint64_t mem_image_align = 4096;
+
+//----------------------------------------
+
+inline bool writememb_image(const char* path, const void* mem, int width,
+                            int word_bytes, uint64_t depth, uint64_t base = 0) {
+  mem_image_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, mem_image_magic, 8);
+  h.width = width;
+  h.word_bytes = word_bytes;
+  h.depth = depth;
+  h.base = base;
+  h.data_offset = mem_image_align;
+  h.data_size = depth * word_bytes;
+
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    printf("Error writing %s: Could not open file\n", path);
+    return false;
+  }
+
+  uint8_t pad[mem_image_align] = {0};
+  memcpy(pad, &h, sizeof(h));
+  bool ok = fwrite(pad, 1, sizeof(pad), f) == sizeof(pad);
+  ok &= fwrite((const uint8_t*)mem + base * word_bytes, 1, h.data_size, f) == h.data_size;
+  fclose(f);
+
+  if (!ok) printf("Error writing %s: Short write\n", path);
+  return ok;
+}
+
+//----------------------------------------
+// Words outside the image are left alone, like readmemh() without a range.
+
+inline bool readmemb_mmap(const char* path, void* mem, int width,
+                          int word_bytes, uint64_t depth) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    printf("Error loading %s: Could not open file\n", path);
+    return false;
+  }
+
+  mem_image_header h;
+  fseek(f, 0, SEEK_END);
+  uint64_t file_size = uint64_t(ftell(f));
+  fseek(f, 0, SEEK_SET);
+  bool valid = fread(&h, sizeof(h), 1, f) == 1 &&
+               memcmp(h.magic, mem_image_magic, 8) == 0 &&
+               h.data_size == h.depth * h.word_bytes &&
+               h.data_offset + h.data_size <= file_size;
+  if (!valid) {
+    printf("Error loading %s: Not a memory image\n", path);
+    fclose(f);
+    return false;
+  }
+
+  if (int(h.width) != width || int(h.word_bytes) != word_bytes ||
+      h.base > depth || h.depth > depth - h.base) {
+    printf("Error loading %s: Image is %d x %llu @ %llu, memory is %d x %llu\n",
+           path, int(h.width), (unsigned long long)h.depth,
+           (unsigned long long)h.base, width, (unsigned long long)depth);
+    fclose(f);
+    return false;
+  }
+
+  uint8_t* dst = (uint8_t*)mem + h.base * word_bytes;
+  uint64_t size = h.data_size;
+  uint64_t mapped_end = 0;
+
+#ifndef _MSC_VER
+  // Only whole pages of the destination can be remapped, and only if they
+  // line up with page boundaries in the file.
+  if ((uintptr_t(dst) % mem_image_align) == 0) {
+    mapped_end = size - (size % mem_image_align);
+    if (mapped_end) {
+      void* p = mmap(dst, mapped_end, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_FIXED, fileno(f), h.data_offset);
+      if (p == MAP_FAILED) mapped_end = 0;
+    }
+  }
+#endif
+
+  // Read whatever we couldn't map.
+  bool ok = true;
+  if (mapped_end < size) {
+    ok = fseek(f, long(h.data_offset + mapped_end), SEEK_SET) == 0 &&
+         fread(dst + mapped_end, 1, size - mapped_end, f) == size - mapped_end;
+  }
+  fclose(f);
+
+  if (!ok) printf("Error loading %s: Short read\n", path);
+  return ok;
+}
+
+//----------------------------------------
+
+template <int WIDTH, int DEPTH>
+inline bool writememb_image(const char* path, const logic<WIDTH> (&mem)[DEPTH],
+                            int begin = 0, int end = DEPTH - 1) {
+  return writememb_image(path, mem, WIDTH, sizeof(logic<WIDTH>), end - begin + 1, begin);
+}
+
+template <int WIDTH, int DEPTH>
+inline bool readmemb_mmap(const char* path, logic<WIDTH> (&mem)[DEPTH]) {
+  return readmemb_mmap(path, mem, WIDTH, sizeof(logic<WIDTH>), DEPTH);
+}
+
+template <int WIDTH, int DEPTH>
+inline bool readmemb_mmap(const std::string& path, logic<WIDTH> (&mem)[DEPTH]) {
+  return readmemb_mmap(path.c_str(), mem, WIDTH, sizeof(logic<WIDTH>), DEPTH);
+}
+
+//------------------------------------------------------------------------------
+// VCD waveform writer for native simulations. It walks the mt_reflect<>
+// tables from "metron --reflect", so register the top module once and sample
+// after every tock:
+//
+//   sim_trace trace;
+//   trace.open("top.vcd");
+//   trace.add(top);
+//   for (uint64_t t = 0; t < cycles; t++) {
+//     top.tock();
+//     trace.sample(t);
+//   }
+//
+// Each sample compares the module against a shadow copy a word at a time and
+// only inspects the fields under words that changed, so an idle cycle costs
+// about as much as a memcmp. Text goes to a background thread in large
+// chunks. Reflected submodules become nested scopes. Packed fields, sparse
+// mems and arrays longer than max_array aren't traced.
+
+class sim_trace {
+ public:
+  sim_trace() = default;
+  sim_trace(const sim_trace&) = delete;
+  sim_trace& operator=(const sim_trace&) = delete;
+  ~sim_trace() { close(); }
+
+  bool open(const char* path, const char* timescale = "1ns") {
+    close();
+    out = fopen(path, "wb");
+    if (!out) return false;
+
+    header.clear();
+    text.clear();
+    roots.clear();
+    vars.clear();
+    this->timescale = timescale;
+    header_done = false;
+    dumping = false;
+    dumped = false;
+
+    stop = false;
+    worker = std::thread([this]() {
+      while (!stop.load(std::memory_order_acquire)) {
+        if (!drain()) std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+      drain();
+    });
+    open_count()++;
+    return true;
+  }
+
+  // Traces open in this process. Their writer threads don't survive a fork().
+  static std::atomic<int>& open_count() {
+    static std::atomic<int> count = 0;
+    return count;
+  }
+
+  // Writes out everything buffered so far and closes the file.
+  void close() {
+    if (!out) return;
+    if (!header_done) write_header(0);
+    handoff();
+    stop = true;
+    worker.join();
+    fclose(out);
+    out = nullptr;
+    open_count()--;
+  }
+
+  //----------
+  // Modules must be added before the first sample() and must not move while
+  // they're being traced.
+
+  template <typename Module>
+  void add(const Module& mod, const char* scope = mt_reflect<Module>::name) {
+    root r;
+    r.base = reinterpret_cast<const uint8_t*>(&mod);
+    r.size = sizeof(Module);
+    r.first_var = vars.size();
+    add_scope(mod, scope, r.base);
+    r.last_var = vars.size();
+    r.shadow.resize((r.size + 7) / 8);
+
+    std::sort(vars.begin() + r.first_var, vars.end(),
+              [](const var& a, const var& b) { return a.offset < b.offset; });
+    roots.push_back(std::move(r));
+  }
+
+  //----------
+  // Tracing can be switched off and on at any time, and only samples with
+  // window_begin <= time < window_end are recorded.
+
+  void set_enabled(bool e) { enabled = e; }
+  void set_window(uint64_t begin, uint64_t end) {
+    window_begin = begin;
+    window_end = end;
+  }
+
+  int max_array = 64;
+
+  //----------
+
+  void sample(uint64_t time) {
+    if (!out) return;
+    if (!header_done) write_header(time);
+
+    bool want = enabled && time >= window_begin && time < window_end;
+    if (!want) {
+      if (dumping) dump_off(time);
+      return;
+    }
+    if (!dumping) {
+      dump_on(time);
+      return;
+    }
+
+    time_written = false;
+    this->time = time;
+    for (auto& r : roots) sample_root(r);
+
+    if (text.size() >= chunk_size) handoff();
+  }
+
+ private:
+  struct var {
+    size_t offset;      // From the start of the root module
+    size_t elem_bytes;
+    int width;
+    int count;
+    int id_index;       // Elements get consecutive ids from here
+    uint64_t checked;   // Last sample this var was compared in
+  };
+
+  struct root {
+    const uint8_t* base;
+    size_t size;
+    size_t first_var;
+    size_t last_var;
+    std::vector<uint64_t> shadow;
+  };
+
+  template <typename T>
+  static constexpr bool is_bits = std::is_integral_v<T> || std::is_enum_v<T>;
+
+  template <int WIDTH>
+  static constexpr bool is_bits_logic(const logic<WIDTH>*) { return true; }
+  static constexpr bool is_bits_logic(const void*) { return false; }
+
+  template <typename T>
+  static constexpr bool traceable =
+      is_bits<T> || is_bits_logic(static_cast<const T*>(nullptr));
+
+  //----------
+
+  template <typename Module>
+  void add_scope(const Module& mod, const char* scope, const uint8_t* base) {
+    header += "$scope module ";
+    header += scope;
+    header += " $end\n";
+
+    mt_visit_fields(mod, [&](const mt_field_info& info, const auto& value) {
+      typedef std::remove_cvref_t<decltype(value)> T;
+      typedef std::remove_all_extents_t<T> E;
+      if constexpr (mt_is_reflected<T>) {
+        add_scope(value, info.name, base);
+      } else if constexpr (traceable<E>) {
+        int count = int(sizeof(T) / sizeof(E));
+        if (count > max_array) return;
+
+        var v;
+        v.offset = size_t(reinterpret_cast<const uint8_t*>(&value) - base);
+        v.elem_bytes = sizeof(E);
+        v.width = info.width;
+        v.count = count;
+        v.id_index = next_id;
+        v.checked = 0;
+        next_id += count;
+        vars.push_back(v);
+
+        bool reg = info.kind == MT_FIELD_REGISTER || info.kind == MT_FIELD_OUTPUT_REG;
+        for (int i = 0; i < count; i++) {
+          char buf[256];
+          if (std::is_array_v<T>) {
+            snprintf(buf, sizeof(buf), "$var %s %d %s %s[%d] $end\n",
+                     reg ? "reg" : "wire", v.width, id_code(v.id_index + i).c_str(),
+                     info.name, i);
+          } else {
+            snprintf(buf, sizeof(buf), "$var %s %d %s %s $end\n",
+                     reg ? "reg" : "wire", v.width, id_code(v.id_index + i).c_str(),
+                     info.name);
+          }
+          header += buf;
+        }
+      }
+    });
+
+    header += "$upscope $end\n";
+  }
+
+  // VCD identifiers are strings of printable characters, '!' through '~'.
+  static std::string id_code(int index) {
+    std::string id;
+    do {
+      id.push_back(char('!' + index % 94));
+      index /= 94;
+    } while (index);
+    return id;
+  }
+
+  //----------
+
+  void write_header(uint64_t time) {
+    header_done = true;
+    text += "$timescale ";
+    text += timescale;
+    text += " $end\n";
+    text += header;
+    text += "$enddefinitions $end\n";
+    dump_on(time);
+  }
+
+  // The first dump is $dumpvars, later ones resume after a $dumpoff.
+  void dump_on(uint64_t time) {
+    write_time(time);
+    text += dumped ? "$dumpon\n" : "$dumpvars\n";
+    dumping = true;
+    dumped = true;
+    for (auto& r : roots) {
+      memcpy(r.shadow.data(), r.base, r.size);
+      for (size_t i = r.first_var; i < r.last_var; i++) {
+        auto& v = vars[i];
+        for (int e = 0; e < v.count; e++) write_value(v, e, r.base);
+      }
+    }
+    text += "$end\n";
+  }
+
+  void dump_off(uint64_t time) {
+    dumping = false;
+    write_time(time);
+    text += "$dumpoff\n";
+    for (auto& v : vars) {
+      for (int e = 0; e < v.count; e++) {
+        text += v.width == 1 ? "x" : "bx ";
+        text += id_code(v.id_index + e);
+        text += '\n';
+      }
+    }
+    text += "$end\n";
+  }
+
+  //----------
+
+  void sample_root(root& r) {
+    if (memcmp(r.base, r.shadow.data(), r.size) == 0) return;
+
+    sample_index++;
+    size_t words = r.shadow.size();
+    size_t tail = r.size - (words - 1) * 8;
+    size_t cursor = r.first_var;
+
+    for (size_t w = 0; w < words; w++) {
+      uint64_t now = 0;
+      memcpy(&now, r.base + w * 8, w == words - 1 ? tail : 8);
+      if (now == r.shadow[w]) continue;
+
+      // Skip vars that end before this word, then check every var that
+      // overlaps it. Vars are sorted by offset, so this is a merge.
+      size_t lo = w * 8;
+      size_t hi = lo + 8;
+      while (cursor < r.last_var && end_of(vars[cursor]) <= lo) cursor++;
+      for (size_t i = cursor; i < r.last_var && vars[i].offset < hi; i++) {
+        auto& v = vars[i];
+        if (v.checked == sample_index) continue;
+        v.checked = sample_index;
+        compare_var(v, r);
+      }
+    }
+
+    memcpy(r.shadow.data(), r.base, r.size);
+  }
+
+  static size_t end_of(const var& v) { return v.offset + v.elem_bytes * v.count; }
+
+  void compare_var(const var& v, const root& r) {
+    auto old = reinterpret_cast<const uint8_t*>(r.shadow.data());
+    for (int e = 0; e < v.count; e++) {
+      size_t offset = v.offset + e * v.elem_bytes;
+      if (memcmp(r.base + offset, old + offset, v.elem_bytes) == 0) continue;
+      if (!time_written) {
+        write_time(time);
+        time_written = true;
+      }
+      write_value(v, e, r.base);
+    }
+  }
+
+  void write_time(uint64_t time) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "#%llu\n", (unsigned long long)time);
+    text += buf;
+  }
+
+  // Values go out in binary with leading zeros dropped, as VCD allows.
+  void write_value(const var& v, int e, const uint8_t* base) {
+    const uint8_t* src = base + v.offset + e * v.elem_bytes;
+    auto bit = [&](int i) { return (src[i >> 3] >> (i & 7)) & 1; };
+
+    if (v.width == 1) {
+      text += char('0' + bit(0));
+    } else {
+      text += 'b';
+      int top = v.width - 1;
+      while (top > 0 && !bit(top)) top--;
+      for (int i = top; i >= 0; i--) text += char('0' + bit(i));
+      text += ' ';
+    }
+    text += id_code(v.id_index + e);
+    text += '\n';
+  }
+
+  //----------
+  // One chunk can be in flight at a time. The simulation only waits if the
+  // writer falls a whole chunk behind.
+
+  void handoff() {
+    while (pending_full.load(std::memory_order_acquire)) std::this_thread::yield();
+    std::swap(text, pending);
+    text.clear();
+    pending_full.store(true, std::memory_order_release);
+  }
+
+  bool drain() {
+    if (!pending_full.load(std::memory_order_acquire)) return false;
+    fwrite(pending.data(), 1, pending.size(), out);
+    pending_full.store(false, std::memory_order_release);
+    return true;
+  }
+
+  static const size_t chunk_size = 1 << 20;
+
+  FILE* out = nullptr;
+  const char* timescale = "1ns";
+  std::string header;
+  std::string text;
+  std::string pending;
+  std::atomic<bool> pending_full = false;
+  std::atomic<bool> stop = false;
+  std::thread worker;
+
+  std::vector<root> roots;
+  std::vector<var> vars;
+  int next_id = 0;
+
+  bool header_done = false;
+  bool dumping = false;
+  bool dumped = false;
+  bool enabled = true;
+  bool time_written = false;
+  uint64_t time = 0;
+  uint64_t sample_index = 0;
+  uint64_t window_begin = 0;
+  uint64_t window_end = ~0ull;
+};
+
+//------------------------------------------------------------------------------
+// Checkpoints of a module's whole state, submodules and memories included.
+//
+//   sim_checkpoint boot;
+//   boot.save(top);
+//   boot.write("boot.mtckpt");
+//   ...
+//   sim_checkpoint boot;
+//   if (boot.read("boot.mtckpt") && boot.restore(top)) { ... }
+//
+// Metron modules are plain fields, so the module's bytes are the state.
+// The image is stored with runs of zero words collapsed, which keeps mostly
+// empty RAMs small. sparse_mems live on the heap, so their pages are saved
+// separately. Finding them needs the module's mt_reflect<> tables.
+// Modules without tables have to be trivially copyable. The header records
+// the module's type name and size, plus the name, offset and size of every
+// reflected field, and restore() refuses checkpoints that don't match.
+
+struct sim_checkpoint_header {
+  char magic[8];        // "MTCKPT1\0"
+  uint64_t layout;      // Hash of the module's type, size and reflected fields
+  uint64_t image_size;  // sizeof(Module)
+};
+
+static const char sim_checkpoint_magic[8] = {'M', 'T', 'C', 'K', 'P', 'T', '1', 0};
+
+template <typename T>
+struct mt_is_sparse_mem : public std::false_type {};
+
+template <typename T, uint64_t DEPTH>
+struct mt_is_sparse_mem<sparse_mem<T, DEPTH>> : public std::true_type {};
+
+// Calls f(mem) for every sparse_mem in 'mod' and its reflected submodules.
+template <typename Module, typename F>
+inline void mt_visit_sparse_mems(Module& mod, F&& f) {
+  if constexpr (mt_is_reflected<std::remove_const_t<Module>>) {
+    mt_visit_fields(mod, [&](const mt_field_info&, auto& value) {
+      typedef std::remove_cvref_t<decltype(value)> T;
+      if constexpr (mt_is_sparse_mem<T>::value) {
+        f(value);
+      } else if constexpr (mt_is_reflected<T>) {
+        mt_visit_sparse_mems(value, f);
+      }
+    });
+  }
+}
+
+template <typename Module>
+inline uint64_t mt_layout_hash(const Module& mod) {
+  const char* type_name = typeid(Module).name();
+  uint64_t h = hash_bytes((const uint8_t*)type_name, strlen(type_name)) ^ sizeof(Module);
+  if constexpr (mt_is_reflected<Module>) {
+    auto base = reinterpret_cast<const uint8_t*>(&mod);
+    mt_visit_fields(mod, [&](const mt_field_info& info, const auto& value) {
+      uint64_t field[3] = {
+          hash_bytes((const uint8_t*)info.name, strlen(info.name)),
+          uint64_t(reinterpret_cast<const uint8_t*>(&value) - base), info.size};
+      h = hash_bytes((const uint8_t*)field, sizeof(field)) ^ (h * 0x100000001b3ull);
+      typedef std::remove_cvref_t<decltype(value)> T;
+      if constexpr (mt_is_reflected<T>) h ^= mt_layout_hash(value);
+    });
+  }
+  return h;
+}
+
+//----------------------------------------
+
+class sim_checkpoint {
+ public:
+  template <typename Module>
+  void save(const Module& mod) {
+    static_assert(std::is_trivially_copyable_v<Module> || mt_is_reflected<Module>,
+                  "Modules containing sparse_mems need mt_reflect<> tables to be checkpointed");
+
+    data.clear();
+    sim_checkpoint_header h;
+    memcpy(h.magic, sim_checkpoint_magic, 8);
+    h.layout = mt_layout_hash(mod);
+    h.image_size = sizeof(Module);
+    append(&h, sizeof(h));
+
+    append_zero_runs(reinterpret_cast<const uint8_t*>(&mod), sizeof(Module));
+    mt_visit_sparse_mems(mod, [&](const auto& mem) { mem.save_pages(data); });
+  }
+
+  // Returns false and leaves 'mod' untouched if the checkpoint doesn't match
+  // the module or its image is corrupt. Corrupt sparse_mem pages past that
+  // can leave memories partly loaded.
+  template <typename Module>
+  bool restore(Module& mod) const {
+    static_assert(std::is_trivially_copyable_v<Module> || mt_is_reflected<Module>,
+                  "Modules containing sparse_mems need mt_reflect<> tables to be checkpointed");
+
+    sim_checkpoint_header h;
+    if (data.size() < sizeof(h)) return false;
+    memcpy(&h, data.data(), sizeof(h));
+    if (memcmp(h.magic, sim_checkpoint_magic, 8) != 0) return false;
+    if (h.image_size != sizeof(Module) || h.layout != mt_layout_hash(mod)) return false;
+
+    const uint8_t* src = data.data() + sizeof(h);
+    const uint8_t* end = data.data() + data.size();
+    std::vector<uint8_t> image(sizeof(Module));
+    if (!read_zero_runs(src, end, image.data(), sizeof(Module))) return false;
+
+    // The image holds the saved sparse_mems' page table pointers. Keep our
+    // own and reload the pages into them afterwards.
+    auto base = reinterpret_cast<const uint8_t*>(&mod);
+    mt_visit_sparse_mems(mod, [&](auto& mem) {
+      auto p = reinterpret_cast<const uint8_t*>(&mem);
+      memcpy(image.data() + (p - base), p, sizeof(mem));
+    });
+    memcpy((void*)&mod, image.data(), sizeof(Module));
+
+    bool ok = true;
+    mt_visit_sparse_mems(mod, [&](auto& mem) { ok = ok && mem.load_pages(src, end); });
+    return ok && src == end;
+  }
+
+  //----------
+
+  bool write(const char* path) const {
+    FILE* f = fopen(path, "wb");
+    if (!f) return false;
+    size_t written = fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+    return written == data.size();
+  }
+
+  bool read(const char* path) {
+    file_contents file;
+    if (!file.open(path)) return false;
+    data.assign(file.data, file.data + file.size);
+    return true;
+  }
+
+  std::vector<uint8_t> data;
+
+ private:
+  void append(const void* src, size_t size) {
+    auto p = reinterpret_cast<const uint8_t*>(src);
+    data.insert(data.end(), p, p + size);
+  }
+
+  //----------
+  // The image is a sequence of [u32 zero words][u32 literal words][literals].
+  // A partial word at the end is treated as if it were zero-padded.
+
+  void append_zero_runs(const uint8_t* src, size_t size) {
+    size_t words = (size + 7) / 8;
+    auto word = [&](size_t i) {
+      uint64_t w = 0;
+      memcpy(&w, src + i * 8, i * 8 + 8 <= size ? 8 : size - i * 8);
+      return w;
+    };
+
+    size_t i = 0;
+    while (i < words) {
+      uint32_t zeros = 0;
+      while (i < words && zeros < 0xFFFFFFFF && word(i) == 0) i++, zeros++;
+      uint32_t literals = 0;
+      while (i + literals < words && literals < 0xFFFFFFFF && word(i + literals) != 0) literals++;
+
+      append(&zeros, 4);
+      append(&literals, 4);
+      for (uint32_t j = 0; j < literals; j++) {
+        uint64_t w = word(i + j);
+        append(&w, 8);
+      }
+      i += literals;
+    }
+  }
+
+  static bool read_zero_runs(const uint8_t*& src, const uint8_t* end, uint8_t* dst, size_t size) {
+    size_t words = (size + 7) / 8;
+    size_t i = 0;
+    while (i < words) {
+      uint32_t run[2];
+      if (end - src < 8) return false;
+      memcpy(run, src, 8);
+      src += 8;
+      if (run[0] + uint64_t(run[1]) > words - i) return false;
+      if (uint64_t(end - src) < uint64_t(run[1]) * 8) return false;
+
+      for (uint32_t j = 0; j < run[0]; j++, i++) {
+        memset(dst + i * 8, 0, i * 8 + 8 <= size ? 8 : size - i * 8);
+      }
+      for (uint32_t j = 0; j < run[1]; j++, i++, src += 8) {
+        memcpy(dst + i * 8, src, i * 8 + 8 <= size ? 8 : size - i * 8);
+      }
+    }
+    return true;
+  }
+};
+
+//------------------------------------------------------------------------------
+// Runs body(top, i) for every i in [0, count), each on its own copy of 'top'.
+// Warm the model up once (boot a CPU, load a program, etc.), then let every
+// stimulus variant continue from there:
+//
+//   toplevel top(text_path, data_path);
+//   run_boot_sequence(top);
+//   auto results = sim_fork_variants(top, 16, [](toplevel& t, int i) {
+//     return run_test(t, i) ? 0 : 1;
+//   });
+//
+// On POSIX each variant runs in a forked child process, so the copy is
+// copy-on-write and up to 'jobs' variants run in parallel. The body's return
+// value becomes the child's exit code, so only its low 8 bits survive.
+// Results are returned in variant order, and a variant that crashes reports
+// -1. Elsewhere the variants run one after
+// another in this process, with 'top' restored from an in-memory checkpoint
+// before each one.
+
+template <typename Module, typename Body>
+inline std::vector<int> sim_fork_variants(Module& top, int count, Body&& body,
+                                          int jobs = 0) {
+  std::vector<int> results(count, -1);
+  if (jobs <= 0) jobs = int(std::thread::hardware_concurrency());
+  if (jobs <= 0) jobs = 1;
+
+#ifdef _MSC_VER
+  sim_checkpoint start;
+  start.save(top);
+  for (int i = 0; i < count; i++) {
+    if (i) start.restore(top);
+    results[i] = body(top, i);
+  }
+  start.restore(top);
+  (void)jobs;
+#else
+  // Anything buffered now would otherwise be printed once per child, and the
+  // log's writer thread wouldn't exist in the children.
+  bool log_thread = sim_log().has_thread();
+  sim_log_stop_thread();
+  sim_log().flush();
+  fflush(stdout);
+  fflush(stderr);
+
+  std::vector<pid_t> pids(count, -1);
+  int running = 0;
+  int next = 0;
+
+  // Only waits on our own children, so anything else the testbench forked
+  // keeps its exit status. Collects every child that has already finished,
+  // or blocks on the oldest one if none have.
+  auto reap = [&]() {
+    int reaped = 0;
+    for (int pass = 0; pass < 2 && !reaped; pass++) {
+      for (int i = 0; i < next; i++) {
+        if (pids[i] < 0) continue;
+        int status = 0;
+        pid_t pid = waitpid(pids[i], &status, pass ? 0 : WNOHANG);
+        if (pid == 0) continue;
+        results[i] = pid > 0 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        pids[i] = -1;
+        running--;
+        reaped++;
+        if (pass) break;
+      }
+    }
+    return reaped > 0;
+  };
+
+  while (next < count || running) {
+    if (next < count && running < jobs) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        int result = body(top, next);
+        fflush(stdout);
+        fflush(stderr);
+        sim_log().flush();
+        _exit(result);
+      }
+      // If fork() fails, run the variant here and put 'top' back after.
+      if (pid < 0) {
+        sim_checkpoint start;
+        start.save(top);
+        results[next] = body(top, next);
+        start.restore(top);
+      } else {
+        pids[next] = pid;
+        running++;
+      }
+      next++;
+    } else if (!reap()) {
+      break;
+    }
+  }
+
+  if (log_thread) sim_log_start_thread();
+#endif
+
+  return results;
+}
+
+//------------------------------------------------------------------------------
+// Lockstep comparison of two models of the same design, normally a Metron
+// class and its Verilated translation. The pair type drives both models
+// through a cycle and lists the ports to compare:
+//
+//   struct Pair {
+//     Module mt;
+//     VModule vl;
+//     void tock();   // Advance both models one cycle
+//     bool done();   // Stop once this is true
+//     template <typename V> void ports(V&& v) {
+//       v("result", mt.result(), vl.result_ret);
+//       v("done", mt.done(), vl.done_ret);
+//     }
+//   };
+//
+//   sim_lockstep<Pair> lockstep(pair);
+//   auto r = lockstep.run(1000000);
+//
+// Each cycle folds each side's port values into its own running hash. The
+// two hashes are compared once per batch. Once the sides diverge their
+// hashes stay different, so bisecting the per-cycle hashes of a failing
+// batch finds the first bad cycle. Finding the bad port means replaying the
+// batch. The checkpoint for that is a fork()ed copy of the process, taken
+// at the start of every batch. That works for single-threaded Verilated
+// models too, which can't be copied.
+//
+// fork() only copies the calling thread, so a replay can't run a model that
+// needs other threads or sample a trace whose writer thread is gone. Every
+// cycle's ports are compared directly instead, which is slower but finds the
+// same mismatch, when any of these hold:
+//   - the platform has no fork()
+//   - pair.vl is a Verilated model whose context has more than one thread
+//     (--threads)
+//   - a sim_trace is open
+//   - the process has threads besides this one, where that can be counted
+//     (Linux)
+// The calling thread's sim_log() writer thread is stopped for the run and
+// restarted after, as sim_fork_variants() does.
+
+struct sim_lockstep_result {
+  bool ok = true;
+  bool done = false;              // pair.done() came true within max_cycles
+  uint64_t cycles = 0;            // Cycles simulated
+  uint64_t bad_cycle = 0;         // First cycle with a mismatch, 0-based
+  const char* bad_port = nullptr; // Null if the port couldn't be found
+  uint64_t mt_value = 0;          // Mismatched values, from sim_port_bits()
+  uint64_t vl_value = 0;
+};
+
+// Ports up to 64 bits wide compare their values, wider ones a hash of them.
+
+template <typename T>
+inline uint64_t sim_port_bits(const T& v) {
+  return uint64_t(v);
+}
+
+template <int WIDTH>
+inline uint64_t sim_port_bits(const logic<WIDTH>& v) {
+  if constexpr (WIDTH <= 64) {
+    return v.get();
+  } else {
+    return hash_bytes((const uint8_t*)&v.x, sizeof(v.x));
+  }
+}
+
+//----------------------------------------
+// Threads in this process, 0 where that can't be found out.
+
+inline int sim_process_threads() {
+#ifdef __linux__
+  FILE* f = fopen("/proc/self/status", "r");
+  if (!f) return 0;
+  char line[256];
+  int threads = 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "Threads: %d", &threads) == 1) break;
+  }
+  fclose(f);
+  return threads;
+#else
+  return 0;
+#endif
+}
+
+//----------------------------------------
+
+template <typename Pair>
+class sim_lockstep {
+ public:
+  sim_lockstep(Pair& pair, uint64_t batch = 16384)
+      : pair(pair), batch(batch ? batch : 1), mt_hash(this->batch), vl_hash(this->batch) {}
+
+  sim_lockstep_result run(uint64_t max_cycles) {
+    sim_lockstep_result r;
+#ifdef _MSC_VER
+    run_direct(r, max_cycles);
+#else
+    bool log_thread = sim_log().has_thread();
+    sim_log_stop_thread();
+    if (can_fork()) {
+      while (r.ok && !r.done && r.cycles < max_cycles) run_batch(r, max_cycles);
+    } else {
+      run_direct(r, max_cycles);
+    }
+    if (log_thread) sim_log_start_thread();
+#endif
+    return r;
+  }
+
+  // True if run() can checkpoint batches by forking, see above.
+  bool can_fork() {
+#ifdef _MSC_VER
+    return false;
+#else
+    if constexpr (requires { pair.vl.contextp()->threads(); }) {
+      if (pair.vl.contextp()->threads() > 1) return false;
+    }
+    if (sim_trace::open_count() > 0) return false;
+    return sim_process_threads() <= 1;
+#endif
+  }
+
+ private:
+  static uint64_t mix(uint64_t h, uint64_t v) {
+    h = (h ^ v) * 0x100000001b3ull;
+    return h ^ (h >> 29);
+  }
+
+  // Compares the ports of the cycle just simulated, returns false and fills
+  // in 'r' on the first mismatch.
+  bool compare(sim_lockstep_result& r, uint64_t cycle) {
+    bool ok = true;
+    pair.ports([&](const char* name, const auto& a, const auto& b) {
+      uint64_t va = sim_port_bits(a);
+      uint64_t vb = sim_port_bits(b);
+      if (ok && va != vb) {
+        ok = false;
+        r.ok = false;
+        r.bad_cycle = cycle;
+        r.bad_port = name;
+        r.mt_value = va;
+        r.vl_value = vb;
+      }
+    });
+    return ok;
+  }
+
+  void run_direct(sim_lockstep_result& r, uint64_t max_cycles) {
+    while (!r.done && r.cycles < max_cycles) {
+      pair.tock();
+      if (!compare(r, r.cycles++)) return;
+      r.done = pair.done();
+    }
+  }
+
+#ifndef _MSC_VER
+  void run_batch(sim_lockstep_result& r, uint64_t max_cycles) {
+    uint64_t start = r.cycles;
+    uint64_t hm = 0, hv = 0, n = 0;
+
+    snapshot snap;
+    snap.take(*this);
+
+    while (n < batch && start + n < max_cycles) {
+      pair.tock();
+      pair.ports([&](const char*, const auto& a, const auto& b) {
+        hm = mix(hm, sim_port_bits(a));
+        hv = mix(hv, sim_port_bits(b));
+      });
+      mt_hash[n] = hm;
+      vl_hash[n] = hv;
+      n++;
+      if (pair.done()) {
+        r.done = true;
+        break;
+      }
+    }
+    r.cycles = start + n;
+    if (hm == hv) return;
+
+    // The last cycle is known bad, find the first.
+    uint64_t lo = 0, hi = n - 1;
+    while (lo < hi) {
+      uint64_t mid = (lo + hi) / 2;
+      if (mt_hash[mid] != vl_hash[mid]) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+
+    r.ok = false;
+    r.bad_cycle = start + lo;
+    snap.replay(r, start, lo);
+  }
+
+  //----------
+  // The child process sits at the start of the batch until the parent either
+  // lets it go or asks it to replay up to a cycle and report the mismatch.
+  // It shares the parent's address space layout, so port names come back as
+  // plain pointers.
+
+  struct snapshot {
+    pid_t pid = -1;
+    int cmd = -1;
+    int res = -1;
+
+    void take(sim_lockstep& l) {
+      int cmd_pipe[2], res_pipe[2];
+      if (pipe(cmd_pipe)) return;
+      if (pipe(res_pipe)) {
+        ::close(cmd_pipe[0]);
+        ::close(cmd_pipe[1]);
+        return;
+      }
+
+      fflush(stdout);
+      fflush(stderr);
+      pid = fork();
+
+      if (pid == 0) {
+        ::close(cmd_pipe[1]);
+        ::close(res_pipe[0]);
+        // Whatever the design prints during the replay was printed already.
+        sim_log().set_min_level(SIM_LOG_NONE);
+
+        uint64_t target;
+        sim_lockstep_result r;
+        if (::read(cmd_pipe[0], &target, 8) == 8) {
+          for (uint64_t i = 0; i <= target; i++) {
+            l.pair.tock();
+            if (!l.compare(r, i)) break;
+          }
+          if (::write(res_pipe[1], &r, sizeof(r)) != sizeof(r)) _exit(1);
+        }
+        _exit(0);
+      }
+
+      ::close(cmd_pipe[0]);
+      ::close(res_pipe[1]);
+      if (pid < 0) {
+        ::close(cmd_pipe[1]);
+        ::close(res_pipe[0]);
+        return;
+      }
+      cmd = cmd_pipe[1];
+      res = res_pipe[0];
+    }
+
+    void replay(sim_lockstep_result& r, uint64_t start, uint64_t target) {
+      if (pid < 0) return;
+      sim_lockstep_result found;
+      if (::write(cmd, &target, 8) == 8 &&
+          ::read(res, &found, sizeof(found)) == sizeof(found) && !found.ok) {
+        r.bad_cycle = start + found.bad_cycle;
+        r.bad_port = found.bad_port;
+        r.mt_value = found.mt_value;
+        r.vl_value = found.vl_value;
+      }
+    }
+
+    ~snapshot() {
+      if (pid < 0) return;
+      ::close(cmd);
+      ::close(res);
+      waitpid(pid, nullptr, 0);
+    }
+  };
+#endif
+
+  Pair& pair;
+  uint64_t batch;
+  std::vector<uint64_t> mt_hash;
+  std::vector<uint64_t> vl_hash;
+};
+
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Runtime side of "metron --bind". The generated <Module>_vl<VL> adapters use
+// these to move values between Metron types and the plain integers (or
+// VlWide word arrays, above 64 bits) that Verilator uses for ports.
+
+template <typename P, typename T>
+inline void sim_vl_put(P& port, const T& v) {
+  port = P(v);
+}
+
+template <typename P, int WIDTH>
+inline void sim_vl_put(P& port, const logic<WIDTH>& v) {
+  if constexpr (WIDTH <= 64) {
+    port = P(v.get());
+  } else if constexpr (WIDTH <= logic_max_narrow) {
+    for (int i = 0; i < (WIDTH + 31) / 32; i++) port[i] = uint32_t(v.get() >> (i * 32));
+  } else {
+    for (int i = 0; i < (WIDTH + 31) / 32; i++) port[i] = uint32_t(v.limb(i >> 1) >> ((i & 1) * 32));
+  }
+}
+
+template <typename T, typename P>
+struct sim_vl_getter {
+  static T get(const P& port) { return T(port); }
+};
+
+template <int WIDTH, typename P>
+struct sim_vl_getter<logic<WIDTH>, P> {
+  static logic<WIDTH> get(const P& port) {
+    logic<WIDTH> r;
+    if constexpr (WIDTH <= 64) {
+      r = typename logic<WIDTH>::BASE(port);
+    } else if constexpr (WIDTH <= logic_max_narrow) {
+      typename logic<WIDTH>::BASE t = 0;
+      for (int i = 0; i < (WIDTH + 31) / 32; i++) t |= typename logic<WIDTH>::BASE(port[i]) << (i * 32);
+      r = t;
+    } else {
+      for (int i = 0; i < (WIDTH + 31) / 32; i++) r.x[i >> 1] |= uint64_t(port[i]) << ((i & 1) * 32);
+      r.fix();
+    }
+    return r;
+  }
+};
+
+template <typename T, typename P>
+inline T sim_vl_get(const P& port) {
+  return sim_vl_getter<T, P>::get(port);
+}
+
+//----------------------------------------
+// A public Metron field that lives in a Verilator port. Reads and writes go
+// straight to the port, with the field's own type on the Metron side.
+
+template <typename T, typename P>
+struct sim_vl_field {
+  P& port;
+
+  sim_vl_field& operator=(const T& v) {
+    sim_vl_put(port, v);
+    return *this;
+  }
+  operator T() const { return sim_vl_get<T>(port); }
+  T get() const { return sim_vl_get<T>(port); }
+};
+
+//----------------------------------------
+// Ends a clock cycle. Metron models commit their ticks as each method
+// returns, so this only does something for adapters, where it's the clock
+// edge. Testbenches that drive both kinds of model call it after each cycle's
+// method calls.
+
+template <typename Top>
+inline void sim_cycle(Top& top) {
+  if constexpr (requires { top.cycle(); }) top.cycle();
+}
+
+//----------------------------------------
+// Return and parameter types of a Metron method, from its member pointer.
+// The adapters use this instead of copying types out of the source, which may
+// name private constants or template parameters.
+
+template <typename F>
+struct sim_method_traits;
+
+template <typename R, typename C, typename... A>
+struct sim_method_traits<R (C::*)(A...)> {
+  using ret = R;
+  template <int N>
+  using arg = std::decay_t<std::tuple_element_t<N, std::tuple<A...>>>;
+};
+
+template <typename R, typename C, typename... A>
+struct sim_method_traits<R (C::*)(A...) const> : sim_method_traits<R (C::*)(A...)> {};
+
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Simulation-rate benchmark harness. 'body(n)' simulates n cycles and returns
+// how many instructions were retired in them, or 0 for designs that aren't
+// CPUs. The warmup runs once, then 'trials' timed runs of 'cycles' each.
+//
+//   auto r = sim_bench(10000000, 100000, 5, [&](uint64_t n) {
+//     for (uint64_t i = 0; i < n; i++) top.tock(0);
+//     sim_bench_keep(top);
+//     return uint64_t(0);
+//   });
+//   sim_bench_print(stdout, "uart", "metron", r);
+//
+// Rows are tab-separated with a fixed column order so runs of different
+// examples can be concatenated and diffed. Per-core rates use process CPU
+// time, so they stay comparable when Verilator runs with threads.
+
+// Makes the compiler assume everything in 'v' is read here, so a simulation
+// whose results are never looked at doesn't get optimized away. Call it at
+// the end of the benchmark body, not every cycle.
+template <typename T>
+inline void sim_bench_keep(T& v) {
+#if defined(__GNUC__)
+  asm volatile("" : : "g"(&v) : "memory");
+#else
+  static void* volatile sink;
+  sink = &v;
+#endif
+}
+
+struct sim_bench_result {
+  uint64_t cycles = 0;   // per trial
+  uint64_t instret = 0;  // in the median trial
+  int trials = 0;
+  double mhz_best = 0;
+  double mhz_median = 0;
+  double cycles_per_cpu_sec = 0;  // median
+  double mips_median = 0;
+};
+
+template <typename Body>
+inline sim_bench_result sim_bench(uint64_t cycles, uint64_t warmup, int trials,
+                                  Body&& body) {
+  using clock = std::chrono::steady_clock;
+
+  sim_bench_result r;
+  r.cycles = cycles;
+  r.trials = trials < 1 ? 1 : trials;
+
+  if (warmup) body(warmup);
+
+  // Trials can retire different numbers of instructions, so the median trial
+  // by wall time supplies both halves of mips_median.
+  std::vector<std::pair<double, uint64_t>> wall(r.trials);
+  std::vector<double> cpu(r.trials);
+  for (int i = 0; i < r.trials; i++) {
+    auto wall_a = clock::now();
+    auto cpu_a = ::clock();
+    uint64_t instret = body(cycles);
+    auto cpu_b = ::clock();
+    auto wall_b = clock::now();
+    wall[i] = {std::chrono::duration<double>(wall_b - wall_a).count(), instret};
+    cpu[i] = double(cpu_b - cpu_a) / CLOCKS_PER_SEC;
+  }
+
+  std::sort(wall.begin(), wall.end());
+  std::sort(cpu.begin(), cpu.end());
+  double wall_med = wall[r.trials / 2].first;
+  double cpu_med = cpu[r.trials / 2];
+
+  r.instret = wall[r.trials / 2].second;
+  r.mhz_best = double(cycles) / wall[0].first / 1.0e6;
+  r.mhz_median = double(cycles) / wall_med / 1.0e6;
+  r.cycles_per_cpu_sec = cpu_med > 0 ? double(cycles) / cpu_med : 0;
+  r.mips_median = double(r.instret) / wall_med / 1.0e6;
+  return r;
+}
+
+inline void sim_bench_print_header(FILE* f) {
+  fprintf(f, "example\tmodel\tcycles\ttrials\tmhz_best\tmhz_median\tcycles_per_cpu_sec\tinstret\tmips_median\n");
+}
+
+inline void sim_bench_print(FILE* f, const char* example, const char* model,
+                            const sim_bench_result& r) {
+  fprintf(f, "%s\t%s\t%llu\t%d\t%.3f\t%.3f\t%.0f\t%llu\t%.3f\n", example, model,
+          (unsigned long long)r.cycles, r.trials, r.mhz_best, r.mhz_median,
+          r.cycles_per_cpu_sec, (unsigned long long)r.instret, r.mips_median);
+}
+
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Idle-cycle fast-forward. Counter-dominated designs spend most cycles waiting
+// for a delay to run out, and a module that knows that can skip the wait in
+// one step instead of ticking through it. It opts in with two members, marked
+// so the translator leaves them out of the SystemVerilog:
+//
+//   // metron_noconvert
+//   uint64_t sim_idle_cycles() const;  // How many upcoming cycles are idle
+//   // metron_noconvert
+//   void sim_skip(uint64_t cycles);    // Apply that many of them at once
+//
+// "Idle" means the only state changes are ones sim_skip() can reproduce
+// exactly, given the inputs the testbench drives every cycle. Return 0 if the
+// next cycle isn't idle, or ~0ull if nothing will change until the inputs do.
+//
+//   auto r = sim_fast_forward(top, 10000000, [](auto& t) { t.tock(0); });
+//
+// runs step() for busy cycles and sim_skip() for idle ones, so long idle
+// stretches cost a single call. With 'check' set, every skip is also replayed
+// through step() from a checkpoint and the two results are compared. The first
+// mismatch stops the run, with 'top' left in the stepped state. That catches
+// hooks that don't match the design, at the cost of all the speed. step()
+// should only touch the model, since check mode calls it on replays too.
+
+template <typename Module>
+concept sim_can_fast_forward = requires(Module& m, const Module& c, uint64_t n) {
+  { c.sim_idle_cycles() } -> std::convertible_to<uint64_t>;
+  m.sim_skip(n);
+};
+
+struct sim_fast_forward_result {
+  uint64_t cycles = 0;   // Cycles simulated, stepped or skipped
+  uint64_t stepped = 0;  // Cycles run through step()
+  uint64_t skipped = 0;  // Cycles covered by sim_skip()
+  uint64_t skips = 0;    // Number of sim_skip() calls
+  bool ok = true;        // False if check mode found a bad skip
+  uint64_t bad_cycle = 0;
+  uint64_t bad_length = 0;
+};
+
+template <typename Module, typename Step>
+  requires sim_can_fast_forward<Module>
+inline sim_fast_forward_result sim_fast_forward(Module& top, uint64_t cycles, Step&& step,
+                                                bool check = false, uint64_t min_skip = 2) {
+  sim_fast_forward_result r;
+
+  while (r.cycles < cycles) {
+    uint64_t left = cycles - r.cycles;
+    uint64_t idle = top.sim_idle_cycles();
+    if (idle > left) idle = left;
+
+    if (idle < min_skip) {
+      step(top);
+      r.cycles++;
+      r.stepped++;
+      continue;
+    }
+
+    if (check) {
+      sim_checkpoint before, stepped, skipped;
+      before.save(top);
+      for (uint64_t i = 0; i < idle; i++) step(top);
+      stepped.save(top);
+      before.restore(top);
+      top.sim_skip(idle);
+      skipped.save(top);
+      if (skipped.data != stepped.data) {
+        stepped.restore(top);
+        r.ok = false;
+        r.bad_cycle = r.cycles;
+        r.bad_length = idle;
+        r.cycles += idle;
+        r.stepped += idle;
+        return r;
+      }
+    } else {
+      top.sim_skip(idle);
+    }
+
+    r.cycles += idle;
+    r.skipped += idle;
+    r.skips++;
+  }
+
+  return r;
+}
+
+//------------------------------------------------------------------------------
@@ -2,10 +2,21 @@
 #include <memory.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#ifdef _MSC_VER
+#include <process.h>
+#endif
+
 #ifdef _MSC_VER
 #pragma warning(disable : 4996)   // unsafe fopen
 #pragma warning(disable : 26451)  // Very picky arithmetic overflow warning
@@ -14,8 +25,8 @@
 //------------------------------------------------------------------------------
 // This file contains classes to support Verilog-style bit manipulation in C++.
 //
-// There are two fundamental types - "logic" for storing blocks of up to 64
-// bits, and "bitslice" for manipulating the bits inside logics and primitive
+// There are two fundamental types - "logic" for storing blocks of bits of any
+// width, and "bitslice" for manipulating the bits inside logics and primitive
 // types in a similar fashion as Verilog's "a[7:2] = 6'b010101" syntax.
 //
 // Logics can also be type-safely concatenated and replicated - "cat(a,b)" is
@@ -107,13 +118,134 @@ DECLARE_SIZE(int64_t, 62);
 DECLARE_SIZE(int64_t, 63);
 DECLARE_SIZE(int64_t, 64);
 
+// Logics up to 128 bits wide use __int128 where the compiler has it, anything
+// wider is stored as an array of 64-bit limbs (see "Wide logics" below).
+
+#ifdef __SIZEOF_INT128__
+
+typedef __int128 int128_t;
+typedef unsigned __int128 uint128_t;
+
+#define DECLARE_SIZE_8(N)                                             \
+  DECLARE_SIZE(int128_t, N + 0); DECLARE_SIZE(int128_t, N + 1);       \
+  DECLARE_SIZE(int128_t, N + 2); DECLARE_SIZE(int128_t, N + 3);       \
+  DECLARE_SIZE(int128_t, N + 4); DECLARE_SIZE(int128_t, N + 5);       \
+  DECLARE_SIZE(int128_t, N + 6); DECLARE_SIZE(int128_t, N + 7);
+
+DECLARE_SIZE_8(65);
+DECLARE_SIZE_8(73);
+DECLARE_SIZE_8(81);
+DECLARE_SIZE_8(89);
+DECLARE_SIZE_8(97);
+DECLARE_SIZE_8(105);
+DECLARE_SIZE_8(113);
+DECLARE_SIZE_8(121);
+
+static const int logic_max_narrow = 128;
+
+#else
+
+static const int logic_max_narrow = 64;
+
+#endif
+
+//------------------------------------------------------------------------------
+// Bit manipulation primitives behind bx/bN, slice assignment and reduce_xor.
+// When the compiler targets BMI2 or POPCNT (-mbmi2, -march=native, etc) they
+// compile to single instructions, otherwise to the portable versions. Define
+// METRON_NO_INTRINSICS to force the portable versions. The *_scalar versions
+// are always available so tests can check that both agree.
+
+#if !defined(METRON_NO_INTRINSICS) && (defined(__BMI2__) || defined(__POPCNT__))
+#include <immintrin.h>
+#endif
+
+inline uint64_t bits_mask(int width) {
+  return width >= 64 ? ~0ull : (1ull << width) - 1;
+}
+
+// Read 'width' bits of 'x' starting at bit 'offset'.
+inline uint64_t bits_extract_scalar(uint64_t x, int offset, int width) {
+  return offset >= 64 ? 0 : (x >> offset) & bits_mask(width);
+}
+
+// Replace 'width' bits of 'x' starting at bit 'offset' with the low bits of 'y'.
+inline uint64_t bits_deposit_scalar(uint64_t x, uint64_t y, int offset,
+                                    int width) {
+  uint64_t m = bits_mask(width) << offset;
+  return (x & ~m) | ((y << offset) & m);
+}
+
+inline uint64_t bits_parity_scalar(uint64_t t) {
+  t ^= t >> 32;
+  t ^= t >> 16;
+  t ^= t >> 8;
+  t ^= t >> 4;
+  t ^= t >> 2;
+  t ^= t >> 1;
+  return t & 1;
+}
+
+#if !defined(METRON_NO_INTRINSICS) && defined(__BMI2__)
+
+inline uint64_t bits_extract(uint64_t x, int offset, int width) {
+  return offset >= 64 ? 0 : _bzhi_u64(x >> offset, width);
+}
+
+inline uint64_t bits_deposit(uint64_t x, uint64_t y, int offset, int width) {
+  uint64_t m = bits_mask(width) << offset;
+  return (x & ~m) | _pdep_u64(y, m);
+}
+
+#else
+
+inline uint64_t bits_extract(uint64_t x, int offset, int width) {
+  return bits_extract_scalar(x, offset, width);
+}
+
+inline uint64_t bits_deposit(uint64_t x, uint64_t y, int offset, int width) {
+  return bits_deposit_scalar(x, y, offset, width);
+}
+
+#endif
+
+#if !defined(METRON_NO_INTRINSICS) && defined(__POPCNT__)
+
+inline uint64_t bits_parity(uint64_t t) { return _mm_popcnt_u64(t) & 1; }
+
+#else
+
+inline uint64_t bits_parity(uint64_t t) { return bits_parity_scalar(t); }
+
+#endif
+
+// Index of the lowest set bit, 'x' must be non-zero.
+inline int bits_ctz(uint64_t x) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(x);
+#else
+  int i = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    i++;
+  }
+  return i;
+#endif
+}
+
+// Sign-extend the low 'width' bits of 'x' to 64 bits with an arithmetic shift.
+inline uint64_t bits_sign_extend(uint64_t x, int width) {
+  return uint64_t(int64_t(x << (64 - width)) >> (64 - width));
+}
+
 template <typename T>
 struct always_false {
   enum { value = false };
 };
 //------------------------------------------------------------------------------
-// A logic behaves like an unsigned integer with any number of bits, up to the
-// largest primitive type in bitsize_to_basetype above.
+// A logic behaves like an unsigned integer with any number of bits. Logics up
+// to the largest primitive type in bitsize_to_basetype above are stored in
+// that type, wider ones are specialized below.
 
 template <int WIDTH = 1>
 class logic {
@@ -128,7 +260,7 @@ class logic {
   typedef typename bitsize_to_basetype<WIDTH>::signed_type SBASE;
 
   BASE x = 0;
-  static const BASE mask = BASE(~0ull) >> ((sizeof(BASE) * 8) - WIDTH);
+  static const BASE mask = BASE(~BASE(0)) >> ((sizeof(BASE) * 8) - WIDTH);
 
   //----------
   // Logics can be constructed and assigned from their base type or other logics
@@ -142,6 +274,16 @@ class logic {
   logic& operator=(const logic& y) = default;
   void operator=(BASE y) { set(y); }
 
+  // Wraps a value the caller already knows fits in WIDTH bits, without masking
+  // it again. The helpers below use this wherever the result width follows
+  // from the operand widths, so a chain of them only masks where bits can
+  // actually be lost.
+  static logic raw(BASE y) {
+    logic r;
+    r.x = y;
+    return r;
+  }
+
   //----------
   // Logics have a getter, setter, and 'coercer' for convenience.
 
@@ -167,10 +309,29 @@ class logic {
 
   template <int M>
   logic& operator=(const logic<M>& y) {
-    set(y.x);
+    if constexpr (M > logic_max_narrow) {
+      BASE t = BASE(y.limb(0));
+      if constexpr (sizeof(BASE) > 8) t |= BASE(y.limb(1)) << 64;
+      set(t);
+    } else if constexpr (M <= WIDTH) {
+      x = BASE(y.x);
+    } else {
+      set(BASE(y.x));
+    }
     return *this;
   }
 
+  // Same interface as wide logics, so generic code can pull 64-bit chunks out
+  // of any logic.
+
+  uint64_t limb(int i) const {
+    if (i == 0) return uint64_t(x);
+    if constexpr (sizeof(BASE) > 8) {
+      if (i == 1) return uint64_t(x >> 64);
+    }
+    return 0;
+  }
+
   //----------
   // Disallow using "<=" with logic<>s, as it means "non-blocking assign" in
   // Verilog and "less than or equal" in C - a typo while porting could cause
@@ -207,9 +368,298 @@ class logic {
   //----------
   // Logics can be indexed like a bit array.
 
-  logic<1> operator[](int i) const { return (x >> i) & 1; }
+  logic<1> operator[](int i) const { return logic<1>::raw((x >> i) & 1); }
 };
 
+//------------------------------------------------------------------------------
+// Wide logics are stored as little-endian 64-bit limbs with the unused bits of
+// the top limb kept clear. The limb loops have fixed trip counts so the
+// compiler can unroll and vectorize them.
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+class logic<WIDTH> {
+ public:
+  static const int width = WIDTH;
+  static const int limbs = (WIDTH + 63) / 64;
+  static const uint64_t top_mask = ~0ull >> (limbs * 64 - WIDTH);
+
+  uint64_t x[limbs] = {};
+
+  //----------
+
+  logic() = default;
+  logic(const logic& y) = default;
+  logic(uint64_t y) { x[0] = y; }
+
+  // Wide logics can be built from logics of other sizes, so that widening a
+  // 128-bit value doesn't go through uint64_t. Truncates or zero-extends the
+  // source, same as assignment.
+  template <int M>
+  logic(const logic<M>& y) {
+    *this = y;
+  }
+
+  logic& operator=(const logic& y) = default;
+  void operator=(uint64_t y) { *this = logic(y); }
+
+  // Truncates or zero-extends the source, same as for narrow logics.
+  template <int M>
+  logic& operator=(const logic<M>& y) {
+    for (int i = 0; i < limbs; i++) x[i] = y.limb(i);
+    x[limbs - 1] &= top_mask;
+    return *this;
+  }
+
+  //----------
+
+  uint64_t limb(int i) const { return (i >= 0 && i < limbs) ? x[i] : 0; }
+
+  void fix() { x[limbs - 1] &= top_mask; }
+
+  logic<1> operator[](int i) const { return (x[i >> 6] >> (i & 63)) & 1; }
+
+  explicit operator bool() const {
+    uint64_t t = 0;
+    for (int i = 0; i < limbs; i++) t |= x[i];
+    return t != 0;
+  }
+
+  const logic& as_unsigned() const { return *this; }
+};
+
+//----------------------------------------
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline logic<WIDTH> operator~(const logic<WIDTH>& a) {
+  logic<WIDTH> r;
+  for (int i = 0; i < r.limbs; i++) r.x[i] = ~a.x[i];
+  r.fix();
+  return r;
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline logic<WIDTH> operator&(const logic<WIDTH>& a, const logic<WIDTH>& b) {
+  logic<WIDTH> r;
+  for (int i = 0; i < r.limbs; i++) r.x[i] = a.x[i] & b.x[i];
+  return r;
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline logic<WIDTH> operator|(const logic<WIDTH>& a, const logic<WIDTH>& b) {
+  logic<WIDTH> r;
+  for (int i = 0; i < r.limbs; i++) r.x[i] = a.x[i] | b.x[i];
+  return r;
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline logic<WIDTH> operator^(const logic<WIDTH>& a, const logic<WIDTH>& b) {
+  logic<WIDTH> r;
+  for (int i = 0; i < r.limbs; i++) r.x[i] = a.x[i] ^ b.x[i];
+  return r;
+}
+
+//----------------------------------------
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline logic<WIDTH> operator+(const logic<WIDTH>& a, const logic<WIDTH>& b) {
+  logic<WIDTH> r;
+  uint64_t carry = 0;
+  for (int i = 0; i < r.limbs; i++) {
+    uint64_t s = a.x[i] + b.x[i];
+    uint64_t c = s < a.x[i];
+    r.x[i] = s + carry;
+    carry = c | (r.x[i] < s);
+  }
+  r.fix();
+  return r;
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline logic<WIDTH> operator-(const logic<WIDTH>& a, const logic<WIDTH>& b) {
+  logic<WIDTH> r;
+  uint64_t borrow = 0;
+  for (int i = 0; i < r.limbs; i++) {
+    uint64_t d = a.x[i] - b.x[i];
+    uint64_t c = a.x[i] < b.x[i];
+    r.x[i] = d - borrow;
+    borrow = c | (d < borrow);
+  }
+  r.fix();
+  return r;
+}
+
+// Multiplication keeps the low WIDTH bits of the product, like Verilog.
+
+inline uint64_t mul_64x64(uint64_t a, uint64_t b, uint64_t& hi) {
+#ifdef __SIZEOF_INT128__
+  uint128_t p = uint128_t(a) * b;
+  hi = uint64_t(p >> 64);
+  return uint64_t(p);
+#else
+  uint64_t a0 = a & 0xFFFFFFFF, a1 = a >> 32;
+  uint64_t b0 = b & 0xFFFFFFFF, b1 = b >> 32;
+  uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+  uint64_t mid = (p00 >> 32) + (p01 & 0xFFFFFFFF) + (p10 & 0xFFFFFFFF);
+  hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+  return (mid << 32) | (p00 & 0xFFFFFFFF);
+#endif
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline logic<WIDTH> operator*(const logic<WIDTH>& a, const logic<WIDTH>& b) {
+  logic<WIDTH> r;
+  for (int i = 0; i < r.limbs; i++) {
+    uint64_t carry = 0;
+    for (int j = 0; i + j < r.limbs; j++) {
+      uint64_t hi;
+      uint64_t lo = mul_64x64(a.x[i], b.x[j], hi);
+      uint64_t t = r.x[i + j] + lo;
+      hi += t < lo;
+      r.x[i + j] = t + carry;
+      hi += r.x[i + j] < t;
+      carry = hi;
+    }
+  }
+  r.fix();
+  return r;
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline logic<WIDTH> operator*(const logic<WIDTH>& a, uint64_t b) {
+  return a * logic<WIDTH>(b);
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline logic<WIDTH> operator+(const logic<WIDTH>& a, uint64_t b) {
+  return a + logic<WIDTH>(b);
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline logic<WIDTH> operator-(const logic<WIDTH>& a, uint64_t b) {
+  return a - logic<WIDTH>(b);
+}
+
+//----------------------------------------
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline logic<WIDTH> operator<<(const logic<WIDTH>& a, int s) {
+  logic<WIDTH> r;
+  if (s >= WIDTH) return r;
+  int ls = s >> 6;
+  int bs = s & 63;
+  for (int i = r.limbs - 1; i >= ls; i--) {
+    uint64_t lo = (i - ls - 1 >= 0) ? a.x[i - ls - 1] : 0;
+    r.x[i] = bs ? (a.x[i - ls] << bs) | (lo >> (64 - bs)) : a.x[i - ls];
+  }
+  r.fix();
+  return r;
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline logic<WIDTH> operator>>(const logic<WIDTH>& a, int s) {
+  logic<WIDTH> r;
+  if (s >= WIDTH) return r;
+  int ls = s >> 6;
+  int bs = s & 63;
+  for (int i = 0; i < r.limbs - ls; i++) {
+    uint64_t hi = a.limb(i + ls + 1);
+    r.x[i] = bs ? (a.x[i + ls] >> bs) | (hi << (64 - bs)) : a.x[i + ls];
+  }
+  return r;
+}
+
+//----------------------------------------
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline bool operator==(const logic<WIDTH>& a, const logic<WIDTH>& b) {
+  uint64_t t = 0;
+  for (int i = 0; i < a.limbs; i++) t |= a.x[i] ^ b.x[i];
+  return t == 0;
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline bool operator!=(const logic<WIDTH>& a, const logic<WIDTH>& b) {
+  return !(a == b);
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline bool operator<(const logic<WIDTH>& a, const logic<WIDTH>& b) {
+  for (int i = a.limbs - 1; i >= 0; i--) {
+    if (a.x[i] != b.x[i]) return a.x[i] < b.x[i];
+  }
+  return false;
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline bool operator>(const logic<WIDTH>& a, const logic<WIDTH>& b) {
+  return b < a;
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline bool operator<=(const logic<WIDTH>& a, const logic<WIDTH>& b) {
+  return !(b < a);
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline bool operator>=(const logic<WIDTH>& a, const logic<WIDTH>& b) {
+  return !(a < b);
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline bool operator==(const logic<WIDTH>& a, uint64_t b) {
+  return a == logic<WIDTH>(b);
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline bool operator!=(const logic<WIDTH>& a, uint64_t b) {
+  return !(a == logic<WIDTH>(b));
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline bool operator<(const logic<WIDTH>& a, uint64_t b) {
+  return a < logic<WIDTH>(b);
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline bool operator>(const logic<WIDTH>& a, uint64_t b) {
+  return logic<WIDTH>(b) < a;
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline bool operator<=(const logic<WIDTH>& a, uint64_t b) {
+  return !(logic<WIDTH>(b) < a);
+}
+
+template <int WIDTH>
+  requires(WIDTH > logic_max_narrow)
+inline bool operator>=(const logic<WIDTH>& a, uint64_t b) {
+  return !(a < logic<WIDTH>(b));
+}
+
 //------------------------------------------------------------------------------
 // Helper struct to emulate Verilog's "foo[7:2] = bar;" slice assignment syntax.
 
@@ -229,8 +679,12 @@ struct bitslice {
     int lo = LO;
     if (hi > WIDTH - 1) hi = WIDTH - 1;
 
-    const DST mask = DST(-1ll) >> ((sizeof(DST) * 8) - (hi - lo + 1));
-    self = DST((self & ~(mask << LO)) | ((x & mask) << LO));
+    if constexpr (sizeof(DST) <= 8) {
+      self = DST(bits_deposit(self, x, LO, hi - lo + 1));
+    } else {
+      const DST mask = DST(-1ll) >> ((sizeof(DST) * 8) - (hi - lo + 1));
+      self = DST((self & ~(mask << LO)) | ((x & mask) << LO));
+    }
   }
 };
 
@@ -250,15 +704,15 @@ inline logic<WIDTH> operator~(const logic<WIDTH>& x) {
 }
 template <int WIDTH>
 inline logic<WIDTH> operator&(const logic<WIDTH>& a, const logic<WIDTH>& b) {
-  return typename logic<WIDTH>::BASE(a) & typename logic<WIDTH>::BASE(b);
+  return logic<WIDTH>::raw(a.get() & b.get());
 }
 template <int WIDTH>
 inline logic<WIDTH> operator|(const logic<WIDTH>& a, const logic<WIDTH>& b) {
-  return typename logic<WIDTH>::BASE(a) | typename logic<WIDTH>::BASE(b);
+  return logic<WIDTH>::raw(a.get() | b.get());
 }
 template <int WIDTH>
 inline logic<WIDTH> operator^(const logic<WIDTH>& a, const logic<WIDTH>& b) {
-  return typename logic<WIDTH>::BASE(a) ^ typename logic<WIDTH>::BASE(b);
+  return logic<WIDTH>::raw(a.get() ^ b.get());
 }
 
 //------------------------------------------------------------------------------
@@ -278,7 +732,33 @@ inline const logic<WIDTH> bx(const SRC& a, int offset = 0) {
 }
 template <int WIDTH, int SRC_WIDTH>
 inline const logic<WIDTH> bx(const logic<SRC_WIDTH>& a, int offset = 0) {
-  return logic<WIDTH>::coerce(a.get() >> offset);
+  if constexpr (WIDTH <= 64 && SRC_WIDTH <= 64) {
+    return logic<WIDTH>::raw(bits_extract(a.get(), offset, WIDTH));
+  } else if constexpr (WIDTH <= logic_max_narrow &&
+                       SRC_WIDTH <= logic_max_narrow) {
+    return logic<WIDTH>::coerce(a.get() >> offset);
+  } else {
+    // Gather 64-bit chunks of the source starting at 'offset'.
+    int ls = offset >> 6;
+    int bs = offset & 63;
+    auto chunk = [&](int i) {
+      uint64_t lo = a.limb(ls + i);
+      uint64_t hi = a.limb(ls + i + 1);
+      return bs ? (lo >> bs) | (hi << (64 - bs)) : lo;
+    };
+
+    logic<WIDTH> r;
+    if constexpr (WIDTH > logic_max_narrow) {
+      for (int i = 0; i < r.limbs; i++) r.x[i] = chunk(i);
+      r.fix();
+    } else {
+      typedef typename logic<WIDTH>::BASE BASE;
+      BASE t = BASE(chunk(0));
+      if constexpr (sizeof(BASE) > 8) t |= BASE(chunk(1)) << 64;
+      r.set(t);
+    }
+    return r;
+  }
 }
 
 #if 0
@@ -306,6 +786,9 @@ inline const logic<WIDTH> bx(const logic<SRC_WIDTH>& a, int offset = 0) {
 
 #endif
 
+template <int WIDTH, int LANES>
+class logic_lanes;
+
 #define DECLARE_BN_SN_HELPERS(WIDTH)                                 \
   template <typename SRC>                                            \
   inline const logic<WIDTH> b##WIDTH(const SRC& a, int offset = 0) { \
@@ -314,7 +797,12 @@ inline const logic<WIDTH> bx(const logic<SRC_WIDTH>& a, int offset = 0) {
   template <int SRC_WIDTH>                                           \
   inline const logic<WIDTH> b##WIDTH(const logic<SRC_WIDTH>& a,      \
                                      int offset = 0) {               \
-    return logic<WIDTH>::coerce(a >> offset);                        \
+    return bx<WIDTH>(a, offset);                                     \
+  }                                                                  \
+  template <int SRC_WIDTH, int LANES>                                \
+  inline logic_lanes<WIDTH, LANES> b##WIDTH(                         \
+      const logic_lanes<SRC_WIDTH, LANES>& a, int offset = 0) {      \
+    return bx<WIDTH>(a, offset);                                     \
   }
 
 DECLARE_BN_SN_HELPERS(1);
@@ -391,24 +879,27 @@ DECLARE_BN_SN_HELPERS(64);
 
 template <int WIDTH>
 inline logic<1> reduce_xor(const logic<WIDTH>& x) {
-  uint64_t t = x.get();
-  t ^= t >> 32;
-  t ^= t >> 16;
-  t ^= t >> 8;
-  t ^= t >> 4;
-  t ^= t >> 2;
-  t ^= t >> 1;
-  return t & 1;
+  uint64_t t = 0;
+  for (int i = 0; i < (WIDTH + 63) / 64; i++) t ^= x.limb(i);
+  return logic<1>::raw(bits_parity(t));
 }
 
 template <int WIDTH>
 inline logic<1> reduce_or(const logic<WIDTH>& x) {
-  return x.get() != 0;
+  if constexpr (WIDTH > logic_max_narrow) {
+    return bool(x);
+  } else {
+    return logic<1>::raw(x.get() != 0);
+  }
 }
 
 template <int WIDTH>
 inline logic<1> reduce_and(const logic<WIDTH>& x) {
-  return x.get() == logic<WIDTH>::mask;
+  if constexpr (WIDTH > logic_max_narrow) {
+    return x == ~logic<WIDTH>(0);
+  } else {
+    return logic<1>::raw(x.get() == logic<WIDTH>::mask);
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -423,8 +914,15 @@ inline logic<1> reduce_and(const logic<WIDTH>& x) {
 template <int WIDTH1, int WIDTH2>
 inline logic<WIDTH1 + WIDTH2> cat(const logic<WIDTH1>& a,
                                   const logic<WIDTH2>& b) {
-  return (typename logic<WIDTH1 + WIDTH2>::BASE(a.get()) << WIDTH2) |
-         typename logic<WIDTH1 + WIDTH2>::BASE(b.get());
+  if constexpr (WIDTH1 + WIDTH2 > logic_max_narrow) {
+    logic<WIDTH1 + WIDTH2> ra, rb;
+    ra = a;
+    rb = b;
+    return (ra << WIDTH2) | rb;
+  } else {
+    typedef typename logic<WIDTH1 + WIDTH2>::BASE BASE;
+    return logic<WIDTH1 + WIDTH2>::raw((BASE(a.get()) << WIDTH2) | BASE(b.get()));
+  }
 }
 
 template <int WIDTH, typename... Args>
@@ -451,8 +949,18 @@ constexpr uint64_t dup_pattern(int width, int dups) {
 
 template <int DUPS, int WIDTH>
 inline logic<WIDTH * DUPS> dup(const logic<WIDTH>& a) {
-  const uint64_t p = dup_pattern(WIDTH, DUPS);
-  return p * a;
+  if constexpr (WIDTH * DUPS > 64) {
+    logic<WIDTH * DUPS> r, t;
+    t = a;
+    for (int i = 0; i < DUPS; i++) r = (r << WIDTH) | t;
+    return r;
+  } else if constexpr (WIDTH == 1) {
+    // Replicating one bit is just a broadcast.
+    return logic<DUPS>::coerce(0 - uint64_t(a.get()));
+  } else {
+    const uint64_t p = dup_pattern(WIDTH, DUPS);
+    return logic<WIDTH * DUPS>::raw(p * a.get());
+  }
 }
 
 //-----------------------------------------------------------------------------
@@ -460,90 +968,625 @@ inline logic<WIDTH * DUPS> dup(const logic<WIDTH>& a) {
 template <int DST_WIDTH, int SRC_WIDTH>
 inline logic<DST_WIDTH> sign_extend(const logic<SRC_WIDTH> a) {
   static_assert(DST_WIDTH >= SRC_WIDTH);
-  return cat(dup<DST_WIDTH - SRC_WIDTH + 1>(a[SRC_WIDTH - 1]),
-             bx<SRC_WIDTH - 1>(a));
+  if constexpr (DST_WIDTH <= 64) {
+    return logic<DST_WIDTH>::coerce(bits_sign_extend(a.get(), SRC_WIDTH));
+  } else {
+    return cat(dup<DST_WIDTH - SRC_WIDTH + 1>(a[SRC_WIDTH - 1]),
+               bx<SRC_WIDTH - 1>(a));
+  }
 }
 
 //------------------------------------------------------------------------------
-// "Magic" constant that gets translated to 'x' in Verilog
+// Narrow registers can opt in to being packed together by declaring them as
+// bitfields of type packed_logic. Adjacent ones share 64-bit words, so a
+// module full of flags and small counters takes a few words instead of a byte
+// or more per register, and copying or clearing them is word-at-a-time.
+//
+//   packed_logic s1_running : 1;
+//   packed_logic s1_duty : 2;
+//   packed_logic s1_env_vol : 4;
+//
+// The translator emits them as plain "logic[N-1:0]" fields. In C++ they
+// truncate on assignment and decay to integers like logic<N> does, but
+// templates can't see their width - wrap them in bN() to pass them to cat(),
+// dup() or anything else that takes a logic<N>.
 
-static const uint64_t DONTCARE = 0;
+typedef uint64_t packed_logic;
 
 //------------------------------------------------------------------------------
+// Lane-batched logics hold LANES independent values of the same width, so one
+// model instance built on them can simulate many design instances at once.
+// Every operator works lane-by-lane over a fixed-size array, which the
+// compiler turns into SIMD ops.
+//
+// Arithmetic, compound assignment, assignment between widths and the bN()/bx()
+// casts work as they do for logic<N>. Comparisons produce a
+// logic_lanes<1, LANES> mask instead of a bool. C++ control flow can't diverge
+// per lane, so branches on lane values need to be written as
+// lanes_select(mask, a, b).
+//
+// logic_lanes<8, 16> a = 10;
+// logic_lanes<8, 16> b = ...;
+// a = lanes_select(a < b, a + 1, a);
 
-constexpr int clog2(uint64_t x) {
-  if (x == 0) return 0;
-  x--;
-  for (int i = 63; i >= 0; i--)
-    if (x & (uint64_t(1) << i)) return i + 1;
-  return 1;
-}
+template <int WIDTH, int LANES>
+class logic_lanes {
+ public:
+  static_assert(WIDTH <= 64, "logic_lanes only supports narrow logics");
 
-static_assert(clog2(0) == 0);
-static_assert(clog2(1) == 1);
-static_assert(clog2(2) == 1);
-static_assert(clog2(3) == 2);
-static_assert(clog2(255) == 8);
-static_assert(clog2(256) == 8);
-static_assert(clog2(257) == 9);
+  static const int width = WIDTH;
+  static const int lanes = LANES;
+  typedef typename logic<WIDTH>::BASE BASE;
+  static const BASE mask = logic<WIDTH>::mask;
 
-constexpr uint64_t pow2(int x) { return (1ull << x); }
+  BASE x[LANES] = {};
 
-void parse_hex(const char* src_filename, void* dst_data, int dst_size);
+  //----------
+  // Constructing from a scalar broadcasts it to every lane.
 
-//------------------------------------------------------------------------------
-// 'end' is INCLUSIVE
+  logic_lanes() = default;
+  logic_lanes(const logic_lanes& y) = default;
+  logic_lanes(uint64_t y) {
+    for (int i = 0; i < LANES; i++) x[i] = BASE(y) & mask;
+  }
 
-inline void readmemh(const char* path, void* mem, int begin, int end) {
-  memset(mem, 0, end - begin + 1ull);
-  parse_hex(path, (uint8_t*)mem + begin, end - begin + 1);
-}
+  logic_lanes& operator=(const logic_lanes& y) = default;
 
-inline void readmemh(const std::string& path, void* mem, int begin, int end) {
-  memset(mem, 0, end - begin + 1);
-  parse_hex(path.c_str(), (uint8_t*)mem + begin, end - begin + 1);
-}
+  template <int M>
+  logic_lanes& operator=(const logic_lanes<M, LANES>& y) {
+    for (int i = 0; i < LANES; i++) x[i] = BASE(y.x[i]) & mask;
+    return *this;
+  }
 
-inline void readmemh(const char* path, void* mem) {
-  parse_hex(path, (uint8_t*)mem, 0xFFFFFFFF);
-}
+  // Compound assignments go through the binary operators below.
+  template <typename T> logic_lanes& operator+=(const T& y) { return *this = *this + y; }
+  template <typename T> logic_lanes& operator-=(const T& y) { return *this = *this - y; }
+  template <typename T> logic_lanes& operator*=(const T& y) { return *this = *this * y; }
+  template <typename T> logic_lanes& operator&=(const T& y) { return *this = *this & y; }
+  template <typename T> logic_lanes& operator|=(const T& y) { return *this = *this | y; }
+  template <typename T> logic_lanes& operator^=(const T& y) { return *this = *this ^ y; }
+  logic_lanes& operator<<=(int s) { return *this = *this << s; }
+  logic_lanes& operator>>=(int s) { return *this = *this >> s; }
 
-inline void readmemh(const std::string& path, void* mem) {
-  parse_hex(path.c_str(), (uint8_t*)mem, 0xFFFFFFFF);
-}
+  //----------
 
-//----------------------------------------
+  logic<WIDTH> lane(int i) const { return x[i]; }
+  void set_lane(int i, logic<WIDTH> y) { x[i] = y.get(); }
 
-inline int display(const char* fmt, ...) {
-  char buffer[256];
-  va_list args;
-  va_start(args, fmt);
-  int len = vsnprintf(buffer, 256, fmt, args);
-  va_end(args);
-  fwrite(buffer, 1, len, stdout);
-  // TinyLog::get().printf(0x88CCFF, "MT> ");
-  // TinyLog::get().print_buffer(0x88CCFF, buffer, len);
-  // TinyLog::get().printf(0x88CCFF, "\n");
-  return len;
-}
-
-inline int write(const char* fmt, ...) {
-  char buffer[256];
-  va_list args;
-  va_start(args, fmt);
-  int len = vsnprintf(buffer, 256, fmt, args);
-  va_end(args);
-  fwrite(buffer, 1, len, stdout);
-  // TinyLog::get().printf(0x88CCFF, "MT> ");
-  // TinyLog::get().print_buffer(0x88CCFF, buffer, len);
-  return len;
-}
+  logic_lanes<1, LANES> operator[](int b) const {
+    logic_lanes<1, LANES> r;
+    for (int i = 0; i < LANES; i++) r.x[i] = (x[i] >> b) & 1;
+    return r;
+  }
+};
 
 //----------------------------------------
-// Verilog's signed right shift doesn't work quite the same as C++'s, so we
-// patch around it here.
+// Binary ops work between two lane sets or between a lane set and a scalar.
+
+#define DECLARE_LANE_OP(OP)                                                  \
+  template <int WIDTH, int LANES>                                            \
+  inline logic_lanes<WIDTH, LANES> operator OP(                              \
+      const logic_lanes<WIDTH, LANES>& a, const logic_lanes<WIDTH, LANES>& b) { \
+    logic_lanes<WIDTH, LANES> r;                                             \
+    for (int i = 0; i < LANES; i++) r.x[i] = (a.x[i] OP b.x[i]) & r.mask;    \
+    return r;                                                                \
+  }                                                                          \
+  template <int WIDTH, int LANES>                                            \
+  inline logic_lanes<WIDTH, LANES> operator OP(                              \
+      const logic_lanes<WIDTH, LANES>& a, uint64_t b) {                      \
+    return a OP logic_lanes<WIDTH, LANES>(b);                                \
+  }                                                                          \
+  template <int WIDTH, int LANES>                                            \
+  inline logic_lanes<WIDTH, LANES> operator OP(                              \
+      uint64_t a, const logic_lanes<WIDTH, LANES>& b) {                      \
+    return logic_lanes<WIDTH, LANES>(a) OP b;                                \
+  }
 
-template <int WIDTH>
+#define DECLARE_LANE_CMP(OP)                                                 \
+  template <int WIDTH, int LANES>                                            \
+  inline logic_lanes<1, LANES> operator OP(                                  \
+      const logic_lanes<WIDTH, LANES>& a, const logic_lanes<WIDTH, LANES>& b) { \
+    logic_lanes<1, LANES> r;                                                 \
+    for (int i = 0; i < LANES; i++) r.x[i] = a.x[i] OP b.x[i];               \
+    return r;                                                                \
+  }                                                                          \
+  template <int WIDTH, int LANES>                                            \
+  inline logic_lanes<1, LANES> operator OP(                                  \
+      const logic_lanes<WIDTH, LANES>& a, uint64_t b) {                      \
+    return a OP logic_lanes<WIDTH, LANES>(b);                                \
+  }
+
+DECLARE_LANE_OP(&);
+DECLARE_LANE_OP(|);
+DECLARE_LANE_OP(^);
+DECLARE_LANE_OP(+);
+DECLARE_LANE_OP(-);
+DECLARE_LANE_OP(*);
+
+DECLARE_LANE_CMP(==);
+DECLARE_LANE_CMP(!=);
+DECLARE_LANE_CMP(<);
+DECLARE_LANE_CMP(<=);
+DECLARE_LANE_CMP(>);
+DECLARE_LANE_CMP(>=);
+
+template <int WIDTH, int LANES>
+inline logic_lanes<WIDTH, LANES> operator~(const logic_lanes<WIDTH, LANES>& a) {
+  logic_lanes<WIDTH, LANES> r;
+  for (int i = 0; i < LANES; i++) r.x[i] = ~a.x[i] & r.mask;
+  return r;
+}
+
+// Shifting by the width or more clears every lane, same as for wide logics.
+
+template <int WIDTH, int LANES>
+inline logic_lanes<WIDTH, LANES> operator<<(const logic_lanes<WIDTH, LANES>& a,
+                                            int s) {
+  logic_lanes<WIDTH, LANES> r;
+  if (s >= WIDTH) return r;
+  for (int i = 0; i < LANES; i++) r.x[i] = (uint64_t(a.x[i]) << s) & r.mask;
+  return r;
+}
+
+template <int WIDTH, int LANES>
+inline logic_lanes<WIDTH, LANES> operator>>(const logic_lanes<WIDTH, LANES>& a,
+                                            int s) {
+  logic_lanes<WIDTH, LANES> r;
+  if (s >= WIDTH) return r;
+  for (int i = 0; i < LANES; i++) r.x[i] = a.x[i] >> s;
+  return r;
+}
+
+//----------------------------------------
+// Per-lane replacement for "mask ? a : b".
+
+template <int WIDTH, int LANES>
+inline logic_lanes<WIDTH, LANES> lanes_select(const logic_lanes<1, LANES>& m,
+                                              const logic_lanes<WIDTH, LANES>& a,
+                                              const logic_lanes<WIDTH, LANES>& b) {
+  logic_lanes<WIDTH, LANES> r;
+  for (int i = 0; i < LANES; i++) r.x[i] = m.x[i] ? a.x[i] : b.x[i];
+  return r;
+}
+
+template <int LANES>
+inline bool lanes_any(const logic_lanes<1, LANES>& m) {
+  uint8_t t = 0;
+  for (int i = 0; i < LANES; i++) t |= m.x[i];
+  return t != 0;
+}
+
+template <int LANES>
+inline bool lanes_all(const logic_lanes<1, LANES>& m) {
+  uint8_t t = 1;
+  for (int i = 0; i < LANES; i++) t &= m.x[i];
+  return t != 0;
+}
+
+//----------------------------------------
+// Lane versions of the slicing, concatenation and reduction helpers.
+
+template <int WIDTH, int SRC_WIDTH, int LANES>
+inline logic_lanes<WIDTH, LANES> bx(const logic_lanes<SRC_WIDTH, LANES>& a,
+                                    int offset = 0) {
+  logic_lanes<WIDTH, LANES> r;
+  if (offset >= SRC_WIDTH) return r;
+  for (int i = 0; i < LANES; i++) r.x[i] = (a.x[i] >> offset) & r.mask;
+  return r;
+}
+
+template <int WIDTH1, int WIDTH2, int LANES>
+inline logic_lanes<WIDTH1 + WIDTH2, LANES> cat(
+    const logic_lanes<WIDTH1, LANES>& a, const logic_lanes<WIDTH2, LANES>& b) {
+  typedef typename logic_lanes<WIDTH1 + WIDTH2, LANES>::BASE BASE;
+  logic_lanes<WIDTH1 + WIDTH2, LANES> r;
+  for (int i = 0; i < LANES; i++) r.x[i] = (BASE(a.x[i]) << WIDTH2) | b.x[i];
+  return r;
+}
+
+template <int WIDTH, int LANES>
+inline logic_lanes<1, LANES> reduce_or(const logic_lanes<WIDTH, LANES>& a) {
+  return a != 0;
+}
+
+template <int WIDTH, int LANES>
+inline logic_lanes<1, LANES> reduce_and(const logic_lanes<WIDTH, LANES>& a) {
+  return a == logic_lanes<WIDTH, LANES>::mask;
+}
+
+template <int WIDTH, int LANES>
+inline logic_lanes<1, LANES> reduce_xor(const logic_lanes<WIDTH, LANES>& a) {
+  logic_lanes<1, LANES> r;
+  for (int i = 0; i < LANES; i++) r.x[i] = reduce_xor(a.lane(i)).get();
+  return r;
+}
+
+//------------------------------------------------------------------------------
+// "Magic" constant that gets translated to 'x' in Verilog
+
+static const uint64_t DONTCARE = 0;
+
+//------------------------------------------------------------------------------
+
+constexpr int clog2(uint64_t x) {
+  if (x == 0) return 0;
+  x--;
+  for (int i = 63; i >= 0; i--)
+    if (x & (uint64_t(1) << i)) return i + 1;
+  return 1;
+}
+
+static_assert(clog2(0) == 0);
+static_assert(clog2(1) == 1);
+static_assert(clog2(2) == 1);
+static_assert(clog2(3) == 2);
+static_assert(clog2(255) == 8);
+static_assert(clog2(256) == 8);
+static_assert(clog2(257) == 9);
+
+constexpr uint64_t pow2(int x) { return (1ull << x); }
+
+void parse_hex(const char* src_filename, void* dst_data, int dst_size);
+void load_hex(const char* path, void* dst, uint64_t dst_size, bool zero_fill);
+
+//------------------------------------------------------------------------------
+// 'end' is INCLUSIVE
+
+inline void readmemh(const char* path, void* mem, int begin, int end) {
+  load_hex(path, (uint8_t*)mem + begin, end - begin + 1ull, true);
+}
+
+inline void readmemh(const std::string& path, void* mem, int begin, int end) {
+  load_hex(path.c_str(), (uint8_t*)mem + begin, end - begin + 1ull, true);
+}
+
+inline void readmemh(const char* path, void* mem) {
+  load_hex(path, mem, 0xFFFFFFFF, false);
+}
+
+inline void readmemh(const std::string& path, void* mem) {
+  load_hex(path.c_str(), mem, 0xFFFFFFFF, false);
+}
+
+//------------------------------------------------------------------------------
+// display() and write() go through a per-thread sim_log_channel. By default
+// the channel formats and writes each message immediately. In deferred mode
+// it only copies the format pointer and the arguments into a buffer, and the
+// formatting and I/O happen when the buffer is full, on flush() and when the
+// thread exits. Testbenches can hand full buffers to a background thread
+// instead with sim_log_start_thread() from metron_sim.h, which keeps threads
+// out of this file. Define METRON_DEFERRED_DISPLAY to make deferred mode the
+// default.
+//
+// Format strings must outlive the channel, which string literals always do.
+// String arguments are copied. Logic arguments are passed as their integer
+// value, logics wider than 64 bits print their bottom 64 bits.
+
+enum sim_log_level {
+  SIM_LOG_DEBUG = 0,
+  SIM_LOG_INFO = 1,  // display(), write() and display_info()
+  SIM_LOG_WARN = 2,  // display_warning()
+  SIM_LOG_ERROR = 3, // display_error()
+  SIM_LOG_NONE = 4,
+};
+
+//----------------------------------------
+// How each argument type is stored in the ring.
+
+template <typename T, typename = void>
+struct deferred_arg {
+  typedef T type;
+  static constexpr size_t slot = (sizeof(type) + 7) & ~size_t(7);
+  static type value(const T& x) { return x; }
+  static size_t size(const T&) { return slot; }
+  static void store(uint8_t* p, const T& x) {
+    type v = value(x);
+    memcpy(p, &v, sizeof(v));
+  }
+  static type load(const uint8_t*& p) {
+    type x;
+    memcpy(&x, p, sizeof(x));
+    p += slot;
+    return x;
+  }
+};
+
+// Arithmetic-like types get converted to 'U' when recorded.
+template <typename T, typename U>
+struct deferred_arg_as : public deferred_arg<U> {
+  static U value(const T& x) { return U(x); }
+  static size_t size(const T&) { return deferred_arg<U>::slot; }
+  static void store(uint8_t* p, const T& x) {
+    U v = value(x);
+    memcpy(p, &v, sizeof(v));
+  }
+};
+
+template <typename T>
+struct deferred_arg<T, std::enable_if_t<std::is_enum_v<T>>>
+    : public deferred_arg_as<T, std::underlying_type_t<T>> {};
+
+template <>
+struct deferred_arg<float> : public deferred_arg_as<float, double> {};
+
+template <int WIDTH>
+  requires(WIDTH <= 64)
+struct deferred_arg<logic<WIDTH>>
+    : public deferred_arg_as<logic<WIDTH>, typename logic<WIDTH>::BASE> {};
+
+template <int WIDTH>
+  requires(WIDTH > 64)
+struct deferred_arg<logic<WIDTH>> : public deferred_arg<uint64_t> {
+  static uint64_t value(const logic<WIDTH>& x) { return x.limb(0); }
+  static size_t size(const logic<WIDTH>&) { return 8; }
+  static void store(uint8_t* p, const logic<WIDTH>& x) {
+    uint64_t v = x.limb(0);
+    memcpy(p, &v, 8);
+  }
+};
+
+// Strings are copied, length first.
+template <>
+struct deferred_arg<const char*> {
+  typedef const char* type;
+  static type value(const char* s) { return s; }
+  static size_t size(const char* s) { return 8 + ((strlen(s) + 8) & ~size_t(7)); }
+  static void store(uint8_t* p, const char* s) {
+    uint64_t len = strlen(s);
+    memcpy(p, &len, 8);
+    memcpy(p + 8, s, len + 1);
+  }
+  static type load(const uint8_t*& p) {
+    uint64_t len;
+    memcpy(&len, p, 8);
+    const char* s = (const char*)p + 8;
+    p += 8 + ((len + 8) & ~uint64_t(7));
+    return s;
+  }
+};
+
+template <>
+struct deferred_arg<char*> : public deferred_arg<const char*> {};
+
+template <size_t N>
+struct deferred_arg<char[N]> : public deferred_arg<const char*> {};
+
+//----------------------------------------
+
+class sim_log_channel;
+
+// Takes full buffers of recorded messages off the channel's hands, see
+// sim_log_start_thread() in metron_sim.h.
+class sim_log_writer {
+ public:
+  virtual ~sim_log_writer() = default;
+
+  // Takes 'size' bytes of records in 'full', returns an empty buffer of the
+  // same capacity for the channel to carry on with.
+  virtual uint8_t* swap(uint8_t* full, size_t size) = 0;
+
+  // Waits until every buffer handed over so far has been written out.
+  virtual void wait() = 0;
+};
+
+class sim_log_channel {
+ public:
+  sim_log_channel(FILE* out = stdout, size_t capacity = 1 << 20)
+      : out(out), capacity(capacity), buffer((uint8_t*)malloc(capacity)) {
+#ifdef METRON_DEFERRED_DISPLAY
+    deferred = true;
+#endif
+  }
+
+  sim_log_channel(const sim_log_channel&) = delete;
+  sim_log_channel& operator=(const sim_log_channel&) = delete;
+
+  ~sim_log_channel() {
+    attach(nullptr);
+    drain();
+    fflush(out);
+    free(buffer);
+  }
+
+  //----------
+  // Messages below 'level' are dropped before anything is recorded.
+
+  void set_min_level(int level) { min_level = level; }
+  int get_min_level() const { return min_level; }
+
+  // Switching back to immediate mode flushes anything already recorded.
+  void set_deferred(bool d) {
+    if (!d) flush();
+    deferred = d;
+  }
+
+  bool is_deferred() const { return deferred; }
+
+  //----------
+  // Returns the formatted length in immediate mode, 0 if the message was
+  // recorded for later.
+
+  template <typename... Args>
+  int print(int level, const char* fmt, const Args&... args) {
+    if (level < min_level) return 0;
+    if (!deferred) return emit(fmt, deferred_arg<Args>::value(args)...);
+
+    size_t payload = (size_t(0) + ... + deferred_arg<Args>::size(args));
+    size_t need = (sizeof(entry) + payload + 7) & ~size_t(7);
+
+    // Too big for the buffer, keep ordering by flushing and printing it now.
+    if (need > capacity / 2) {
+      flush();
+      return emit(fmt, deferred_arg<Args>::value(args)...);
+    }
+
+    if (capacity - used < need) drain();
+
+    uint8_t* dst = buffer + used;
+    entry e = {uint32_t(need), fmt, &replay<Args...>};
+    memcpy(dst, &e, sizeof(e));
+    uint8_t* p = dst + sizeof(e);
+    ((deferred_arg<Args>::store(p, args), p += deferred_arg<Args>::size(args)), ...);
+    (void)p;
+    used += need;
+    return 0;
+  }
+
+  //----------
+  // Waits until everything recorded so far has been written out.
+
+  void flush() {
+    drain();
+    if (writer) writer->wait();
+    fflush(out);
+  }
+
+  // Hands full buffers to 'w' from now on instead of writing them out here.
+  // Anything already recorded is flushed first, and the old writer deleted.
+  // The channel owns 'w'. Null goes back to writing out here.
+  void attach(sim_log_writer* w) {
+    flush();
+    delete writer;
+    writer = w;
+  }
+
+  bool has_thread() const { return writer != nullptr; }
+  size_t get_capacity() const { return capacity; }
+
+  // Formats and writes out 'size' bytes of records. Writers call this on
+  // the buffers they're handed.
+  void replay_records(const uint8_t* records, size_t size) {
+    for (size_t pos = 0; pos < size;) {
+      entry e;
+      memcpy(&e, records + pos, sizeof(e));
+      e.replay(this, e.fmt, records + pos + sizeof(e));
+      pos += e.size;
+    }
+  }
+
+ private:
+  typedef void (*replay_fn)(sim_log_channel* chan, const char* fmt, const uint8_t* payload);
+
+  struct entry {
+    uint32_t size;  // Whole record, 8-byte aligned
+    const char* fmt;
+    replay_fn replay;
+  };
+
+  //----------
+
+  // Formats into a stack buffer, and only formats again into 'overflow' if the
+  // message doesn't fit.
+  template <typename... Args>
+  static int write_formatted(FILE* out, std::string& overflow, const char* fmt,
+                             Args... args) {
+    char buffer[256];
+    int len = snprintf(buffer, sizeof(buffer), fmt, args...);
+    if (len <= 0) return 0;
+    if (len < int(sizeof(buffer))) {
+      fwrite(buffer, 1, len, out);
+      return len;
+    }
+    overflow.resize(len + 1);
+    snprintf(overflow.data(), len + 1, fmt, args...);
+    fwrite(overflow.data(), 1, len, out);
+    return len;
+  }
+
+  template <typename... Args>
+  int emit(const char* fmt, Args... args) {
+    return write_formatted(out, text, fmt, args...);
+  }
+
+  // Loads the arguments one at a time, in order, then formats them.
+  template <typename... Args>
+  struct arg_list {};
+
+  template <typename... Loaded>
+  static void replay_args(arg_list<>, sim_log_channel* chan, const char* fmt,
+                          const uint8_t*, Loaded... loaded) {
+    write_formatted(chan->out, chan->text, fmt, loaded...);
+  }
+
+  template <typename First, typename... Rest, typename... Loaded>
+  static void replay_args(arg_list<First, Rest...>, sim_log_channel* chan,
+                          const char* fmt, const uint8_t* p, Loaded... loaded) {
+    auto arg = deferred_arg<First>::load(p);
+    replay_args(arg_list<Rest...>{}, chan, fmt, p, loaded..., arg);
+  }
+
+  template <typename... Args>
+  static void replay(sim_log_channel* chan, const char* fmt, const uint8_t* p) {
+    replay_args(arg_list<Args...>{}, chan, fmt, p);
+  }
+
+  // Writes out everything recorded so far, or hands it to the writer.
+  void drain() {
+    if (!used) return;
+    if (writer) {
+      buffer = writer->swap(buffer, used);
+    } else {
+      replay_records(buffer, used);
+    }
+    used = 0;
+  }
+
+  //----------
+
+  FILE* out;
+  size_t capacity;
+  uint8_t* buffer;
+  size_t used = 0;
+  std::string text;  // Messages too long for write_formatted()'s stack buffer
+
+  int min_level = SIM_LOG_DEBUG;
+  bool deferred = false;
+
+  sim_log_writer* writer = nullptr;
+};
+
+//----------------------------------------
+// Each simulation thread logs through its own channel, so recording a message
+// never needs a lock.
+
+inline sim_log_channel& sim_log() {
+  static thread_local sim_log_channel channel;
+  return channel;
+}
+
+template <typename... Args>
+inline int display(const char* fmt, const Args&... args) {
+  return sim_log().print(SIM_LOG_INFO, fmt, args...);
+}
+
+template <typename... Args>
+inline int write(const char* fmt, const Args&... args) {
+  return sim_log().print(SIM_LOG_INFO, fmt, args...);
+}
+
+// Severity versions, translated to $info, $warning and $error. Raising the
+// channel's minimum level drops the less severe ones.
+
+template <typename... Args>
+inline int display_info(const char* fmt, const Args&... args) {
+  return sim_log().print(SIM_LOG_INFO, fmt, args...);
+}
+
+template <typename... Args>
+inline int display_warning(const char* fmt, const Args&... args) {
+  return sim_log().print(SIM_LOG_WARN, fmt, args...);
+}
+
+template <typename... Args>
+inline int display_error(const char* fmt, const Args&... args) {
+  return sim_log().print(SIM_LOG_ERROR, fmt, args...);
+}
+
+//----------------------------------------
+// Verilog's signed right shift doesn't work quite the same as C++'s, so we
+// patch around it here.
+
+template <int WIDTH>
 inline logic<WIDTH> sra(logic<WIDTH> x, int s) {
   return x.as_signed() >> s;
 }
@@ -572,38 +1615,137 @@ inline int from_hex(uint8_t c) {
 }
 
 //------------------------------------------------------------------------------
+// Read-only copy of a whole file, read through stdio.
+
+struct file_contents {
+  file_contents() = default;
+  file_contents(const file_contents&) = delete;
+  file_contents& operator=(const file_contents&) = delete;
+
+  bool open(const char* path) {
+    close();
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len < 0) {
+      fclose(f);
+      return false;
+    }
+    buffer.resize(size_t(len));
+    size = fread(buffer.data(), 1, buffer.size(), f);
+    fclose(f);
+    data = buffer.data();
+    return size == buffer.size();
+  }
 
-inline void parse_hex(const char* src_filename, void* dst_data, int dst_size) {
-  FILE* f = fopen(src_filename, "rb");
-  fseek(f, 0, SEEK_END);
-  int src_size = ftell(f);
-  fseek(f, 0, SEEK_SET);
-
-  // Stick a chunk of nulls on the end so we don't have to worry about reading a
-  // byte past the buffer.
-  void* src_data = malloc(src_size + 256);
-  memset(src_data, 0, src_size + 256);
-  size_t count = fread(src_data, 1, src_size, f);
-  (void)count;
-  fclose(f);
+  void close() {
+    data = nullptr;
+    size = 0;
+    buffer.clear();
+  }
+
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  std::vector<uint8_t> buffer;
+};
+
+//------------------------------------------------------------------------------
+
+inline uint64_t hash_bytes(const uint8_t* p, size_t n) {
+  uint64_t h = 0xcbf29ce484222325ull ^ n;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w;
+    memcpy(&w, p + i, 8);
+    h = (h ^ w) * 0x100000001b3ull;
+    h ^= h >> 32;
+  }
+  for (; i < n; i++) h = (h ^ p[i]) * 0x100000001b3ull;
+  return h;
+}
+
+//------------------------------------------------------------------------------
+// Decoded contents of a .vh/.hex file - runs of bytes and the destination
+// offsets they get copied to.
+
+struct hex_segment {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct hex_image {
+  std::vector<hex_segment> segments;
+  std::vector<uint8_t> bytes;  // Segment contents, back to back
+  bool ok = true;
+};
+
+struct hex_digit_table {
+  uint8_t v[256];
+  constexpr hex_digit_table() : v() {
+    for (int i = 0; i < 256; i++) v[i] = 0xFF;
+    for (int i = 0; i < 10; i++) v['0' + i] = uint8_t(i);
+    for (int i = 0; i < 6; i++) v['a' + i] = v['A' + i] = uint8_t(10 + i);
+  }
+};
+
+inline constexpr hex_digit_table hex_digits;
+
+//----------------------------------------
+// Decodes the hex digits at the start of an 8-byte little-endian word all at
+// once. Returns how many leading bytes were hex digits and puts their value in
+// 'value'.
+
+inline int decode_hex8(uint64_t w, uint64_t& value) {
+  const uint64_t ones = 0x0101010101010101ull;
+  const uint64_t high = 0x8080808080808080ull;
+
+  // Range checks rely on every byte being < 0x80 so nothing carries between
+  // bytes. Folding in 0x20 maps 'A'-'F' onto 'a'-'f' and leaves digits alone.
+  uint64_t ascii = ~w & high;
+  uint64_t l = w | (ones * 0x20);
+  uint64_t digit = (w + ones * (0x80 - '0')) & ~(w + ones * (0x80 - '9' - 1));
+  uint64_t alpha = (l + ones * (0x80 - 'a')) & ~(l + ones * (0x80 - 'f' - 1));
+  uint64_t valid = (digit | alpha) & ascii;
+
+  uint64_t invalid = ~valid & high;
+  int run = invalid ? bits_ctz(invalid) / 8 : 8;
+  if (!run) return 0;
+
+  // Nibble values, first character in the low byte. Bytes past the run are
+  // cleared so they act like trailing zeros.
+  uint64_t nib = (w & (ones * 0x0F)) + ((alpha & ascii) >> 7) * 9;
+  if (run < 8) nib &= ~0ull >> (64 - run * 8);
+
+  // Pack pairs of nibbles into bytes, then bytes into a big-endian number.
+  uint64_t t = ((nib << 4) | (nib >> 8)) & 0x00FF00FF00FF00FFull;
+  t = (t | (t >> 8)) & 0x0000FFFF0000FFFFull;
+  t = (t | (t >> 16)) & 0x00000000FFFFFFFFull;
+  t = ((t & 0xFF) << 24) | ((t & 0xFF00) << 8) | ((t >> 8) & 0xFF00) | (t >> 24);
+
+  value = t >> (4 * (8 - run));
+  return run;
+}
 
-  uint8_t* sc = (uint8_t*)src_data;
-  uint8_t* sc_end = sc + src_size;
+//----------------------------------------
 
-  uint8_t* dc = (uint8_t*)dst_data;
-  uint8_t* dc_end = dc + (dst_size == -1 ? 0xFFFFFFFF : dst_size);
+inline void decode_hex(const char* src_filename, const uint8_t* sc, size_t len,
+                       hex_image& out) {
+  const uint8_t* sc_end = sc + len;
+  out.segments.push_back({0, 0});
 
-  while (sc[0] && sc < sc_end) {
+  while (sc < sc_end && sc[0]) {
     // Skip single-line comments
-    if (sc[0] == '/' && sc[1] == '/') {
-      while (sc[0] && sc[0] != '\n') sc++;
+    if (sc[0] == '/' && sc + 1 < sc_end && sc[1] == '/') {
+      while (sc < sc_end && sc[0] && sc[0] != '\n') sc++;
       sc++;
       continue;
     }
 
     // Skip multi-line comments
-    if (sc[0] == '/' && sc[1] == '*') {
-      while (sc[0] && (sc[0] != '*' || sc[1] != '/')) sc++;
+    if (sc[0] == '/' && sc + 1 < sc_end && sc[1] == '*') {
+      while (sc + 1 < sc_end && (sc[0] != '*' || sc[1] != '/')) sc++;
       sc += 2;
       continue;
     }
@@ -621,40 +1763,422 @@ inline void parse_hex(const char* src_filename, void* dst_data, int dst_size) {
       sc++;
     }
 
-    // We should be at a big-endian hex value now, decode it.
-    int chunk_data = 0;
+    // We should be at a big-endian hex value now. Decode 8 digits at a time
+    // while we can, then finish off with the table.
+    uint64_t chunk_data = 0;
     int chunk_size = 0;
-    while (sc[0]) {
-      int d = from_hex(sc[0]);
-      if (d == -1) break;
-      chunk_data <<= 4;
-      chunk_data |= d;
-      chunk_size++;
-      sc++;
+    while (sc + 8 <= sc_end) {
+      uint64_t w, v = 0;
+      memcpy(&w, sc, 8);
+      int run = decode_hex8(w, v);
+      chunk_data = (chunk_data << (4 * run)) | v;
+      chunk_size += run;
+      sc += run;
+      if (run < 8) break;
+    }
+    if (sc + 8 > sc_end) {
+      while (sc < sc_end && hex_digits.v[sc[0]] != 0xFF) {
+        chunk_data = (chunk_data << 4) | hex_digits.v[sc[0]];
+        chunk_size++;
+        sc++;
+      }
     }
 
     if (!chunk_size || (chunk_size & 1)) {
       // KCOV_OFF
+      uint8_t c = sc < sc_end ? sc[0] : 0;
       printf("Error loading %s: Invalid vmem character 0x%02x (%c)\n",
-             src_filename, sc[0], sc[0]);
-      // LOG_R("Error loading %s: Invalid vmem character 0x%02x (%c)\n",
-      //        src_filename, sc[0], sc[0]);
+             src_filename, c, c);
+      out.ok = false;
       return;
       // KCOV_ON
     }
 
     // Store hex value in address or in output stream, little-endian.
     if (is_addr) {
-      dc = (uint8_t*)dst_data + (chunk_data * 4);
+      if (out.segments.back().size) out.segments.push_back({0, 0});
+      out.segments.back().offset = chunk_data * 4;
     } else {
       for (; chunk_size; chunk_size -= 2) {
-        if (dc < dc_end) *dc++ = chunk_data & 0xFF;
+        out.bytes.push_back(chunk_data & 0xFF);
+        out.segments.back().size++;
         chunk_data >>= 8;
       }
     }
   }
+}
+
+//----------------------------------------
+
+inline void apply_hex(const hex_segment* segments, size_t count,
+                      const uint8_t* bytes, uint8_t* dst, uint64_t dst_size,
+                      bool zero_fill) {
+  // Skip clearing the destination if the first run covers all of it.
+  if (zero_fill) {
+    bool covered = count && segments[0].offset == 0 && segments[0].size >= dst_size;
+    if (!covered) memset(dst, 0, dst_size);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    auto& seg = segments[i];
+    if (seg.offset < dst_size) {
+      uint64_t size = seg.size;
+      if (size > dst_size - seg.offset) size = dst_size - seg.offset;
+      memcpy(dst + seg.offset, bytes, size);
+    }
+    bytes += seg.size;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Decoded images are cached in "<file>.mtcache" next to the source. The cache
+// records the source's size, modification time and a hash of its contents. If
+// the size and time still match, the cached image is used without reading the
+// source at all. Otherwise the source is read and hashed, and the cache is only
+// used if the hash matches. Define METRON_NO_HEX_CACHE to disable the cache.
+//
+// A source modified in the same second the cache is written could change again
+// without its time changing, so sources newer than a couple of seconds are
+// cached without a time and always get hashed.
+
+struct hex_cache_header {
+  char magic[8];
+  uint64_t src_hash;
+  uint64_t src_size;
+  int64_t src_mtime;  // Zero if the source was too new to trust its time
+  uint64_t segment_count;
+  uint64_t byte_count;
+};
+
+static const char hex_cache_magic[8] = "MTHEX02";
+
+// Size and modification time of a file, zeros if it can't be stat'd. This is
+// in the C runtime on both POSIX and MSVC.
+struct file_stamp {
+  uint64_t size = 0;
+  int64_t mtime = 0;
+};
+
+inline file_stamp get_file_stamp(const char* path) {
+  struct stat st;
+  if (stat(path, &st) != 0) return {};
+  return {uint64_t(st.st_size), int64_t(st.st_mtime)};
+}
+
+inline bool read_hex_cache_header(const file_contents& cache, hex_cache_header& h) {
+  if (cache.size < sizeof(hex_cache_header)) return false;
+  memcpy(&h, cache.data, sizeof(h));
+  if (memcmp(h.magic, hex_cache_magic, 8) != 0) return false;
+  uint64_t expected = sizeof(h) + h.segment_count * sizeof(hex_segment) + h.byte_count;
+  return cache.size == expected;
+}
+
+inline void apply_hex_cache(const file_contents& cache, const hex_cache_header& h,
+                            uint8_t* dst, uint64_t dst_size, bool zero_fill) {
+  auto segments = (const hex_segment*)(cache.data + sizeof(h));
+  auto bytes = cache.data + sizeof(h) + h.segment_count * sizeof(hex_segment);
+  apply_hex(segments, h.segment_count, bytes, dst, dst_size, zero_fill);
+}
+
+// Creates a new file named 'path' plus a suffix no other process is using.
+
+inline FILE* open_temp_file(const std::string& path, std::string& temp_path) {
+#ifdef _MSC_VER
+  temp_path = path + "." + std::to_string(_getpid());
+  return fopen(temp_path.c_str(), "wb");
+#else
+  temp_path = path + ".XXXXXX";
+  int fd = mkstemp(temp_path.data());
+  if (fd < 0) return nullptr;
+  return fdopen(fd, "wb");
+#endif
+}
+
+inline void save_hex_cache(const std::string& cache_path, hex_cache_header h,
+                           const hex_segment* segments, const uint8_t* bytes) {
+  memcpy(h.magic, hex_cache_magic, 8);
+
+  // Write to a temp file and rename it, so other processes loading the same
+  // image never see a partial cache.
+  std::string temp_path;
+  FILE* f = open_temp_file(cache_path, temp_path);
+  if (!f) return;
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  if (h.segment_count) {
+    ok &= fwrite(segments, sizeof(hex_segment), h.segment_count, f) == h.segment_count;
+  }
+  if (h.byte_count) {
+    ok &= fwrite(bytes, 1, h.byte_count, f) == h.byte_count;
+  }
+  fclose(f);
+
+  if (!ok || rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+    remove(temp_path.c_str());
+  }
+}
+
+//------------------------------------------------------------------------------
+
+inline void load_hex(const char* path, void* dst, uint64_t dst_size,
+                     bool zero_fill) {
+#ifndef METRON_NO_HEX_CACHE
+  std::string cache_path = std::string(path) + ".mtcache";
+
+  file_stamp stamp = get_file_stamp(path);
+  if (stamp.mtime > int64_t(time(nullptr)) - 2) stamp.mtime = 0;
+
+  file_contents cache;
+  hex_cache_header cached = {};
+  bool have_cache = cache.open(cache_path.c_str()) && read_hex_cache_header(cache, cached);
+
+  if (have_cache && stamp.mtime && cached.src_mtime == stamp.mtime &&
+      cached.src_size == stamp.size) {
+    apply_hex_cache(cache, cached, (uint8_t*)dst, dst_size, zero_fill);
+    return;
+  }
+#endif
+
+  file_contents src;
+  if (!src.open(path)) {
+    // KCOV_OFF
+    printf("Error loading %s: Could not open file\n", path);
+    return;
+    // KCOV_ON
+  }
+
+  uint64_t src_hash = hash_bytes(src.data, src.size);
+
+#ifndef METRON_NO_HEX_CACHE
+  if (have_cache && cached.src_hash == src_hash && cached.src_size == src.size) {
+    apply_hex_cache(cache, cached, (uint8_t*)dst, dst_size, zero_fill);
+
+    // Same contents under a new time (touched, checked out again), so record
+    // the new time to get the fast path back next time.
+    if (stamp.mtime && cached.src_mtime != stamp.mtime) {
+      auto segments = (const hex_segment*)(cache.data + sizeof(cached));
+      cached.src_mtime = stamp.mtime;
+      save_hex_cache(cache_path, cached, segments,
+                     (const uint8_t*)(segments + cached.segment_count));
+    }
+    return;
+  }
+#endif
+
+  hex_image image;
+  decode_hex(path, src.data, src.size, image);
+  apply_hex(image.segments.data(), image.segments.size(), image.bytes.data(),
+            (uint8_t*)dst, dst_size, zero_fill);
+
+#ifndef METRON_NO_HEX_CACHE
+  if (image.ok) {
+    hex_cache_header h = {};
+    h.src_hash = src_hash;
+    h.src_size = src.size;
+    h.src_mtime = stamp.size == src.size ? stamp.mtime : 0;
+    h.segment_count = image.segments.size();
+    h.byte_count = image.bytes.size();
+    save_hex_cache(cache_path, h, image.segments.data(), image.bytes.data());
+  }
+#endif
+}
+
+//----------------------------------------
+
+inline void parse_hex(const char* src_filename, void* dst_data, int dst_size) {
+  load_hex(src_filename, dst_data, dst_size == -1 ? 0xFFFFFFFF : uint32_t(dst_size), false);
+}
+
+//------------------------------------------------------------------------------
+// Memory that only allocates the 4K pages that have been written to. Reads of
+// untouched pages return zero, as do out-of-range reads - out-of-range writes
+// are dropped. Translates to a plain unpacked array, so
+//
+//   sparse_mem<logic<32>, 65536> mem;
+//
+// becomes "logic[31:0] mem[65536];".
+//
+// Indexing a non-const sparse_mem returns a copy of the element that writes
+// itself back when assigned to, so reads through it don't allocate.
+
+template <typename T, uint64_t DEPTH>
+class sparse_mem {
+ public:
+  static const uint64_t depth = DEPTH;
+  static const uint64_t page_words = sizeof(T) >= 4096 ? 1 : 4096 / sizeof(T);
+  static const uint64_t page_count = (DEPTH + page_words - 1) / page_words;
+
+  class ref : public T {
+   public:
+    ref(sparse_mem* mem, uint64_t index) : T(mem->get(index)), mem(mem), index(index) {}
+
+    ref& operator=(const ref& v) {
+      return *this = static_cast<const T&>(v);
+    }
+
+    template <typename V>
+    ref& operator=(const V& v) {
+      T::operator=(v);
+      mem->set(index, *this);
+      return *this;
+    }
+
+   private:
+    sparse_mem* mem;
+    uint64_t index;
+  };
+
+  //----------
+
+  // The page table comes from calloc so it's zeroed lazily too.
+  sparse_mem() : pages((T**)calloc(page_count, sizeof(T*))) {}
+
+  sparse_mem(const sparse_mem& b) : sparse_mem() { *this = b; }
+
+  sparse_mem& operator=(const sparse_mem& b) {
+    if (this == &b) return *this;
+    clear();
+    for (uint64_t i = 0; i < page_count; i++) {
+      if (b.pages[i]) {
+        pages[i] = new T[page_words];
+        memcpy((void*)pages[i], (const void*)b.pages[i], page_words * sizeof(T));
+      }
+    }
+    return *this;
+  }
+
+  ~sparse_mem() {
+    clear();
+    free(pages);
+  }
+
+  //----------
+
+  T get(uint64_t i) const {
+    if (i >= DEPTH) return T();
+    T* page = pages[i / page_words];
+    return page ? page[i % page_words] : T();
+  }
+
+  void set(uint64_t i, const T& v) {
+    if (i >= DEPTH) return;
+    page(i / page_words)[i % page_words] = v;
+  }
+
+  T operator[](uint64_t i) const { return get(i); }
+  ref operator[](uint64_t i) { return ref(this, i); }
+
+  // Copies raw bytes into the memory's storage, as if it was a flat T array.
+  void write_bytes(uint64_t offset, const uint8_t* src, uint64_t size) {
+    const uint64_t page_bytes = page_words * sizeof(T);
+    const uint64_t total = DEPTH * sizeof(T);
+    if (offset >= total) return;
+    if (size > total - offset) size = total - offset;
+
+    while (size) {
+      uint64_t p = offset / page_bytes;
+      uint64_t o = offset % page_bytes;
+      uint64_t n = page_bytes - o < size ? page_bytes - o : size;
+      memcpy((uint8_t*)page(p) + o, src, n);
+      offset += n;
+      src += n;
+      size -= n;
+    }
+  }
+
+  void clear() {
+    for (uint64_t i = 0; i < page_count; i++) {
+      delete[] pages[i];
+      pages[i] = nullptr;
+    }
+  }
+
+  uint64_t pages_allocated() const {
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < page_count; i++) count += pages[i] != nullptr;
+    return count;
+  }
+
+  //----------
+  // Checkpoint support, see sim_checkpoint. Only pages with something other
+  // than zeros in them are saved.
+
+  void save_pages(std::vector<uint8_t>& out) const {
+    const uint64_t page_bytes = page_words * sizeof(T);
+    size_t count_at = out.size();
+    uint64_t count = 0;
+    out.resize(out.size() + 8);
+
+    for (uint64_t i = 0; i < page_count; i++) {
+      auto src = (const uint8_t*)pages[i];
+      if (!src) continue;
+      uint8_t any = 0;
+      for (uint64_t j = 0; j < page_bytes; j++) any |= src[j];
+      if (!any) continue;
+
+      size_t at = out.size();
+      out.resize(at + 8 + page_bytes);
+      memcpy(out.data() + at, &i, 8);
+      memcpy(out.data() + at + 8, src, page_bytes);
+      count++;
+    }
+
+    memcpy(out.data() + count_at, &count, 8);
+  }
+
+  bool load_pages(const uint8_t*& src, const uint8_t* end) {
+    const uint64_t page_bytes = page_words * sizeof(T);
+    clear();
+
+    uint64_t count;
+    if (end - src < 8) return false;
+    memcpy(&count, src, 8);
+    src += 8;
+
+    for (uint64_t c = 0; c < count; c++) {
+      uint64_t i;
+      if (uint64_t(end - src) < 8 + page_bytes) return false;
+      memcpy(&i, src, 8);
+      if (i >= page_count) return false;
+      memcpy((void*)page(i), src + 8, page_bytes);
+      src += 8 + page_bytes;
+    }
+    return true;
+  }
+
+ private:
+  T* page(uint64_t p) {
+    if (!pages[p]) pages[p] = new T[page_words]();
+    return pages[p];
+  }
+
+  T** pages;
+};
+
+//----------------------------------------
+
+template <typename T, uint64_t DEPTH>
+inline void readmemh(const char* path, sparse_mem<T, DEPTH>& mem) {
+  file_contents src;
+  if (!src.open(path)) {
+    // KCOV_OFF
+    printf("Error loading %s: Could not open file\n", path);
+    return;
+    // KCOV_ON
+  }
+
+  hex_image image;
+  decode_hex(path, src.data, src.size, image);
+
+  const uint8_t* bytes = image.bytes.data();
+  for (auto& seg : image.segments) {
+    mem.write_bytes(seg.offset, bytes, seg.size);
+    bytes += seg.size;
+  }
+}
 
-  free(src_data);
+template <typename T, uint64_t DEPTH>
+inline void readmemh(const std::string& path, sparse_mem<T, DEPTH>& mem) {
+  readmemh(path.c_str(), mem);
 }
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,32 @@
+#pragma once
+#include "metron_tools.h"
+
+// "metron --coverage" used to key branch arms by line alone, so the two ifs on
+// one line in tick() shared their arms.
+
+class Emit_cov {
+public:
+
+  Emit_cov() {
+    acc = 0;
+    flag = 0;
+  }
+
+  void tock(logic<2> op, logic<4> x) {
+    tick(op, x);
+  }
+
+private:
+
+  void tick(logic<2> op, logic<4> x) {
+    if (x == 0) { flag = 1; } if (x == 1) { flag = 0; }
+    switch (op) {
+      case 0: acc = acc + x; break;
+      case 1: acc = acc - x; break;
+      default: acc = acc ^ x; break;
+    }
+  }
+
+  logic<4> acc;
+  logic<1> flag;
+};
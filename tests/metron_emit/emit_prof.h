@@ -0,0 +1,34 @@
+#pragma once
+#include "metron_tools.h"
+
+// "metron --profile" should time tock() and tick(), and leave the leaf funcs
+// alone.
+
+class Emit_prof {
+public:
+
+  Emit_prof() {
+    count = 0;
+  }
+
+  logic<8> get_count() const {
+    return count;
+  }
+
+  void tock(logic<8> delta) {
+    logic<8> d = twice(delta);
+    tick(d);
+  }
+
+private:
+
+  logic<8> twice(logic<8> x) const {
+    return x + x;
+  }
+
+  void tick(logic<8> d) {
+    count = count + d;
+  }
+
+  logic<8> count;
+};
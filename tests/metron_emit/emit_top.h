@@ -0,0 +1,62 @@
+#pragma once
+#include "metron_tools.h"
+
+// Emit_sub::x and Emit::sub_x used to get the same reflection tag, which was
+// built by pasting the module and field names together with underscores.
+
+class Emit_sub {
+public:
+
+  Emit_sub() {
+    x = 0;
+  }
+
+  logic<8> get_x() const {
+    return x;
+  }
+
+  void tock(logic<8> delta) {
+    tick(delta);
+  }
+
+private:
+
+  void tick(logic<8> delta) {
+    x = x + delta;
+  }
+
+  logic<8> x;
+};
+
+class Emit {
+public:
+
+  Emit() {
+    sub_x = 0;
+  }
+
+  logic<8> result;
+
+  void tock(logic<8> delta) {
+    if (delta == 0) {
+      result = 0;
+    } else {
+      result = sub.get_x();
+    }
+    sub.tock(delta);
+    tick();
+  }
+
+  logic<100> wide(logic<100> x) const {
+    return ~x;
+  }
+
+private:
+
+  void tick() {
+    sub_x = sub_x + 1;
+  }
+
+  logic<8> sub_x;
+  Emit_sub sub;
+};
@@ -0,0 +1,34 @@
+#include "metron_tools.h"
+
+// Narrow registers can be packed into shared words.
+// EXPECT logic running;
+// EXPECT logic[2:0] timer;
+// EXPECT logic[2:0] phase;
+// EXPECT NOT packed_logic
+
+class Module {
+public:
+
+  void tick(logic<1> trig) {
+    out = cat(b3(phase), b1(running));
+    if (trig) {
+      running = 1;
+      timer = 7;
+    } else if (timer) {
+      timer = timer - 1;
+    } else {
+      running = 0;
+    }
+    phase = phase + 1;
+  }
+
+  logic<4> get_out() {
+    return out;
+  }
+
+private:
+  packed_logic running : 1;
+  packed_logic timer : 3;
+  packed_logic phase : 3;
+  logic<4> out;
+};
@@ -0,0 +1,34 @@
+#include "metron_tools.h"
+
+// sparse_mem<> should turn into a plain unpacked array.
+// EXPECT logic[7:0] data[1024];
+// EXPECT $readmemh("examples/uart/message.hex", data);
+// EXPECT NOT sparse_mem<logic
+
+class Module {
+public:
+
+  Module() {
+    readmemh("examples/uart/message.hex", data);
+  }
+
+  void tock(logic<10> addr_, logic<8> wdata_) {
+    addr = addr_;
+    wdata = wdata_;
+  }
+
+  void tick() {
+    out = data[addr];
+    data[addr] = wdata;
+  }
+
+  logic<8> get_data() {
+    return out;
+  }
+
+private:
+  logic<10> addr;
+  logic<8> wdata;
+  sparse_mem<logic<8>, 1024> data;
+  logic<8> out;
+};
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "Tests.h"
+#include "metron_sim.h"
+
+// Generated by the build from tests/metron_emit.
+#include "emit_top_reflect.h"
+#include "emit_top_vl.h"
+#include "profile/emit_prof.h"
+#include "coverage/emit_cov.h"
+
+//------------------------------------------------------------------------------
+// Tests for the C++ that metron's generators write. Nothing in here is written
+// by hand to look like generator output - the build runs bin/metron on the
+// fixtures in tests/metron_emit and this file is compiled against the result.
+
+//------------------------------------------------------------------------------
+// "metron --reflect"
+
+TestResults test_emit_reflect() {
+  TEST_INIT();
+
+  typedef mt_reflect<Emit> R;
+  typedef mt_reflect<Emit_sub> RS;
+  static_assert(mt_is_reflected<Emit> && mt_is_reflected<Emit_sub>);
+
+  EXPECT_EQ(strcmp(R::name, "Emit"), 0, "x");
+  EXPECT_EQ(strcmp(RS::name, "Emit_sub"), 0, "x");
+
+  // Fields come out in declaration order with the translator's categories.
+  EXPECT_EQ(int(R::fields.size()), 3, "x");
+  EXPECT_EQ(strcmp(R::fields[0].name, "result"), 0, "x");
+  EXPECT_EQ(strcmp(R::fields[1].name, "sub_x"), 0, "x");
+  EXPECT_EQ(strcmp(R::fields[2].name, "sub"), 0, "x");
+  EXPECT_EQ(R::fields[1].kind, MT_FIELD_REGISTER, "x");
+  EXPECT_EQ(R::fields[2].kind, MT_FIELD_COMPONENT, "x");
+  EXPECT_EQ(R::fields[1].width, 8, "x");
+  EXPECT_EQ(int(RS::fields.size()), 1, "x");
+  EXPECT_EQ(strcmp(RS::fields[0].name, "x"), 0, "x");
+  EXPECT_EQ(RS::fields[0].kind, MT_FIELD_REGISTER, "x");
+
+  // Emit_sub::x and Emit::sub_x must have their own tags and member pointers.
+  static_assert(std::is_same_v<std::remove_cvref_t<decltype(std::get<1>(R::members))>, logic<8> Emit::*>);
+  static_assert(std::is_same_v<std::remove_cvref_t<decltype(std::get<0>(RS::members))>, logic<8> Emit_sub::*>);
+
+  Emit top;
+  for (int i = 0; i < 5; i++) top.tock(3);
+
+  EXPECT_EQ(top.*std::get<1>(R::members), 5, "Emit::sub_x should count tocks");
+  EXPECT_EQ(top.*std::get<2>(R::members).*std::get<0>(RS::members), 15, "Emit_sub::x should sum deltas");
+
+  // The visitor sees the same values, private fields included.
+  int visited = 0;
+  uint64_t total = 0;
+  mt_visit_fields(top, [&](const mt_field_info& info, auto& value) {
+    visited++;
+    if constexpr (std::is_same_v<std::remove_cvref_t<decltype(value)>, Emit_sub>) {
+      mt_visit_fields(value, [&](const mt_field_info& sub_info, auto& sub_value) {
+        if constexpr (std::is_same_v<std::remove_cvref_t<decltype(sub_value)>, logic<8>>) {
+          total += sub_value;
+        }
+      });
+    } else if (info.kind == MT_FIELD_REGISTER) {
+      total += value;
+    }
+  });
+  EXPECT_EQ(visited, 3, "x");
+  EXPECT_EQ(total, 20, "x");
+
+  size_t offset = mt_field_offset(top, 2);
+  EXPECT_EQ((const char*)&(top.*std::get<2>(R::members)) - (const char*)&top,
+            ptrdiff_t(offset), "Offset is wrong");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+// "metron --bind"
+//
+// There's no Verilator here, so VEmit stands in for the Verilated Emit: the
+// ports Verilator would give it, and an eval() that runs the Metron model
+// with Verilog's clocking - outputs follow the inputs and the current state,
+// and state only changes on a rising clock edge.
+
+struct VEmit {
+  uint8_t clock = 0;
+  uint8_t tock_delta = 0;
+  uint8_t result = 0;
+  uint32_t wide_x[4] = {};
+  uint32_t wide_ret[4] = {};
+
+  Emit state;
+  uint8_t old_clock = 0;
+  int edges = 0;
+
+  void eval() {
+    Emit next = state;
+    next.tock(tock_delta);
+    result = uint8_t(next.result);
+    sim_vl_put(wide_ret, state.wide(sim_vl_get<logic<100>>(wide_x)));
+    if (clock && !old_clock) {
+      state = next;
+      edges++;
+    }
+    old_clock = clock;
+  }
+};
+
+TestResults test_emit_bind() {
+  TEST_INIT();
+
+  Emit mt;
+  Emit_vl<VEmit> vl;
+
+  // Calls apply inputs, cycle() is the clock edge.
+  int mismatches = 0;
+  for (int i = 0; i < 20; i++) {
+    logic<8> delta = i % 5;
+    mt.tock(delta);
+    vl.tock(delta);
+    if (mt.result != vl.result.get()) mismatches++;
+    sim_cycle(mt);
+    sim_cycle(vl);
+  }
+  EXPECT_EQ(mismatches, 0, "Adapter doesn't behave like the Metron model");
+  EXPECT_EQ(vl.vl.edges, 20, "One clock edge per cycle");
+
+  // Several calls in one cycle still clock the model once.
+  vl.tock(1);
+  vl.tock(2);
+  EXPECT_EQ(vl.vl.edges, 20, "Method calls shouldn't clock the model");
+  vl.cycle();
+  EXPECT_EQ(vl.vl.edges, 21, "x");
+
+  // Funcs go through the wide ports.
+  logic<100> x = cat(logic<36>(0x123456789ull), logic<64>(0xFEDCBA9876543210ull));
+  EXPECT(vl.wide(x) == mt.wide(x), "Wide func through the adapter failed");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+// "metron --profile"
+
+TestResults test_emit_profile() {
+  TEST_INIT();
+
+  mt_prof_reset();
+  Emit_prof top;
+  for (int i = 0; i < 10; i++) top.tock(1);
+  EXPECT_EQ(top.get_count(), 20, "Instrumentation shouldn't change behavior");
+
+  auto& t = mt_prof_this_thread();
+  auto find = [&](int parent, const char* name) {
+    for (int c = t.nodes[parent].first_child; c >= 0; c = t.nodes[c].next_sibling) {
+      if (strcmp(t.nodes[c].name, name) == 0) return c;
+    }
+    return -1;
+  };
+
+  int tock = find(0, "Emit_prof::tock");
+  int tick = tock >= 0 ? find(tock, "Emit_prof::tick") : -1;
+  EXPECT(tock >= 0 && tick >= 0, "tock and tick should be timed");
+  if (tick >= 0) {
+    EXPECT_EQ(t.nodes[tock].calls, 10, "Wrong call count");
+    EXPECT_EQ(t.nodes[tick].calls, 10, "Wrong call count");
+  }
+  EXPECT(tock >= 0 && find(tock, "Emit_prof::twice") < 0, "Leaf funcs shouldn't be timed");
+  EXPECT_EQ(t.current, 0, "Scopes should unwind to the root");
+
+  // Otherwise the report gets printed when the test exits.
+  mt_prof_reset();
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+// "metron --coverage"
+
+TestResults test_emit_coverage() {
+  TEST_INIT();
+
+  mt_cov_reset();
+  Emit_cov top;
+  auto count_arms = [](int& arms, int& hit) {
+    std::map<std::string, std::array<uint64_t, 2>> cov;
+    mt_cov_collect(cov);
+    arms = hit = 0;
+    for (auto& [key, bits] : cov) {
+      if (!key.starts_with("arm Emit_cov ")) continue;
+      arms++;
+      hit += int(bits[0]);
+    }
+    return cov;
+  };
+
+  // x == 0 takes the first if, the second if's else and case 0.
+  int arms = 0, hit = 0;
+  top.tock(0, 0);
+  count_arms(arms, hit);
+  EXPECT_EQ(arms, 7, "Ifs on the same line should have their own arms");
+  EXPECT_EQ(hit, 3, "x");
+
+  top.tock(1, 5);
+  top.tock(2, 1);
+  auto cov = count_arms(arms, hit);
+  EXPECT_EQ(hit, 7, "Every arm should have been taken");
+
+  // acc went 0 -> 0 -> 11 -> 10, flag 0 -> 1 -> 1 -> 0.
+  EXPECT_EQ(cov["reg Emit_cov acc 4"][0], 0b1011, "Wrong rising bits");
+  EXPECT_EQ(cov["reg Emit_cov acc 4"][1], 0b0001, "Wrong falling bits");
+  EXPECT_EQ(cov["reg Emit_cov flag 1"][0], 1, "x");
+  EXPECT_EQ(cov["reg Emit_cov flag 1"][1], 1, "x");
+
+  // Otherwise this gets written to metron.cov when the test exits.
+  mt_cov_reset();
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  TestResults results("test_emitters");
+
+  results << test_emit_reflect();
+  results << test_emit_bind();
+  results << test_emit_profile();
+  results << test_emit_coverage();
+
+  return results.show_banner();
+}
+
+//------------------------------------------------------------------------------
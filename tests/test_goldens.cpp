@@ -0,0 +1,247 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Log.h"
+#include "MtTranslate.h"
+#include "MtUtils.h"
+#include "Platform.h"
+#include "Tests.h"
+#include "submodules/CLI11/include/CLI/App.hpp"
+#include "submodules/CLI11/include/CLI/Config.hpp"
+#include "submodules/CLI11/include/CLI/Formatter.hpp"
+
+//------------------------------------------------------------------------------
+// In-process version of the metron_good/metron_bad/metron_golden checks in
+// run_tests.py. Every test case is a separate mt_translate() call, cases run on
+// a pool of threads, and converted output is compared against the goldens in
+// memory.
+//
+// Lines in a case's source starting with "// EXPECT " or "// EXPECT NOT " give
+// text the output must or must not contain, so they're checked even before the
+// case has a golden.
+
+struct TestCase {
+  std::string dir;
+  std::string name;
+  bool expect_pass = true;
+
+  std::string golden_path;
+  bool has_golden = false;
+  std::string golden;
+  std::string output;
+
+  bool passed = false;
+  std::string message;
+};
+
+//------------------------------------------------------------------------------
+
+bool read_file(const std::string& path, std::string& out) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) return false;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  out.resize(size);
+  size_t count = fread(out.data(), 1, size, f);
+  fclose(f);
+  return count == size_t(size);
+}
+
+std::vector<std::string> list_headers(const std::string& dir) {
+  std::vector<std::string> result;
+  DIR* d = opendir(dir.c_str());
+  if (!d) return result;
+  while (auto entry = readdir(d)) {
+    std::string name = entry->d_name;
+    if (name.ends_with(".h")) result.push_back(name);
+  }
+  closedir(d);
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
+void run_case(TestCase& tc) {
+  std::string src_blob;
+  auto full_path = tc.dir + "/" + tc.name;
+  if (!read_file(full_path, src_blob)) {
+    tc.message = "could not read source";
+    return;
+  }
+
+  std::vector<std::string> src_lines;
+  for (size_t a = 0, b = 0; a < src_blob.size(); a = b + 1) {
+    b = src_blob.find('\n', a);
+    if (b == std::string::npos) b = src_blob.size();
+    auto line = src_blob.substr(a, b - a);
+    if (line.ends_with("\r")) line.pop_back();
+    src_lines.push_back(line);
+  }
+
+  auto result = mt_translate({{tc.name, src_blob}});
+  const auto& out = result.sv;
+
+  // Bad cases have to fail for the reason given by the "// X " lines in their
+  // source, same as check_bad_expected_errors() in run_tests.py.
+  if (!tc.expect_pass) {
+    if (result.ok) {
+      tc.message = "conversion should have failed";
+      return;
+    }
+    for (auto& line : src_lines) {
+      if (!line.starts_with("// X ")) continue;
+      auto text = line.substr(4);
+      while (text.size() && isspace(text.front())) text.erase(0, 1);
+      while (text.size() && isspace(text.back())) text.pop_back();
+      if (result.diagnostics.find(text) == std::string::npos) {
+        tc.message = "did not produce expected error \"" + text + "\"";
+        return;
+      }
+    }
+    tc.passed = true;
+    return;
+  }
+
+  if (!result.ok) {
+    tc.message = "conversion failed\n" + result.diagnostics;
+    return;
+  }
+
+  // The EXPECT comments get copied to the output, so they're left out of what
+  // gets searched.
+  std::string code;
+  for (size_t a = 0, b = 0; a < out.size(); a = b + 1) {
+    b = out.find('\n', a);
+    if (b == std::string::npos) b = out.size();
+    auto line = out.substr(a, b - a);
+    if (line.find("// EXPECT ") == std::string::npos) code += line + "\n";
+  }
+
+  for (auto& line : src_lines) {
+    bool expect_not = line.starts_with("// EXPECT NOT ");
+    if (!expect_not && !line.starts_with("// EXPECT ")) continue;
+    auto text = line.substr(expect_not ? 14 : 10);
+    if ((code.find(text) != std::string::npos) == expect_not) {
+      tc.message = (expect_not ? "output contains \"" : "output is missing \"") + text + "\"";
+      return;
+    }
+  }
+
+  if (tc.has_golden && out != tc.golden) {
+    // Report the first line that differs.
+    int line = 1;
+    size_t i = 0;
+    while (i < out.size() && i < tc.golden.size() && out[i] == tc.golden[i]) {
+      if (out[i] == '\n') line++;
+      i++;
+    }
+    tc.message = str_printf("output differs from golden at line %d", line);
+    return;
+  }
+
+  tc.output = out;
+  tc.passed = true;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  CLI::App app{"In-process Metron conversion tests"};
+
+  int jobs = int(std::thread::hardware_concurrency());
+  std::string test_dir = "tests";
+  bool verbose = false;
+  bool add_goldens = false;
+
+  app.add_option("-j,--jobs", jobs, "Number of worker threads");
+  app.add_option("-d,--dir", test_dir, "Directory containing metron_good, metron_bad and metron_golden");
+  app.add_flag("-v,--verbose", verbose, "Print every test case, not just failures");
+  app.add_flag("--add-goldens", add_goldens, "Write the output of every passing case that has no golden yet to metron_golden. Existing goldens are never overwritten.");
+  CLI11_PARSE(app, argc, argv);
+
+  if (jobs < 1) jobs = 1;
+
+  //----------
+  // Collect test cases and load goldens up front so workers don't touch the
+  // filesystem for them.
+
+  std::vector<TestCase> cases;
+
+  for (auto& name : list_headers(test_dir + "/metron_good")) {
+    TestCase tc;
+    tc.dir = test_dir + "/metron_good";
+    tc.name = name;
+    tc.expect_pass = true;
+    tc.golden_path = test_dir + "/metron_golden/" + name.substr(0, name.size() - 2) + ".sv";
+    tc.has_golden = read_file(tc.golden_path, tc.golden);
+    cases.push_back(tc);
+  }
+
+  for (auto& name : list_headers(test_dir + "/metron_bad")) {
+    TestCase tc;
+    tc.dir = test_dir + "/metron_bad";
+    tc.name = name;
+    tc.expect_pass = false;
+    cases.push_back(tc);
+  }
+
+  //----------
+  // mt_translate() captures each worker's log, so nothing gets interleaved.
+
+  auto time_a = timestamp();
+
+  std::atomic<int> next_case = 0;
+  std::vector<std::thread> workers;
+  for (int i = 0; i < jobs; i++) {
+    workers.emplace_back([&]() {
+      for (int c = next_case++; c < int(cases.size()); c = next_case++) {
+        run_case(cases[c]);
+      }
+    });
+  }
+  for (auto& w : workers) w.join();
+
+  auto time_b = timestamp();
+
+  //----------
+
+  TestResults results("metron_test_goldens");
+  int goldens = 0;
+
+  for (auto& tc : cases) {
+    if (add_goldens && tc.passed && tc.expect_pass && !tc.has_golden) {
+      FILE* f = fopen(tc.golden_path.c_str(), "wb");
+      if (f) {
+        fwrite(tc.output.data(), 1, tc.output.size(), f);
+        fclose(f);
+        LOG_Y("Added golden %s\n", tc.golden_path.c_str());
+      } else {
+        LOG_R("Could not write %s\n", tc.golden_path.c_str());
+      }
+    }
+    if (tc.has_golden) goldens++;
+    if (tc.passed) {
+      results.test_pass++;
+      if (verbose) LOG_G("pass %s/%s\n", tc.dir.c_str(), tc.name.c_str());
+    } else {
+      results.test_fail++;
+      LOG_R("FAIL %s/%s : %s\n", tc.dir.c_str(), tc.name.c_str(), tc.message.c_str());
+    }
+  }
+
+  LOG_B("%d cases, %d with goldens, %d threads, %f msec\n", int(cases.size()),
+        goldens, jobs, double(time_b - time_a) / 1000000.0);
+
+  return results.show_banner();
+}
+
+//------------------------------------------------------------------------------
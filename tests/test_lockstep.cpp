@@ -1,37 +1,60 @@
 #include <stdio.h>
 #include "Tests.h"
+#include "metron_sim.h"
 
 #define STRINGIZE1(M) #M
 #define STRINGIZE2(M) STRINGIZE1(M)
 
-#include STRINGIZE2(MT_HEADER)
+// The binding header includes the Metron header for us.
 #include STRINGIZE2(VL_HEADER)
+#include STRINGIZE2(BIND_HEADER)
+
+//------------------------------------------------------------------------------
+// All the lockstep test modules have the same ports, so one pair covers them.
+// The Verilated side goes through the adapter from "metron --bind", so both
+// models are driven by the same method calls, plus the adapter's clock edge.
+
+struct LockstepPair {
+  MT_TOP mt;
+  BIND_TOP<VL_TOP> vl;
+
+  void tock() {
+    mt.tock();
+    vl.tock();
+    sim_cycle(vl);
+  }
+
+  bool done() { return mt.done(); }
+
+  template <typename V>
+  void ports(V&& v) {
+    v("result", mt.result(), vl.result());
+    v("done", mt.done(), vl.done());
+  }
+};
+
+//------------------------------------------------------------------------------
 
 TestResults test_lockstep() {
   TEST_INIT();
 
-  MT_TOP mtop;
-  VL_TOP vtop;
+  LockstepPair pair;
+  sim_lockstep<LockstepPair> lockstep(pair);
 
   // Our tiny tests should simulate at a few tens of mhz at least, so a timeout
   // of 1 million cycles won't take too long.
-  for (int i = 0; i < 1000000; i++) {
-    mtop.tock();
-
-    vtop.clock = 0;
-    vtop.eval();
-    vtop.clock = 1;
-    vtop.eval();
+  auto r = lockstep.run(1000000);
 
-    printf("0x%08x 0x%08x\n", (uint32_t)mtop.result(), (uint32_t)vtop.result_ret);
-
-    EXPECT_EQ(mtop.result(), vtop.result_ret, "Results should match");
-    EXPECT_EQ(mtop.done(),   vtop.done_ret,   "Done flag should match");
-
-    if (mtop.done()) break;
+  if (!r.ok) {
+    LOG_R("Mismatch at cycle %lld, port %s: 0x%08llx != 0x%08llx\n",
+          (long long)r.bad_cycle, r.bad_port ? r.bad_port : "<unknown>",
+          (long long)r.mt_value, (long long)r.vl_value);
   }
 
-  EXPECT_EQ(true, mtop.done(), "Test timed out");
+  EXPECT(r.ok, "Results should match");
+  if (r.ok) {
+    EXPECT(r.done, "Test timed out");
+  }
 
   TEST_DONE();
 }
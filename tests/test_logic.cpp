@@ -1,4 +1,8 @@
+#include <chrono>
+#include <filesystem>
+
 #include "metron_tools.h"
+#include "metron_sim.h"
 
 #include "test_utils.h"
 
@@ -99,6 +103,618 @@ TestResults test_logic_dup() {
   TEST_DONE();
 }
 
+//------------------------------------------------------------------------------
+// The intrinsic and portable bit helpers should agree everywhere. Build with
+// -mbmi2 -mpopcnt to exercise the intrinsic versions.
+
+TestResults test_logic_bits() {
+  TEST_INIT();
+
+  uint64_t r = 0x123456789ABCDEF1ull;
+  auto rand64 = [&]() {
+    r ^= r << 13;
+    r ^= r >> 7;
+    r ^= r << 17;
+    return r;
+  };
+
+  int mismatches = 0;
+  for (int i = 0; i < 10000; i++) {
+    uint64_t x = rand64();
+    uint64_t y = rand64();
+    int offset = int(y % 64);
+    int width = int(y >> 58) + 1;
+    if (offset + width > 64) width = 64 - offset;
+
+    if (bits_extract(x, offset, width) != bits_extract_scalar(x, offset, width)) mismatches++;
+    if (bits_deposit(x, y, offset, width) != bits_deposit_scalar(x, y, offset, width)) mismatches++;
+    if (bits_parity(x) != bits_parity_scalar(x)) mismatches++;
+
+    uint64_t sign = 1ull << (width - 1);
+    uint64_t sx = ((x & bits_mask(width)) ^ sign) - sign;
+    if (bits_sign_extend(x, width) != sx) mismatches++;
+  }
+  EXPECT_EQ(mismatches, 0, "Intrinsic and portable bit helpers disagree");
+
+  // The logic<> helpers built on them should match the old formulations.
+  mismatches = 0;
+  for (int i = 0; i < 1000; i++) {
+    logic<37> a = rand64();
+    int offset = int(rand64() % 30);
+
+    if (bx<7>(a, offset) != ((a.get() >> offset) & 0x7F)) mismatches++;
+    if (b13(a, offset) != ((a.get() >> offset) & 0x1FFF)) mismatches++;
+
+    logic<12> t = cat(dup<5>(a[36]), bx<7>(a, 30));
+    if (sign_extend<12>(bx<7>(a, 30)) != t) mismatches++;
+
+    logic<29> d = dup<29>(a[3]);
+    if (d != (a[3] ? 0x1FFFFFFF : 0)) mismatches++;
+
+    uint64_t p = a.get();
+    p ^= p >> 32; p ^= p >> 16; p ^= p >> 8; p ^= p >> 4; p ^= p >> 2; p ^= p >> 1;
+    if (reduce_xor(a) != (p & 1)) mismatches++;
+
+    logic<37> s = a;
+    slice<20, 9>(s) = offset * 77;
+    uint64_t m = 0xFFFull << 9;
+    if (s != ((a.get() & ~m) | ((uint64_t(offset * 77) << 9) & m))) mismatches++;
+  }
+  EXPECT_EQ(mismatches, 0, "Bit helpers changed behavior");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+
+TestResults test_logic_wide() {
+  TEST_INIT();
+
+  // 65-128 bits use __int128 where available.
+  logic<100> a = 1;
+  a = a << 99;
+  EXPECT_EQ(uint64_t(a >> 64), 1ull << 35, "x");
+  a = a << 1;
+  EXPECT(a == 0, "Shifting past the top should clear the value");
+
+  logic<200> b = ~0ull;
+  logic<200> c = 1;
+  b = b + c;
+  EXPECT_EQ(b.limb(0), 0ull, "x");
+  EXPECT_EQ(b.limb(1), 1ull, "Carry should propagate into the next limb");
+
+  b = b - c;
+  EXPECT_EQ(b.limb(0), ~0ull, "Borrow should propagate out of the next limb");
+  EXPECT_EQ(b.limb(1), 0ull, "x");
+
+  logic<200> d = 0;
+  d = d - c;
+  EXPECT_EQ(d.limb(3), 0xFFull, "Top limb should stay masked");
+  EXPECT(reduce_and(d) == 1, "x");
+  EXPECT(d + 1 == 0, "x");
+
+  logic<256> e = 0x8000000000000001ull;
+  e = e << 130;
+  EXPECT_EQ(e.limb(2), 4ull, "x");
+  EXPECT_EQ(e.limb(3), 2ull, "x");
+  e = e >> 129;
+  EXPECT_EQ(e.limb(0), 2ull, "x");
+  EXPECT_EQ(e.limb(1), 1ull, "x");
+
+  EXPECT_EQ(bx<16>(e, 60), 0x0010, "bx should pull bits across limbs");
+  EXPECT_EQ(b4(e, 61), 0x8, "x");
+  EXPECT(e[64] == 1 && e[65] == 0 && e[1] == 1, "x");
+
+  logic<192> f = cat(logic<64>(0x1111111111111111ull),
+                     logic<64>(0x2222222222222222ull),
+                     logic<64>(0x3333333333333333ull));
+  EXPECT_EQ(f.limb(2), 0x1111111111111111ull, "x");
+  EXPECT_EQ(f.limb(0), 0x3333333333333333ull, "x");
+
+  logic<240> g = dup<30>(logic<8>(0xA5));
+  EXPECT_EQ(g.limb(3), 0xA5A5A5A5A5A5ull, "x");
+  EXPECT(reduce_xor(g) == 0, "x");
+  EXPECT(reduce_xor(g ^ logic<240>(1)) == 1, "x");
+  EXPECT(reduce_or(g) == 1, "x");
+
+  logic<8> h;
+  h = g;
+  EXPECT_EQ(h, 0xA5, "Assigning to a narrower logic should truncate");
+
+  logic<160> i = sign_extend<160>(logic<8>(0x80));
+  EXPECT_EQ(i.limb(2), 0xFFFFFFFFull, "x");
+  EXPECT_EQ(i.limb(0), 0xFFFFFFFFFFFFFF80ull, "x");
+
+  EXPECT(logic<160>(5) < logic<160>(7), "x");
+  EXPECT(!(i < logic<160>(7)), "x");
+  EXPECT(logic<160>(5) < 9 && logic<160>(9) <= 9 && i > 9 && i >= 9, "x");
+
+  // Widening must not pass through uint64_t.
+  logic<128> j = ~logic<128>(0);
+  logic<256> k(j);
+  logic<256> l = j;
+  EXPECT_EQ(k.limb(1), ~0ull, "Construction should keep the high half");
+  EXPECT_EQ(l.limb(1), ~0ull, "x");
+  EXPECT_EQ(l.limb(2), 0ull, "Construction should zero-extend");
+
+  // Products keep the low WIDTH bits.
+  logic<256> m = k * k;
+  EXPECT_EQ(m.limb(0), 1ull, "x");
+  EXPECT_EQ(m.limb(1), 0ull, "x");
+  EXPECT_EQ(m.limb(2), ~0ull - 1, "x");
+  EXPECT_EQ(m.limb(3), ~0ull, "x");
+  logic<200> n = d * d;
+  EXPECT(n == 1, "(-1)^2 should wrap to 1");
+  EXPECT(logic<160>(3) * 5 == 15, "x");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+
+TestResults test_logic_lanes() {
+  TEST_INIT();
+
+  // Every lane should match the same operation done on scalar logics.
+  logic_lanes<12, 16> a, b;
+  for (int i = 0; i < 16; i++) {
+    a.set_lane(i, i * 397 + 11);
+    b.set_lane(i, i * 1013 + 7);
+  }
+
+  auto sum = a + b;
+  auto diff = a - b;
+  auto mix = (a ^ b) | (a << 3);
+  auto less = a < b;
+  auto top = bx<4>(a, 8);
+  auto both = cat(top, bx<8>(b));
+  auto parity = reduce_xor(a);
+
+  for (int i = 0; i < 16; i++) {
+    logic<12> sa = a.lane(i);
+    logic<12> sb = b.lane(i);
+    logic<12> ssum = sa + sb;
+    logic<12> sdiff = sa - sb;
+    logic<12> smix = (sa ^ sb) | (sa << 3);
+
+    EXPECT_EQ(sum.lane(i), ssum, "x");
+    EXPECT_EQ(diff.lane(i), sdiff, "x");
+    EXPECT_EQ(mix.lane(i), smix, "x");
+    EXPECT_EQ(less.lane(i), sa < sb, "x");
+    EXPECT_EQ(top.lane(i), b4(sa, 8), "x");
+    EXPECT_EQ(both.lane(i), cat(b4(sa, 8), b8(sb)), "x");
+    EXPECT_EQ(parity.lane(i), reduce_xor(sa), "x");
+  }
+
+  // Branches become selects - count up until each lane hits its limit.
+  logic_lanes<8, 16> count = 0;
+  logic_lanes<8, 16> limit;
+  for (int i = 0; i < 16; i++) limit.set_lane(i, i * 3);
+
+  for (int step = 0; step < 100; step++) {
+    count = lanes_select(count < limit, count + 1, count);
+  }
+  for (int i = 0; i < 16; i++) EXPECT_EQ(count.lane(i), i * 3, "x");
+
+  EXPECT(lanes_all(count == limit), "x");
+  EXPECT(!lanes_any(count != limit), "x");
+
+  // Over-wide shifts clear, like wide logics.
+  EXPECT(lanes_all((a << 12) == 0) && lanes_all((a >> 70) == 0), "x");
+
+  // Compound assignments and width casts match the scalar versions.
+  logic_lanes<12, 16> acc = a;
+  acc += b;
+  acc ^= 0x5A;
+  acc <<= 2;
+  logic_lanes<4, 16> low = b4(acc, 3);
+  logic_lanes<16, 16> wider;
+  wider = acc;
+  for (int i = 0; i < 16; i++) {
+    logic<12> sacc = a.lane(i);
+    sacc = sacc + b.lane(i);
+    sacc = sacc ^ 0x5A;
+    sacc = sacc << 2;
+    EXPECT_EQ(acc.lane(i), sacc, "x");
+    EXPECT_EQ(low.lane(i), b4(sacc, 3), "x");
+    EXPECT_EQ(wider.lane(i).get(), sacc.get(), "x");
+  }
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+// readmemh should decode the same bytes whether it goes through the word-at-a-
+// time decoder, the table fallback, or a cached image.
+
+TestResults test_logic_readmemh() {
+  TEST_INIT();
+
+  std::string path = test_temp_path("metron_test_readmemh.vh");
+  std::string cache_path = path + ".mtcache";
+  remove(cache_path.c_str());
+
+  FILE* f = fopen(path.c_str(), "wb");
+  fprintf(f, "// comment\n");
+  fprintf(f, "00112233 aAbBcCdD\n");
+  fprintf(f, "/* multi\n line */ 0123456789abcdef\n");
+  fprintf(f, "@00000004\n");
+  fprintf(f, "fe dc\tBA98\n");
+  fprintf(f, "7654");
+  fclose(f);
+
+  const uint8_t expected[24] = {
+    0x33, 0x22, 0x11, 0x00, 0xDD, 0xCC, 0xBB, 0xAA,
+    0xEF, 0xCD, 0xAB, 0x89, 0x67, 0x45, 0x23, 0x01,
+    0xFE, 0xDC, 0x98, 0xBA, 0x54, 0x76, 0x00, 0x00,
+  };
+
+  for (int pass = 0; pass < 2; pass++) {
+    uint8_t mem[24];
+    memset(mem, 0x5A, sizeof(mem));
+    readmemh(path, mem, 0, 23);
+    EXPECT(memcmp(mem, expected, 24) == 0, "readmemh decoded the wrong bytes");
+
+    // Without a range the tail of the destination is left alone.
+    memset(mem, 0x5A, sizeof(mem));
+    readmemh(path, mem);
+    EXPECT(memcmp(mem, expected, 22) == 0, "readmemh decoded the wrong bytes");
+    EXPECT_EQ(mem[22], 0x5A, "readmemh wrote past the end of the image");
+  }
+
+#ifndef METRON_NO_HEX_CACHE
+  FILE* c = fopen(cache_path.c_str(), "rb");
+  EXPECT(c != nullptr, "readmemh did not write a cache file");
+  if (c) fclose(c);
+
+  // A cache whose size and time match the source is used without reading the
+  // source, so a same-size edit that keeps the old time still loads the cached
+  // image. Any other time makes it check the contents again.
+  {
+    namespace fs = std::filesystem;
+    auto old_time = fs::file_time_type::clock::now() - std::chrono::seconds(100);
+
+    std::string stamp_path = test_temp_path("metron_test_hex_stamp.vh");
+    std::string stamp_cache = stamp_path + ".mtcache";
+    remove(stamp_cache.c_str());
+
+    uint8_t mem[2] = {};
+    f = fopen(stamp_path.c_str(), "wb");
+    fprintf(f, "0011");
+    fclose(f);
+    fs::last_write_time(stamp_path, old_time);
+    readmemh(stamp_path, mem);
+    EXPECT_EQ(mem[0], 0x11, "readmemh decoded the wrong bytes");
+
+    f = fopen(stamp_path.c_str(), "wb");
+    fprintf(f, "0022");
+    fclose(f);
+    fs::last_write_time(stamp_path, old_time);
+    readmemh(stamp_path, mem);
+    EXPECT_EQ(mem[0], 0x11, "readmemh should trust a cache with a matching time");
+
+    fs::last_write_time(stamp_path, old_time + std::chrono::seconds(10));
+    readmemh(stamp_path, mem);
+    EXPECT_EQ(mem[0], 0x22, "readmemh should re-check a cache with a stale time");
+
+    remove(stamp_path.c_str());
+    remove(stamp_cache.c_str());
+  }
+#endif
+
+  // Every token width the word decoder handles should agree with from_hex.
+  uint64_t r = 0x9E3779B97F4A7C15ull;
+  int mismatches = 0;
+  for (int i = 0; i < 10000; i++) {
+    r ^= r << 13;
+    r ^= r >> 7;
+    r ^= r << 17;
+
+    char text[8];
+    for (int j = 0; j < 8; j++) text[j] = "0123456789abcdefABCDEF @/\n_g"[(r >> (j * 5)) % 28];
+
+    uint64_t w, value = 0, ref = 0;
+    memcpy(&w, text, 8);
+    int run = decode_hex8(w, value);
+    int ref_run = 0;
+    while (ref_run < 8 && from_hex(text[ref_run]) != -1) {
+      ref = (ref << 4) | from_hex(text[ref_run]);
+      ref_run++;
+    }
+    if (run != ref_run || (run && value != ref)) mismatches++;
+  }
+  EXPECT_EQ(mismatches, 0, "decode_hex8 disagrees with from_hex");
+
+  remove(path.c_str());
+  remove(cache_path.c_str());
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+// Binary images should round-trip whether they're mapped over the destination
+// or read into it, and writes to a mapped memory must not reach the file.
+
+TestResults test_logic_readmemb_mmap() {
+  TEST_INIT();
+
+  std::string image_path = test_temp_path("metron_test_image.bin");
+  const char* path = image_path.c_str();
+  const int depth = 4096;
+
+  static logic<24> src[depth];
+  for (int i = 0; i < depth; i++) src[i] = i * 0x10203;
+  EXPECT(writememb_image(path, src, 16, depth - 1), "writememb_image failed");
+
+  // Page-aligned destination, the middle of the image gets mapped.
+  auto aligned = (logic<24>(*)[depth])aligned_alloc(4096, sizeof(src));
+  memset(aligned, 0, sizeof(src));
+  EXPECT(readmemb_mmap(path, *aligned), "readmemb_mmap failed");
+  int mismatches = 0;
+  for (int i = 0; i < depth; i++) {
+    if ((*aligned)[i] != (i >= 16 ? src[i] : logic<24>(0))) mismatches++;
+  }
+  EXPECT_EQ(mismatches, 0, "Mapped image has the wrong contents");
+
+  (*aligned)[1000] = 0xABCDEF;
+  EXPECT_EQ((*aligned)[1000], 0xABCDEF, "Mapped image should be writable");
+
+  // Misaligned destination, everything gets read.
+  static logic<24> other[depth + 1];
+  logic<24>(&shifted)[depth] = *(logic<24>(*)[depth])(other + 1);
+  EXPECT(readmemb_mmap(path, shifted), "readmemb_mmap failed");
+  mismatches = 0;
+  for (int i = 16; i < depth; i++) {
+    if (shifted[i] != src[i]) mismatches++;
+  }
+  EXPECT_EQ(mismatches, 0, "Copied image has the wrong contents");
+  free(aligned);
+
+  // Images only load into memories of the same shape.
+  static logic<32> wrong_width[depth];
+  static logic<24> too_small[depth / 2];
+  EXPECT(!readmemb_mmap(path, wrong_width), "Width mismatch should fail");
+  EXPECT(!readmemb_mmap(path, too_small), "Depth mismatch should fail");
+
+  remove(path);
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+
+TestResults test_logic_sparse_mem() {
+  TEST_INIT();
+
+  // 16M words, way more than we'd want to allocate for a test.
+  static sparse_mem<logic<32>, (1 << 24)> mem;
+  const auto& cmem = mem;
+  EXPECT_EQ(mem.pages_allocated(), 0, "New sparse_mem should be empty");
+
+  EXPECT_EQ(cmem[123456], 0, "Untouched words should read as zero");
+  logic<32> q = mem[7777777];  // Through the non-const path
+  EXPECT_EQ(q, 0, "Untouched words should read as zero");
+  EXPECT_EQ(mem.pages_allocated(), 0, "Reads should not allocate");
+
+  // Same read-modify-write as example_data_memory
+  logic<24> address = 0x123456;
+  logic<32> mask = 0x0000FF00;
+  logic<32> data = 0xAABBCCDD;
+  mem[address] = 0x11223344;
+  mem[address] = (mem[address] & ~mask) | (data & mask);
+  EXPECT_EQ(cmem[address], 0x1122CC44, "Masked write through sparse_mem");
+  EXPECT_EQ(cmem[address + 1], 0, "Neighbors should be untouched");
+  EXPECT_EQ(mem.pages_allocated(), 1, "One write should allocate one page");
+
+  mem[address + 1] = mem[address];
+  EXPECT_EQ(cmem[address + 1], 0x1122CC44, "Element to element copy");
+
+  // Out of range accesses are dropped
+  mem[1 << 24] = 1;
+  EXPECT_EQ(cmem[1 << 24], 0, "Out of range writes should be dropped");
+
+  // Copies are deep
+  auto copy = new sparse_mem<logic<32>, (1 << 24)>(mem);
+  mem[address] = 0;
+  EXPECT_EQ(copy->get(address), 0x1122CC44, "Copies should not share pages");
+  delete copy;
+
+  // Loading crosses page boundaries
+  std::string sparse_path = test_temp_path("metron_test_sparse.vh");
+  const char* path = sparse_path.c_str();
+  FILE* f = fopen(path, "wb");
+  fprintf(f, "@000003FF\n01234567 89ABCDEF\n@00400000\ndeadbeef\n");
+  fclose(f);
+
+  mem.clear();
+  readmemh(path, mem);
+  EXPECT_EQ(cmem[0x3FF], 0x01234567, "readmemh into sparse_mem");
+  EXPECT_EQ(cmem[0x400], 0x89ABCDEF, "readmemh into sparse_mem");
+  EXPECT_EQ(cmem[0x400000], 0xDEADBEEF, "readmemh into sparse_mem");
+  EXPECT_EQ(mem.pages_allocated(), 3, "readmemh should only touch three pages");
+  remove(path);
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+// Deferred logging should produce exactly what immediate logging does, in the
+// same order, whether it's drained inline or by the background thread.
+
+TestResults test_logic_sim_log() {
+  TEST_INIT();
+
+  auto run = [](bool deferred, bool threaded) {
+    FILE* f = tmpfile();
+    std::string result;
+    {
+      sim_log_channel chan(f, 4096);
+      chan.set_deferred(deferred);
+      if (threaded) sim_log_start_thread(chan);
+
+      char name[16] = "temp";
+      logic<12> x = 0xABC;
+      logic<100> w = 42;
+      for (int i = 0; i < 500; i++) {
+        chan.print(SIM_LOG_INFO, "%d %s %s %03x %llu %.1f %.2Lf\n", i, name, "lit", x, w,
+                   i * 0.5f, i * 0.25L);
+        chan.print(SIM_LOG_DEBUG, "debug %d\n", i);
+        name[0] = 'a' + (i % 26);
+      }
+
+      // Longer than the formatting buffer, but fits in the ring
+      std::string longer(300, 'y');
+      chan.print(SIM_LOG_INFO, "%s %d\n", longer.c_str(), 7);
+
+      chan.set_min_level(SIM_LOG_WARN);
+      chan.print(SIM_LOG_INFO, "dropped\n");
+      chan.print(SIM_LOG_ERROR, "error\n");
+
+      // Bigger than the ring
+      std::string big(5000, 'x');
+      chan.print(SIM_LOG_ERROR, "%s\n", big.c_str());
+    }
+
+    fseek(f, 0, SEEK_END);
+    result.resize(ftell(f));
+    fseek(f, 0, SEEK_SET);
+    size_t count = fread(result.data(), 1, result.size(), f);
+    fclose(f);
+    result.resize(count);
+    return result;
+  };
+
+  // The severity functions should be filtered by level.
+  {
+    auto& chan = sim_log();
+    int old_level = chan.get_min_level();
+    bool old_deferred = chan.is_deferred();
+    chan.set_deferred(false);
+    chan.set_min_level(SIM_LOG_NONE);
+    EXPECT(display("x") == 0 && display_info("x") == 0 && display_warning("x") == 0 &&
+           display_error("x") == 0, "x");
+    chan.set_min_level(SIM_LOG_ERROR);
+    EXPECT(display_info("x") == 0 && display_warning("x") == 0, "Info and warning should be dropped");
+    chan.set_min_level(SIM_LOG_WARN);
+    EXPECT(display_info("x") == 0, "x");
+    chan.set_min_level(old_level);
+    chan.set_deferred(old_deferred);
+  }
+
+  auto immediate = run(false, false);
+  EXPECT(immediate.find("499 eemp lit abc 42 249.5 124.75\n") != std::string::npos, "Immediate log is wrong");
+  EXPECT(immediate.find(std::string(300, 'y') + " 7\n") != std::string::npos, "Long message is wrong");
+  EXPECT(immediate.find("dropped") == std::string::npos, "Low-severity message not dropped");
+  EXPECT(run(true, false) == immediate, "Deferred log doesn't match immediate log");
+  EXPECT(run(true, true) == immediate, "Threaded log doesn't match immediate log");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+// The helpers skip masking when the operand widths prove the result fits. Check
+// them against the old always-mask formulations, and check that every result
+// still has no bits set above its width.
+
+template <int WIDTH>
+bool in_range(const logic<WIDTH>& x) {
+  return x.get() == (x.get() & logic<WIDTH>::mask);
+}
+
+TestResults test_logic_unmasked() {
+  TEST_INIT();
+
+  uint64_t r = 0xDEADBEEFCAFEF00Dull;
+  auto rand64 = [&]() {
+    r ^= r << 13;
+    r ^= r >> 7;
+    r ^= r << 17;
+    return r;
+  };
+
+  int mismatches = 0;
+  int out_of_range = 0;
+  for (int i = 0; i < 10000; i++) {
+    logic<5> a = rand64();
+    logic<11> b = rand64();
+    logic<32> c = rand64();
+    logic<90> d = logic<90>::coerce(rand64());
+    int offset = int(rand64() % 27);
+
+    auto ab = cat(a, b);
+    if (ab.get() != (((uint64_t(a) << 11) | uint64_t(b)) & 0xFFFF)) mismatches++;
+    out_of_range += !in_range(ab);
+
+    auto acd = cat(a, c, d);
+    if (bx<90>(acd) != d || bx<32>(acd, 90) != c || bx<5>(acd, 122) != a) mismatches++;
+    out_of_range += !in_range(acd);
+
+    auto aaa = dup<6>(a);
+    if (aaa.get() != uint64_t(a) * 0x2108421ull) mismatches++;
+    out_of_range += !in_range(aaa);
+
+    auto x = bx<13>(c, offset);
+    if (x.get() != ((uint64_t(c) >> offset) & 0x1FFF)) mismatches++;
+    out_of_range += !in_range(x);
+
+    logic<11> b2 = rand64();
+    if ((b & b2).get() != (uint64_t(b) & uint64_t(b2))) mismatches++;
+    if ((b | b2).get() != (uint64_t(b) | uint64_t(b2))) mismatches++;
+    if ((b ^ b2).get() != (uint64_t(b) ^ uint64_t(b2))) mismatches++;
+    out_of_range += !in_range(b & b2) + !in_range(b | b2) + !in_range(b ^ b2);
+    out_of_range += !in_range(~b);
+
+    // Widening is a plain copy, narrowing truncates
+    logic<32> wide;
+    wide = b;
+    logic<5> narrow;
+    narrow = b;
+    if (wide.get() != uint64_t(b) || narrow.get() != (uint64_t(b) & 0x1F)) mismatches++;
+    out_of_range += !in_range(wide) + !in_range(narrow);
+
+    if (b[offset % 11] != ((uint64_t(b) >> (offset % 11)) & 1)) mismatches++;
+    if (reduce_and(a) != (a == 0x1F)) mismatches++;
+    if (reduce_or(a) != (a != 0)) mismatches++;
+  }
+
+  EXPECT_EQ(mismatches, 0, "Unmasked helpers disagree with the masked versions");
+  EXPECT_EQ(out_of_range, 0, "Helper results have bits set above their width");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+
+TestResults test_logic_packed() {
+  TEST_INIT();
+
+  struct Regs {
+    packed_logic running : 1;
+    packed_logic duty : 2;
+    packed_logic env_vol : 4;
+    packed_logic timer : 3;
+    packed_logic lfsr : 15;
+  };
+  EXPECT_EQ(sizeof(Regs), 8, "Packed fields should share one word");
+
+  Regs r = {};
+  r.env_vol = 15;
+  r.env_vol = r.env_vol + 1;
+  EXPECT_EQ(r.env_vol, 0, "Packed fields should wrap like logic<>");
+  logic<3> duty = 0b110;
+  r.duty = duty;
+  EXPECT_EQ(r.duty, 0b10, "Packed fields should truncate like logic<>");
+  EXPECT_EQ(r.running, 0, "Writes shouldn't touch neighbors");
+
+  r.lfsr = 0x7FFF;
+  logic<4> a = b4(r.lfsr, 3);
+  logic<6> b = cat(b2(r.duty), b4(r.env_vol));
+  EXPECT_EQ(a, 0xF, "bN() should extract from packed fields");
+  EXPECT_EQ(b, 0b100000, "Packed fields should concatenate through bN()");
+
+  TEST_DONE();
+}
+
 //------------------------------------------------------------------------------
 
 TestResults test_logic() {
@@ -109,6 +725,15 @@ TestResults test_logic() {
   results << test_logic_cat();
   results << test_logic_slice();
   results << test_logic_dup();
+  results << test_logic_bits();
+  results << test_logic_unmasked();
+  results << test_logic_wide();
+  results << test_logic_lanes();
+  results << test_logic_readmemh();
+  results << test_logic_readmemb_mmap();
+  results << test_logic_sparse_mem();
+  results << test_logic_packed();
+  results << test_logic_sim_log();
 
   TEST_DONE();
 }
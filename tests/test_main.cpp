@@ -6,6 +6,7 @@
 
 TestResults test_utils();
 TestResults test_logic();
+TestResults test_sim();
 TestResults test_uart();
 TestResults test_ibex();
 TestResults test_rvsimple();
@@ -18,6 +19,7 @@ int main(int argc, char** argv) {
 
   results << test_utils();  // this looks ok
   results << test_logic();  // this looks ok
+  results << test_sim();
   // results += test_ibex();
 
   LOG_G("%s: %6d expect pass\n", __FUNCTION__, results.expect_pass);
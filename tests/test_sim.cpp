@@ -0,0 +1,791 @@
+#include <atomic>
+#include <thread>
+
+#include "metron_tools.h"
+#include "metron_coverage.h"
+#include "metron_profile.h"
+#include "metron_sim.h"
+
+#include "test_utils.h"
+
+//------------------------------------------------------------------------------
+// Tests for the simulation runtime - reflection and the tracing, checkpoint,
+// lockstep, binding, benchmark, profiling, coverage and fast-forward tools
+// built on it.
+
+//------------------------------------------------------------------------------
+// ReflectTest and its mt_reflect<> are laid out the way "metron --reflect"
+// would generate them.
+
+class ReflectTest {
+public:
+  logic<8> in;
+  logic<12> out;
+
+  void tick() {
+    count = count + in;
+    mem[b2(count)] = out;
+  }
+
+private:
+  logic<20> count;
+  logic<16> mem[4];
+  packed_logic flag : 1;
+  sparse_mem<logic<32>, 1024> big;
+};
+
+template <> struct mt_tag<ReflectTest, 0> { friend constexpr auto mt_member(mt_tag<ReflectTest, 0>); };
+template struct mt_member_access<mt_tag<ReflectTest, 0>, &ReflectTest::in>;
+template <> struct mt_tag<ReflectTest, 1> { friend constexpr auto mt_member(mt_tag<ReflectTest, 1>); };
+template struct mt_member_access<mt_tag<ReflectTest, 1>, &ReflectTest::out>;
+template <> struct mt_tag<ReflectTest, 2> { friend constexpr auto mt_member(mt_tag<ReflectTest, 2>); };
+template struct mt_member_access<mt_tag<ReflectTest, 2>, &ReflectTest::count>;
+template <> struct mt_tag<ReflectTest, 3> { friend constexpr auto mt_member(mt_tag<ReflectTest, 3>); };
+template struct mt_member_access<mt_tag<ReflectTest, 3>, &ReflectTest::mem>;
+template <> struct mt_tag<ReflectTest, 5> { friend constexpr auto mt_member(mt_tag<ReflectTest, 5>); };
+template struct mt_member_access<mt_tag<ReflectTest, 5>, &ReflectTest::big>;
+
+template <>
+struct mt_reflect<ReflectTest> {
+  static constexpr const char* name = "ReflectTest";
+
+  static constexpr auto members = std::make_tuple(
+    mt_member(mt_tag<ReflectTest, 0>{}),
+    mt_member(mt_tag<ReflectTest, 1>{}),
+    mt_member(mt_tag<ReflectTest, 2>{}),
+    mt_member(mt_tag<ReflectTest, 3>{}),
+    nullptr,
+    mt_member(mt_tag<ReflectTest, 5>{}));
+
+  static constexpr std::array<mt_field_info, 6> fields = {{
+    mt_make_field("in", MT_FIELD_INPUT, std::get<0>(members)),
+    mt_make_field("out", MT_FIELD_OUTPUT_REG, std::get<1>(members)),
+    mt_make_field("count", MT_FIELD_REGISTER, std::get<2>(members)),
+    mt_make_field("mem", MT_FIELD_REGISTER, std::get<3>(members)),
+    mt_make_packed_field("flag", MT_FIELD_REGISTER, 1),
+    mt_make_field("big", MT_FIELD_REGISTER, std::get<5>(members))}};
+};
+
+TestResults test_sim_reflect() {
+  TEST_INIT();
+
+  typedef mt_reflect<ReflectTest> R;
+  static_assert(mt_is_reflected<ReflectTest>);
+  static_assert(!mt_is_reflected<logic<8>>);
+  static_assert(R::fields[2].width == 20 && R::fields[2].kind == MT_FIELD_REGISTER);
+  static_assert(R::fields[3].width == 16 && R::fields[3].extent == 4);
+  static_assert(R::fields[5].width == 32 && R::fields[5].extent == 1024);
+
+  ReflectTest t = {};
+  t.in = 3;
+  t.tick();
+  t.tick();
+
+  int visited = 0;
+  uint64_t total = 0;
+  mt_visit_fields(t, [&](const mt_field_info& info, auto& value) {
+    visited++;
+    if constexpr (std::is_same_v<std::remove_cvref_t<decltype(value)>, logic<20>>) {
+      EXPECT_EQ(strcmp(info.name, "count"), 0, "Visitor paired a field with the wrong info");
+      total += value;
+      value = 0;
+    }
+  });
+  EXPECT_EQ(visited, 5, "Visitor should skip packed fields");
+  EXPECT_EQ(total, 6, "Visitor didn't see the register's value");
+
+  auto count = std::get<2>(R::members);
+  EXPECT_EQ(t.*count, 0, "Visitor writes should land in the module");
+
+  size_t offset = mt_field_offset(t, 3);
+  EXPECT_EQ(offset, mt_field_offset(t, std::get<3>(R::members)), "Offsets should agree");
+  EXPECT_EQ(mt_field_offset(t, 4), size_t(-1), "Packed fields have no offset");
+  EXPECT_EQ((char*)&(t.*std::get<3>(R::members)) - (char*)&t, ptrdiff_t(offset), "Offset is wrong");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+
+class ReflectTop {
+public:
+  logic<1> enable;
+  ReflectTest sub;
+};
+
+template <> struct mt_tag<ReflectTop, 0> { friend constexpr auto mt_member(mt_tag<ReflectTop, 0>); };
+template struct mt_member_access<mt_tag<ReflectTop, 0>, &ReflectTop::enable>;
+template <> struct mt_tag<ReflectTop, 1> { friend constexpr auto mt_member(mt_tag<ReflectTop, 1>); };
+template struct mt_member_access<mt_tag<ReflectTop, 1>, &ReflectTop::sub>;
+
+template <>
+struct mt_reflect<ReflectTop> {
+  static constexpr const char* name = "ReflectTop";
+
+  static constexpr auto members = std::make_tuple(
+    mt_member(mt_tag<ReflectTop, 0>{}),
+    mt_member(mt_tag<ReflectTop, 1>{}));
+
+  static constexpr std::array<mt_field_info, 2> fields = {{
+    mt_make_field("enable", MT_FIELD_INPUT, std::get<0>(members)),
+    mt_make_field("sub", MT_FIELD_COMPONENT, std::get<1>(members))}};
+};
+
+TestResults test_sim_trace() {
+  TEST_INIT();
+
+  std::string trace_path = test_temp_path("metron_test_trace.vcd");
+  const char* path = trace_path.c_str();
+  ReflectTop top = {};
+  top.sub.in = 1;
+
+  sim_trace trace;
+  EXPECT(trace.open(path), "Couldn't open the trace file");
+  trace.add(top);
+  trace.set_window(0, 6);
+  for (uint64_t t = 0; t < 8; t++) {
+    if (t == 2) trace.set_enabled(false);
+    if (t == 4) trace.set_enabled(true);
+    if (t & 1) top.sub.tick();
+    trace.sample(t);
+  }
+  trace.close();
+
+  std::string vcd;
+  FILE* f = fopen(path, "rb");
+  EXPECT(f, "Trace file wasn't written");
+  char buf[4096];
+  size_t len;
+  while (f && (len = fread(buf, 1, sizeof(buf), f))) vcd.append(buf, len);
+  if (f) fclose(f);
+  remove(path);
+
+  auto has = [&](const char* s) { return vcd.find(s) != std::string::npos; };
+  EXPECT(has("$scope module ReflectTop $end\n$var wire 1 ! enable $end\n"
+             "$scope module sub $end\n$var wire 8 \" in $end\n"),
+         "Scopes or vars are missing from the header");
+  EXPECT(has("$var reg 16 % mem[0] $end\n$var reg 16 & mem[1] $end\n"),
+         "Arrays should be traced per element");
+  EXPECT(!has(" flag ") && !has(" big "), "Packed fields and sparse mems shouldn't be traced");
+
+  // count is id '$'. It goes 0 -> 1 at time 1, then tracing is off for times
+  // 2 and 3, then back on at 4 with the value from time 3. The window closes
+  // at time 6.
+  EXPECT(has("#0\n$dumpvars\n0!\nb1 \"\n"), "Initial values are missing");
+  EXPECT(has("#1\nb1 $\n#2\n"), "The change at time 1 is missing");
+  EXPECT(has("#2\n$dumpoff\n"), "Tracing should have been switched off");
+  EXPECT(has("#4\n$dumpon\n") && has("b10 $\n"), "Tracing should have resumed with a full dump");
+  EXPECT(has("#5\nb11 $\n#6\n$dumpoff\n"), "The change at time 5 is missing");
+  EXPECT(!has("#7"), "Samples outside the window should be dropped");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+
+struct CheckpointTest {
+  logic<8> pc;
+  logic<3> flags;
+  logic<32> ram[4096];
+};
+
+TestResults test_sim_checkpoint() {
+  TEST_INIT();
+
+  // Plain modules are saved as-is, with the zeros squeezed out.
+  CheckpointTest a = {};
+  a.pc = 0x42;
+  a.flags = 5;
+  a.ram[100] = 0xDEADBEEF;
+  a.ram[4095] = 1;
+
+  sim_checkpoint c;
+  c.save(a);
+  EXPECT(c.data.size() < 128, "Zero runs should have been collapsed");
+
+  CheckpointTest b;
+  memset((void*)&b, 0xFF, sizeof(b));
+  EXPECT(c.restore(b), "Restore failed");
+  EXPECT(memcmp(&a, &b, sizeof(a)) == 0, "Restored state doesn't match");
+
+  // sparse_mem pages are saved separately and reloaded into the existing
+  // sparse_mem, through the reflection tables.
+  ReflectTest r = {};
+  r.in = 7;
+  r.tick();
+  r.out = 0x123;
+  r.tick();
+  auto& big = r.*std::get<5>(mt_reflect<ReflectTest>::members);
+  big[3] = 0x11111111;
+  big[1000] = 0x22222222;
+
+  std::string checkpoint_path = test_temp_path("metron_test_checkpoint.mtckpt");
+  const char* path = checkpoint_path.c_str();
+  sim_checkpoint c2;
+  c2.save(r);
+  EXPECT(c2.write(path), "Couldn't write the checkpoint");
+
+  ReflectTest r2 = {};
+  auto& big2 = r2.*std::get<5>(mt_reflect<ReflectTest>::members);
+  big2[500] = 0x33333333;
+
+  sim_checkpoint c3;
+  EXPECT(c3.read(path), "Couldn't read the checkpoint back");
+  remove(path);
+  EXPECT(c3.restore(r2), "Restore failed");
+  EXPECT_EQ(r2.*std::get<2>(mt_reflect<ReflectTest>::members), 14, "Register wasn't restored");
+  EXPECT_EQ(r2.out, 0x123, "Output wasn't restored");
+  const auto& cbig2 = big2;
+  EXPECT_EQ(cbig2.get(3), 0x11111111, "Memory wasn't restored");
+  EXPECT_EQ(cbig2.get(1000), 0x22222222, "Memory wasn't restored");
+  EXPECT_EQ(cbig2.get(500), 0, "Restore should replace the memory's old contents");
+  EXPECT_EQ(big2.pages_allocated(), 1, "Only saved pages should be allocated");
+
+  big[3] = 0;
+  EXPECT_EQ(cbig2.get(3), 0x11111111, "Restored memory shouldn't alias the source");
+
+  // A truncated image fails without touching the module, and its memory
+  // keeps its own pages.
+  sim_checkpoint c4 = c3;
+  c4.data.resize(sizeof(sim_checkpoint_header) + 12);
+  r2.out = 0x456;
+  EXPECT(!c4.restore(r2), "Restore from a truncated checkpoint should fail");
+  EXPECT_EQ(r2.out, 0x456, "Failed restore shouldn't touch the module");
+  EXPECT_EQ(cbig2.get(1000), 0x22222222, "Failed restore shouldn't touch the memory");
+  big2[1000] = 0x44444444;
+  EXPECT_EQ(cbig2.get(1000), 0x44444444, "Memory should still be usable");
+
+  // Checkpoints only restore into the module they came from, even one with
+  // the same size.
+  struct CheckpointOther {
+    uint8_t bytes[sizeof(CheckpointTest)];
+  };
+  static_assert(sizeof(CheckpointOther) == sizeof(CheckpointTest));
+  CheckpointOther other = {};
+  ReflectTop top;
+  EXPECT(!c3.restore(top), "Restore into a different module should fail");
+  EXPECT(!c.restore(r2), "Restore into a different module should fail");
+  EXPECT(!c.restore(other), "Restore into a different module should fail");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+
+TestResults test_sim_fork() {
+  TEST_INIT();
+
+  CheckpointTest warm = {};
+  warm.pc = 10;
+  warm.ram[0] = 1000;
+
+  auto exits = sim_fork_variants(warm, 6, [](CheckpointTest& t, int i) {
+    t.pc = t.pc + i;
+    t.ram[0] = t.ram[0] + i;
+    return int(t.pc + t.ram[0] % 100);
+  }, 3);
+
+  EXPECT_EQ(int(exits.size()), 6, "Should have one result per variant");
+  for (int i = 0; i < 6; i++) {
+    EXPECT_EQ(exits[i], 10 + 2 * i, "Variant %d started from the wrong state", i);
+  }
+  EXPECT_EQ(warm.pc, 10, "Variants shouldn't change the warmed-up model");
+
+#ifndef _MSC_VER
+  // A child the testbench forked itself should still be waiting for it
+  // afterwards, with its own exit status.
+  pid_t own = fork();
+  if (own == 0) _exit(77);
+  exits = sim_fork_variants(warm, 4, [](CheckpointTest& t, int i) { return int(t.pc) + i; }, 2);
+  for (int i = 0; i < 4; i++) EXPECT_EQ(exits[i], 10 + i, "Variant %d has the wrong exit", i);
+
+  int status = 0;
+  EXPECT_EQ(waitpid(own, &status, 0), own, "sim_fork_variants reaped someone else's child");
+  EXPECT(WIFEXITED(status) && WEXITSTATUS(status) == 77, "Wrong exit status for our own child");
+#endif
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+
+struct LockstepTestPair {
+  logic<32> a;
+  logic<32> b;
+  logic<8> flags_a;
+  logic<8> flags_b;
+  uint64_t cycle = 0;
+  uint64_t bug_cycle = ~0ull;
+
+  void tock() {
+    a = a + 3;
+    b = b + 3;
+    flags_a = b8(a, 4);
+    flags_b = b8(b, 4) ^ (cycle == bug_cycle ? 0x10 : 0);
+    cycle++;
+  }
+
+  bool done() { return cycle == 50000; }
+
+  template <typename V>
+  void ports(V&& v) {
+    v("value", a, b);
+    v("flags", flags_a, flags_b);
+  }
+};
+
+// Stands in for a Verilated model built with --threads 4.
+struct ThreadedLockstepPair : public LockstepTestPair {
+  struct context {
+    int threads() const { return 4; }
+  };
+  struct model {
+    context ctx;
+    context* contextp() { return &ctx; }
+  };
+  model vl;
+};
+
+TestResults test_sim_lockstep() {
+  TEST_INIT();
+
+  LockstepTestPair good = {};
+  auto r = sim_lockstep<LockstepTestPair>(good).run(1000000);
+  EXPECT(r.ok && r.done, "Identical models should run to completion");
+  EXPECT_EQ(r.cycles, 50000, "Wrong cycle count");
+
+  for (uint64_t batch : {1000, 16384}) {
+    LockstepTestPair bad = {};
+    bad.bug_cycle = 23456;
+    r = sim_lockstep<LockstepTestPair>(bad, batch).run(1000000);
+    EXPECT(!r.ok, "The mismatch wasn't caught");
+    EXPECT_EQ(r.bad_cycle, 23456, "Bisection found the wrong cycle");
+    EXPECT(r.bad_port && strcmp(r.bad_port, "flags") == 0, "Replay found the wrong port");
+    EXPECT_EQ(r.mt_value ^ r.vl_value, 0x10, "Replay reported the wrong values");
+  }
+
+  // Batches can only be forked when nothing else in the process needs a
+  // thread, otherwise every cycle is compared directly and the result is the
+  // same.
+  {
+    LockstepTestPair pair = {};
+    sim_lockstep<LockstepTestPair> lockstep(pair);
+#ifndef _MSC_VER
+    EXPECT(lockstep.can_fork(), "A single-threaded pair should fork");
+#endif
+
+    sim_trace trace;
+    trace.open(test_temp_path("metron_test_lockstep.vcd").c_str());
+    EXPECT(!lockstep.can_fork(), "Shouldn't fork with a trace open");
+    trace.close();
+    remove(test_temp_path("metron_test_lockstep.vcd").c_str());
+
+#ifdef __linux__
+    std::atomic<bool> quit = false;
+    std::thread other([&]() {
+      while (!quit) std::this_thread::yield();
+    });
+    EXPECT(!lockstep.can_fork(), "Shouldn't fork with another thread running");
+    quit = true;
+    other.join();
+#endif
+  }
+
+  {
+    ThreadedLockstepPair bad = {};
+    bad.bug_cycle = 23456;
+    sim_lockstep<ThreadedLockstepPair> lockstep(bad, 1000);
+    EXPECT(!lockstep.can_fork(), "Shouldn't fork a model built with --threads");
+    r = lockstep.run(1000000);
+    EXPECT_EQ(r.bad_cycle, 23456, "Direct comparison found the wrong cycle");
+    EXPECT(r.bad_port && strcmp(r.bad_port, "flags") == 0, "Direct comparison found the wrong port");
+  }
+
+  LockstepTestPair slow = {};
+  r = sim_lockstep<LockstepTestPair>(slow).run(100);
+  EXPECT(r.ok && !r.done && r.cycles == 100, "Should stop at max_cycles");
+
+  // Wide ports are compared by hashing their bits, for both storage layouts.
+  logic<100> w1 = logic<100>(1) << 90, w2 = w1, w3 = w1 + 1;
+  EXPECT(sim_port_bits(w1) == sim_port_bits(w2), "Equal 100-bit ports should match");
+  EXPECT(sim_port_bits(w1) != sim_port_bits(w3), "Different 100-bit ports shouldn't match");
+  logic<200> x1 = logic<200>(1) << 150, x2 = x1, x3 = x1 + 1;
+  EXPECT(sim_port_bits(x1) == sim_port_bits(x2), "Equal 200-bit ports should match");
+  EXPECT(sim_port_bits(x1) != sim_port_bits(x3), "Different 200-bit ports shouldn't match");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+// The adapters themselves are tested against real "metron --bind" output in
+// test_emitters.cpp. This covers the port conversions they're built on.
+
+TestResults test_sim_bind() {
+  TEST_INIT();
+
+  // Round trips through Verilator-style ports of each size class.
+  uint8_t p8 = 0;
+  sim_vl_put(p8, logic<5>(0x15));
+  EXPECT_EQ(p8, 0x15, "Narrow put failed");
+  EXPECT_EQ(sim_vl_get<logic<5>>(uint8_t(0x35)).get(), 0x15, "Narrow get should mask");
+
+  uint64_t p64 = 0;
+  sim_vl_put(p64, logic<40>(0xAB12345678ull));
+  EXPECT_EQ(p64, 0xAB12345678ull, "64-bit put failed");
+
+  uint32_t words[6] = {};
+  logic<160> w;
+  w.x[0] = 0x1111111122222222ull;
+  w.x[1] = 0x3333333344444444ull;
+  w.x[2] = 0x55555555ull;
+  sim_vl_put(words, w);
+  EXPECT_EQ(words[0], 0x22222222, "Wide put failed");
+  EXPECT_EQ(words[3], 0x33333333, "Wide put failed");
+  EXPECT_EQ(words[4], 0x55555555, "Wide put failed");
+  auto w2 = sim_vl_get<logic<160>>(words);
+  EXPECT(w2 == w, "Wide round trip failed");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+
+TestResults test_sim_bench() {
+  TEST_INIT();
+
+  LockstepTestPair pair = {};
+  uint64_t total = 0;
+  int calls = 0;
+  auto r = sim_bench(1000, 300, 4, [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) pair.tock();
+    sim_bench_keep(pair);
+    total += n;
+    calls++;
+    return n / 2;
+  });
+
+  EXPECT_EQ(calls, 5, "Warmup plus one call per trial");
+  EXPECT_EQ(total, 4300, "Wrong number of cycles simulated");
+  EXPECT_EQ(pair.cycle, 4300, "The body's work should not be optimized away");
+  EXPECT_EQ(r.cycles, 1000, "Wrong cycles per trial");
+  EXPECT_EQ(r.instret, 500, "Wrong instret per trial");
+  EXPECT_EQ(r.trials, 4, "Wrong trial count");
+  EXPECT(r.mhz_best > 0 && r.mhz_best >= r.mhz_median, "Best rate should be at least the median");
+
+  // When trials retire different counts, instret and mips_median both come
+  // from the median trial.
+  calls = 0;
+  r = sim_bench(1000, 0, 5, [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) pair.tock();
+    sim_bench_keep(pair);
+    return uint64_t(++calls * 100);
+  });
+  EXPECT(r.instret % 100 == 0 && r.instret >= 100 && r.instret <= 500, "instret should come from a trial");
+  double ratio = r.mips_median / r.mhz_median;
+  EXPECT(ratio > r.instret / 1000.0 * 0.999 && ratio < r.instret / 1000.0 * 1.001,
+         "mips_median should use the median trial's instret");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+// What "metron --profile" writes for a module with a submodule - a scope in
+// every method except the leaf func.
+
+class ProfileSub {
+ public:
+  void tick(logic<8> x) { MT_PROF_SCOPE("ProfileSub::tick");
+    acc = acc + x;
+  }
+  logic<8> get() const { return acc; }
+
+ private:
+  logic<8> acc;
+};
+
+class ProfileTop {
+ public:
+  void tock() { MT_PROF_SCOPE("ProfileTop::tock");
+    sub.tick(count);
+    if (b4(count) == 0) tick_slow();
+    tick_count();
+  }
+
+ private:
+  void tick_count() { MT_PROF_SCOPE("ProfileTop::tick_count");
+    count = count + 1;
+  }
+  void tick_slow() { MT_PROF_SCOPE("ProfileTop::tick_slow");
+    sub.tick(sub.get());
+  }
+
+  logic<8> count;
+  ProfileSub sub;
+};
+
+TestResults test_sim_profile() {
+  TEST_INIT();
+
+  mt_prof_reset();
+  ProfileTop top;
+  for (int i = 0; i < 160; i++) top.tock();
+
+  // Find nodes by call path in this thread's tree.
+  auto& t = mt_prof_this_thread();
+  auto find = [&](int parent, const char* name) {
+    for (int c = t.nodes[parent].first_child; c >= 0; c = t.nodes[c].next_sibling) {
+      if (strcmp(t.nodes[c].name, name) == 0) return c;
+    }
+    return -1;
+  };
+
+  int tock = find(0, "ProfileTop::tock");
+  EXPECT(tock >= 0, "Missing top-level method");
+  if (tock >= 0) {
+    int direct = find(tock, "ProfileSub::tick");
+    int slow = find(tock, "ProfileTop::tick_slow");
+    int nested = slow >= 0 ? find(slow, "ProfileSub::tick") : -1;
+    EXPECT(direct >= 0 && slow >= 0 && nested >= 0, "Missing call paths");
+    EXPECT_EQ(t.nodes[tock].calls, 160, "Wrong call count");
+    if (direct >= 0 && nested >= 0) {
+      EXPECT_EQ(t.nodes[direct].calls, 160, "Wrong call count");
+      EXPECT_EQ(t.nodes[nested].calls, 10, "Calls should be split by path");
+      EXPECT(t.nodes[tock].ticks >= t.nodes[slow].ticks, "Callers include their callees");
+    }
+  }
+  EXPECT_EQ(t.current, 0, "Scopes should unwind to the root");
+
+  FILE* f = tmpfile();
+  mt_prof_report(f);
+  rewind(f);
+  std::string report;
+  char buf[256];
+  while (fgets(buf, sizeof(buf), f)) report += buf;
+  fclose(f);
+  EXPECT(report.find("      ProfileSub::tick") != std::string::npos, "Report should be indented by depth");
+
+  // Otherwise the report gets printed again when the tests exit.
+  mt_prof_reset();
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+// A module instrumented by hand the way "metron --coverage" does it, with an
+// if, an if without an else, a switch without a default and two registers.
+// The generator's own output is tested in test_emitters.cpp.
+
+class CoverageMod {
+ public:
+  void tick(logic<2> op, logic<4> x) { MT_COV_TOGGLE(0, this->acc); MT_COV_TOGGLE(1, this->flag);
+    if (x == 0) { MT_COV_BRANCH(0);
+      flag = 1;
+    } else { MT_COV_BRANCH(1);
+      flag = 0;
+    }
+    if (flag) { MT_COV_BRANCH(2); acc = 0; } else { MT_COV_BRANCH(3); }
+    switch (op) { default: MT_COV_BRANCH(7); break;
+      case 0: MT_COV_BRANCH(4); acc = acc + x; break;
+      case 1: MT_COV_BRANCH(5); acc = acc - x; break;
+      case 2: MT_COV_BRANCH(6); acc = acc ^ x; break;
+    }
+  }
+
+ private:
+  logic<4> acc;
+  logic<1> flag;
+ static inline mt_cov_module mt_cov{"CoverageMod", "coverage_mod.h", {{1, 15, "if"}, {1, 15, "else"}, {2, 15, "if"}, {2, 15, "else"}, {3, 7, "case 0"}, {4, 7, "case 1"}, {5, 7, "case 2"}, {6, 5, "default"}}, {{"acc", mt_cov_width<decltype(acc)>()}, {"flag", mt_cov_width<decltype(flag)>()}}};};
+
+TestResults test_sim_coverage() {
+  TEST_INIT();
+
+  mt_cov_reset();
+  CoverageMod mod;
+  mod.tick(0, 3);
+  mod.tick(0, 4);
+  mod.tick(2, 1);
+
+  std::map<std::string, std::array<uint64_t, 2>> cov;
+  mt_cov_collect(cov);
+  EXPECT_EQ(cov["arm CoverageMod coverage_mod.h 1:15 if"][0], 0, "x was never 0");
+  EXPECT_EQ(cov["arm CoverageMod coverage_mod.h 1:15 else"][0], 1, "Missed else");
+  EXPECT_EQ(cov["arm CoverageMod coverage_mod.h 2:15 else"][0], 1, "Missed implicit else");
+  EXPECT_EQ(cov["arm CoverageMod coverage_mod.h 4:7 case 1"][0], 0, "op was never 1");
+  EXPECT_EQ(cov["arm CoverageMod coverage_mod.h 5:7 case 2"][0], 1, "Missed case");
+  EXPECT_EQ(cov["arm CoverageMod coverage_mod.h 6:5 default"][0], 0, "op was never 3");
+
+  // acc went 0 -> 3 -> 7 -> 6.
+  EXPECT_EQ(cov["reg CoverageMod acc 4"][0], 0b0111, "Wrong rising bits");
+  EXPECT_EQ(cov["reg CoverageMod acc 4"][1], 0b0001, "Wrong falling bits");
+  EXPECT_EQ(cov["reg CoverageMod flag 1"][0], 0, "flag never changed");
+
+  // A second run that takes the other arms merges with the first.
+  mt_cov_reset();
+  mod.tick(1, 0);
+  mod.tick(3, 2);
+
+  FILE* f = tmpfile();
+  mt_cov_write(f, cov);
+  rewind(f);
+  std::map<std::string, std::array<uint64_t, 2>> merged;
+  mt_cov_collect(merged);
+  mt_cov_load(f, merged);
+  fclose(f);
+
+  EXPECT_EQ(merged.size(), cov.size(), "Runs should have the same keys");
+  int arms = 0;
+  for (auto& [key, bits] : merged) {
+    if (key.starts_with("arm ")) arms += int(bits[0]);
+  }
+  EXPECT_EQ(arms, 8, "Every arm should be covered after both runs");
+  EXPECT_EQ(merged["reg CoverageMod flag 1"][0], 1, "flag rose in the second run");
+  EXPECT_EQ(merged["reg CoverageMod flag 1"][1], 1, "flag fell in the second run");
+
+  // Merges into a coverage file wait for its lock, so parallel runs don't
+  // lose each other's bits.
+  auto cov_path = test_temp_path("metron_test_coverage.cov");
+  remove(cov_path.c_str());
+
+  auto held = std::make_unique<mt_cov_file_lock>(cov_path.c_str());
+  EXPECT(held->locked, "Couldn't take the lock");
+  {
+    mt_cov_file_lock second(cov_path.c_str(), 50);
+    EXPECT(!second.locked, "A held lock shouldn't be taken over");
+  }
+  std::atomic<bool> done = false;
+  std::thread waiter([&]() {
+    auto c = cov;
+    mt_cov_merge(cov_path.c_str(), c);
+    done = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT(!done, "Merge should wait for the lock");
+  held.reset();
+  waiter.join();
+  EXPECT(done, "Merge should finish once the lock is released");
+
+  std::vector<std::thread> runs;
+  for (int t = 0; t < 4; t++) {
+    runs.emplace_back([&, t]() {
+      for (int i = 0; i < 10; i++) {
+        std::map<std::string, std::array<uint64_t, 2>> c;
+        c["arm Parallel p.h " + std::to_string(t * 10 + i) + ":1 if"][0] = 1;
+        mt_cov_merge(cov_path.c_str(), c);
+      }
+    });
+  }
+  for (auto& r : runs) r.join();
+
+  std::map<std::string, std::array<uint64_t, 2>> on_disk;
+  if (FILE* in = fopen(cov_path.c_str(), "rb")) {
+    mt_cov_load(in, on_disk);
+    fclose(in);
+  }
+  remove(cov_path.c_str());
+  EXPECT_EQ(on_disk.size(), cov.size() + 40, "Parallel merges lost entries");
+
+  // Otherwise this gets written to metron.cov when the tests exit.
+  mt_cov_reset();
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+// A pulse generator that's idle while its delay counts up. 'buggy' makes
+// sim_skip() forget that the first idle cycle clears the pulse.
+
+class FastForwardTest {
+ public:
+  logic<1> get_pulse() const { return pulse; }
+  logic<16> get_count() const { return count; }
+  logic<10> get_delay() const { return delay; }
+
+  void tick() {
+    if (delay < delay_max) {
+      delay = delay + 1;
+      pulse = 0;
+    } else {
+      delay = 0;
+      pulse = 1;
+      count = count + 1;
+    }
+  }
+
+  // metron_noconvert
+  uint64_t sim_idle_cycles() const {
+    return delay < delay_max ? delay_max - delay.get() : 0;
+  }
+
+  // metron_noconvert
+  void sim_skip(uint64_t cycles) {
+    delay = delay.get() + cycles;
+    if (!buggy) pulse = 0;
+  }
+
+  bool buggy = false;
+
+ private:
+  static const int delay_max = 999;
+  logic<10> delay;
+  logic<1> pulse;
+  logic<16> count;
+};
+
+TestResults test_sim_fast_forward() {
+  TEST_INIT();
+
+  auto step = [](FastForwardTest& t) { t.tick(); };
+  const uint64_t cycles = 100003;
+
+  FastForwardTest stepped;
+  for (uint64_t i = 0; i < cycles; i++) stepped.tick();
+
+  FastForwardTest fast;
+  auto r = sim_fast_forward(fast, cycles, step);
+  EXPECT(r.ok, "Unchecked runs can't fail");
+  EXPECT_EQ(r.cycles, cycles, "Wrong cycle count");
+  EXPECT_EQ(r.stepped + r.skipped, cycles, "Every cycle is either stepped or skipped");
+  EXPECT_EQ(r.stepped, 100, "Only the pulses should be stepped");
+  EXPECT_EQ(r.skips, 101, "One skip per delay, plus the partial one at the end");
+
+  EXPECT_EQ(fast.get_delay(), stepped.get_delay(), "Fast-forwarded state should match");
+  EXPECT_EQ(fast.get_pulse(), stepped.get_pulse(), "Fast-forwarded state should match");
+  EXPECT_EQ(fast.get_count(), stepped.get_count(), "Fast-forwarded state should match");
+  EXPECT_EQ(fast.get_count(), 100, "Wrong pulse count");
+
+  // Check mode passes good hooks and stops at the first bad skip.
+  FastForwardTest checked;
+  r = sim_fast_forward(checked, cycles, step, true);
+  EXPECT(r.ok && r.skips == 101, "Good hooks should pass the check");
+
+  FastForwardTest buggy;
+  buggy.buggy = true;
+  r = sim_fast_forward(buggy, cycles, step, true);
+  EXPECT(!r.ok, "Check mode should catch the bad skip");
+  EXPECT_EQ(r.bad_cycle, 1000, "The first skip after a pulse is the bad one");
+  EXPECT_EQ(r.bad_length, 999, "Wrong bad skip length");
+  EXPECT_EQ(buggy.get_pulse(), 0, "A failed check leaves the stepped state");
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
+
+TestResults test_sim() {
+  TEST_INIT("Test the simulation runtime");
+
+  results << test_sim_reflect();
+  results << test_sim_trace();
+  results << test_sim_checkpoint();
+  results << test_sim_fork();
+  results << test_sim_lockstep();
+  results << test_sim_bind();
+  results << test_sim_bench();
+  results << test_sim_profile();
+  results << test_sim_coverage();
+  results << test_sim_fast_forward();
+
+  TEST_DONE();
+}
+
+//------------------------------------------------------------------------------
@@ -1,5 +1,7 @@
 #include "test_utils.h"
 
+#include <filesystem>
+
 //#include "MtCursor.h"
 #include "MtModLibrary.h"
 #include "MtModule.h"
@@ -62,6 +64,12 @@ bool find_iws(const std::string& a, const std::string& b) {
 
 //------------------------------------------------------------------------------
 
+std::string test_temp_path(const char* name) {
+  return (std::filesystem::temp_directory_path() / name).string();
+}
+
+//------------------------------------------------------------------------------
+
 void parse_simple(std::string src, MtModLibrary& library) {
   /*
   std::string out;
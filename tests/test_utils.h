@@ -13,6 +13,11 @@ bool comp_iws(const std::string& a, const std::string& b);
 bool find_iws(const char* a, const char* b);
 bool find_iws(const std::string& a, const std::string& b);
 
+//------------------------------------------------------------------------------
+// Path for a scratch file called 'name' in the system's temp directory.
+
+std::string test_temp_path(const char* name);
+
 //------------------------------------------------------------------------------
 // Translate a single block of C++ (possibly containing multiple modules) into
 // a single block of Verilog.
@@ -0,0 +1,239 @@
+#include <stdio.h>
+
+#include <string>
+
+#include "MtTranslate.h"
+#include "MtUtils.h"
+#include "submodules/CLI11/include/CLI/App.hpp"
+#include "submodules/CLI11/include/CLI/Config.hpp"
+#include "submodules/CLI11/include/CLI/Formatter.hpp"
+
+//------------------------------------------------------------------------------
+// Translator throughput benchmark. Generates a synthetic Metron design with a
+// configurable shape, runs it through the whole load -> trace -> emit pipeline
+// and reports lines per second. The generator is deterministic, so the same
+// options always produce the same source.
+
+struct GenConfig {
+  int modules = 16;  // Number of module classes in the design
+  int fields = 8;    // Registers per module
+  int methods = 4;   // Tick methods per module (clamped to 'fields')
+  int depth = 4;     // Length of the const function call chain in each tock
+  int fanout = 8;    // Number of cases in each tick's switch statement
+  int nesting = 4;   // Length of each submodule chain, 1 = no submodules
+};
+
+//------------------------------------------------------------------------------
+
+void gen_module(const GenConfig& c, int index, std::string& out) {
+  int methods = c.methods < c.fields ? c.methods : c.fields;
+  if (methods < 1) methods = 1;
+  bool has_sub = (c.nesting > 1) && (index % c.nesting != 0);
+
+  out += str_printf("class gen_mod_%d {\n", index);
+  out += "public:\n";
+  out += "  logic<16> tock(logic<16> in) {\n";
+
+  if (c.depth > 0) {
+    out += "    logic<16> x = func_0(in);\n";
+  } else {
+    out += "    logic<16> x = in;\n";
+  }
+
+  if (has_sub) {
+    out += "    logic<16> s = sub.tock(x);\n";
+  } else {
+    out += "    logic<16> s = x + 1;\n";
+  }
+
+  out += "    logic<16> result = 0";
+  for (int f = 0; f < c.fields; f++) out += str_printf(" + reg_%d", f);
+  out += ";\n";
+
+  for (int m = 0; m < methods; m++) {
+    out += str_printf("    tick_%d(%s);\n", m, (m & 1) ? "s" : "x");
+  }
+
+  out += "    return result;\n";
+  out += "  }\n";
+  out += "\n";
+  out += "private:\n";
+
+  //----------
+  // Const function chain, emitted as SV functions.
+
+  for (int d = 0; d < c.depth; d++) {
+    out += str_printf("  logic<16> func_%d(logic<16> a) const {\n", d);
+    if (d + 1 < c.depth) {
+      out += str_printf("    return func_%d(a + %d);\n", d + 1, d + 1);
+    } else {
+      out += str_printf("    return a ^ %d;\n", d + 1);
+    }
+    out += "  }\n\n";
+  }
+
+  //----------
+  // Ticks, each owning every 'methods'th register.
+
+  for (int m = 0; m < methods; m++) {
+    out += str_printf("  void tick_%d(logic<16> a) {\n", m);
+    out += "    switch (a) {\n";
+    for (int k = 0; k < c.fanout; k++) {
+      out += str_printf("      case %d:\n", k);
+      for (int f = m; f < c.fields; f += methods) {
+        out += str_printf("        reg_%d = reg_%d + %d;\n", f, f, k + 1);
+      }
+      out += "        break;\n";
+    }
+    out += "    }\n";
+    out += "  }\n\n";
+  }
+
+  for (int f = 0; f < c.fields; f++) {
+    out += str_printf("  logic<16> reg_%d;\n", f);
+  }
+
+  if (has_sub) {
+    out += str_printf("  gen_mod_%d sub;\n", index - 1);
+  }
+
+  out += "};\n\n";
+}
+
+//------------------------------------------------------------------------------
+
+std::string gen_design(const GenConfig& c) {
+  std::string out;
+  out += "#include \"metron_tools.h\"\n\n";
+  out += "// Synthetic design generated by translate_benchmark\n\n";
+  for (int i = 0; i < c.modules; i++) gen_module(c, i, out);
+  return out;
+}
+
+//------------------------------------------------------------------------------
+
+struct BenchResult {
+  bool ok = false;
+  int lines = 0;
+  int out_bytes = 0;
+  double parse_ms = 0;
+  double process_ms = 0;
+  double emit_ms = 0;
+
+  double total_ms() const { return parse_ms + process_ms + emit_ms; }
+  double lines_per_sec() const { return lines / (total_ms() / 1000.0); }
+};
+
+//------------------------------------------------------------------------------
+
+BenchResult run_pipeline(const std::string& src) {
+  BenchResult r;
+
+  auto result = mt_translate({{"gen.h", src}});
+
+  r.ok = result.ok;
+  r.lines = result.stats.source_lines;
+  r.out_bytes = result.stats.output_bytes;
+  r.parse_ms = double(result.stats.parse_ns) / 1000000.0;
+  r.process_ms = double(result.stats.process_ns) / 1000000.0;
+  r.emit_ms = double(result.stats.emit_ns) / 1000000.0;
+  return r;
+}
+
+//------------------------------------------------------------------------------
+// Run the pipeline 'reps' times and keep the fastest run of each phase.
+
+BenchResult run_best(const std::string& src, int reps) {
+  BenchResult best = run_pipeline(src);
+  for (int i = 1; i < reps && best.ok; i++) {
+    BenchResult r = run_pipeline(src);
+    if (r.parse_ms < best.parse_ms) best.parse_ms = r.parse_ms;
+    if (r.process_ms < best.process_ms) best.process_ms = r.process_ms;
+    if (r.emit_ms < best.emit_ms) best.emit_ms = r.emit_ms;
+  }
+  return best;
+}
+
+//------------------------------------------------------------------------------
+
+void print_header() {
+  printf("%8s %8s %8s %8s %8s %8s %8s %10s %10s %10s %10s %12s\n", "modules",
+         "fields", "methods", "depth", "fanout", "nesting", "lines",
+         "parse_ms", "process_ms", "emit_ms", "total_ms", "lines/sec");
+}
+
+void print_row(const GenConfig& c, const BenchResult& r) {
+  printf("%8d %8d %8d %8d %8d %8d %8d %10.3f %10.3f %10.3f %10.3f %12.0f\n",
+         c.modules, c.fields, c.methods, c.depth, c.fanout, c.nesting, r.lines,
+         r.parse_ms, r.process_ms, r.emit_ms, r.total_ms(), r.lines_per_sec());
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+  CLI::App app{"Metron translator throughput benchmark"};
+
+  GenConfig config;
+  int reps = 5;
+  std::string sweep;
+  bool dump = false;
+
+  // clang-format off
+  app.add_option("--modules", config.modules, "Number of generated modules");
+  app.add_option("--fields",  config.fields,  "Registers per module");
+  app.add_option("--methods", config.methods, "Tick methods per module");
+  app.add_option("--depth",   config.depth,   "Const function call depth per tock");
+  app.add_option("--fanout",  config.fanout,  "Switch cases per tick");
+  app.add_option("--nesting", config.nesting, "Submodule chain length");
+  app.add_option("-r,--reps", reps,           "Repetitions per data point, fastest is reported");
+  app.add_option("-s,--sweep", sweep,         "Double this parameter from 1 up to its configured value (modules, fields, methods, depth, fanout, nesting)");
+  app.add_flag  ("-d,--dump", dump,           "Print the generated source and exit");
+  // clang-format on
+
+  CLI11_PARSE(app, argc, argv);
+
+  if (dump) {
+    printf("%s", gen_design(config).c_str());
+    return 0;
+  }
+
+  int* swept = nullptr;
+  if (sweep == "modules") swept = &config.modules;
+  if (sweep == "fields")  swept = &config.fields;
+  if (sweep == "methods") swept = &config.methods;
+  if (sweep == "depth")   swept = &config.depth;
+  if (sweep == "fanout")  swept = &config.fanout;
+  if (sweep == "nesting") swept = &config.nesting;
+
+  if (sweep.size() && !swept) {
+    printf("Unknown sweep parameter '%s'\n", sweep.c_str());
+    return -1;
+  }
+
+  std::vector<GenConfig> points;
+  if (swept) {
+    int max = *swept;
+    for (int v = 1; v < max; v *= 2) {
+      *swept = v;
+      points.push_back(config);
+    }
+    *swept = max;
+  }
+  points.push_back(config);
+
+  print_header();
+  for (const auto& c : points) {
+    auto r = run_best(gen_design(c), reps);
+    if (!r.ok) {
+      printf("Translation failed for the configuration below, rerun with "
+             "--dump to see the source\n");
+      print_row(c, r);
+      return -1;
+    }
+    print_row(c, r);
+  }
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------